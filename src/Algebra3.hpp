@@ -27,6 +27,12 @@
 //  -   Use standard C++ headers
 //  -   Formatting cleanup
 //
+//  Packet extensions
+//  -   Lanes<T, N> of scalars and Vec2P packets of 2D vectors, for
+//      evaluating geometric code on several points at once with SIMD
+//  -   Vectors are trivially copyable (defaulted copy and assignment) and
+//      constexpr-constructible from their components
+//
 #ifndef __Algebra3_hpp__
 #define __Algebra3_hpp__
 
@@ -34,8 +40,13 @@
 #include <cctype>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 
+#if defined(__SSE2__)
+#  include <immintrin.h>
+#endif
+
 // this line defines a new type: pointer to a function which returns
 // double and takes as argument a double
 typedef double (*ALG3_FCT_PTR)(double);
@@ -81,15 +92,15 @@ class Vec2
     // Constructors
 
     Vec2();
-    Vec2(double const x, double const y);
+    constexpr Vec2(double const x, double const y) : n{x, y} {}
     explicit Vec2(double const d);
-    Vec2(Vec2 const & v);                // copy constructor
+    Vec2(Vec2 const & v) = default;      // copy constructor
     Vec2(Vec3 const & v);                // cast v3 to v2
     Vec2(Vec3 const & v, int dropAxis);  // cast v3 to v2
 
     // Assignment operators
 
-    Vec2 & operator  = (Vec2 const & v);     // assignment of a Vec2
+    Vec2 & operator  = (Vec2 const & v) = default;  // assignment of a Vec2
     Vec2 & operator += (Vec2 const & v);     // incrementation by a Vec2
     Vec2 & operator -= (Vec2 const & v);     // decrementation by a Vec2
     Vec2 & operator *= (double const d);     // multiplication by a constant
@@ -159,9 +170,9 @@ class Vec3
     // Constructors
 
     Vec3();
-    Vec3(double const x, double const y, double const z);
+    constexpr Vec3(double const x, double const y, double const z) : n{x, y, z} {}
     explicit Vec3(double const d);
-    Vec3(Vec3 const & v);                    // copy constructor
+    Vec3(Vec3 const & v) = default;          // copy constructor
     Vec3(Vec2 const & v);                    // cast v2 to v3
     Vec3(Vec2 const & v, double d);          // cast v2 to v3
     Vec3(Vec4 const & v);                    // cast v4 to v3
@@ -169,7 +180,7 @@ class Vec3
 
     // Assignment operators
 
-    Vec3 & operator  = (Vec3 const & v);     // assignment of a Vec3
+    Vec3 & operator  = (Vec3 const & v) = default;  // assignment of a Vec3
     Vec3 & operator += (Vec3 const & v);     // incrementation by a Vec3
     Vec3 & operator -= (Vec3 const & v);     // decrementation by a Vec3
     Vec3 & operator *= (double const d);     // multiplication by a constant
@@ -245,15 +256,15 @@ class Vec4
     // Constructors
 
     Vec4();
-    Vec4(double const x, double const y, double const z, double const w);
+    constexpr Vec4(double const x, double const y, double const z, double const w) : n{x, y, z, w} {}
     explicit Vec4(double const d);
-    Vec4(Vec4 const & v);                        // copy constructor
+    Vec4(Vec4 const & v) = default;              // copy constructor
     Vec4(Vec3 const & v);                        // cast Vec3 to Vec4
     Vec4(Vec3 const & v, double const d);        // cast Vec3 to Vec4
 
     // Assignment operators
 
-    Vec4 & operator  = (Vec4 const & v);       // assignment of a Vec4
+    Vec4 & operator  = (Vec4 const & v) = default;  // assignment of a Vec4
     Vec4 & operator += (Vec4 const & v);       // incrementation by a Vec4
     Vec4 & operator -= (Vec4 const & v);       // decrementation by a Vec4
     Vec4 & operator *= (double const d);       // multiplication by a constant
@@ -470,15 +481,9 @@ Mat4 perspective3D(double const d);                             // perspective 3
 
 inline Vec2::Vec2() {}
 
-inline Vec2::Vec2(double const x, double const y)
-{ n[0] = x; n[1] = y; }
-
 inline Vec2::Vec2(double const d)
 { n[0] = n[1] = d; }
 
-inline Vec2::Vec2(Vec2 const & v)
-{ n[0] = v.n[0]; n[1] = v.n[1]; }
-
 inline Vec2::Vec2(Vec3 const & v) // it is up to caller to avoid divide-by-zero
 { n[0] = v.n[0]/v.n[2]; n[1] = v.n[1]/v.n[2]; };
 
@@ -495,9 +500,6 @@ inline Vec2::Vec2(Vec3 const & v, int dropAxis)
 
 // ASSIGNMENT OPERATORS
 
-inline Vec2 & Vec2::operator = (Vec2 const & v)
-{ n[0] = v.n[0]; n[1] = v.n[1]; return *this; }
-
 inline Vec2 & Vec2::operator += (Vec2 const & v)
 { n[0] += v.n[0]; n[1] += v.n[1]; return *this; }
 
@@ -647,15 +649,9 @@ inline Vec2 prod(Vec2 const & a, Vec2 const & b)
 
 inline Vec3::Vec3() {}
 
-inline Vec3::Vec3(double const x, double const y, double const z)
-{ n[0] = x; n[1] = y; n[2] = z; }
-
 inline Vec3::Vec3(double const d)
 { n[0] = n[1] = n[2] = d; }
 
-inline Vec3::Vec3(Vec3 const & v)
-{ n[0] = v.n[0]; n[1] = v.n[1]; n[2] = v.n[2]; }
-
 inline Vec3::Vec3(Vec2 const & v)
 { n[0] = v.n[0]; n[1] = v.n[1]; n[2] = 1.0; }
 
@@ -680,9 +676,6 @@ inline Vec3::Vec3(Vec4 const & v, int dropAxis)
 
 // ASSIGNMENT OPERATORS
 
-inline Vec3 & Vec3::operator = (Vec3 const & v)
-{ n[0] = v.n[0]; n[1] = v.n[1]; n[2] = v.n[2]; return *this; }
-
 inline Vec3 & Vec3::operator += (Vec3 const & v)
 { n[0] += v.n[0]; n[1] += v.n[1]; n[2] += v.n[2]; return *this; }
 
@@ -840,16 +833,9 @@ inline Vec3 prod(Vec3 const & a, Vec3 const & b)
 
 inline Vec4::Vec4() {}
 
-inline Vec4::Vec4(double const x, double const y, double const z,
-                  double const w)
-{ n[0] = x; n[1] = y; n[2] = z; n[3] = w; }
-
 inline Vec4::Vec4(double const d)
 {  n[0] = n[1] = n[2] = n[3] = d; }
 
-inline Vec4::Vec4(Vec4 const & v)
-{ n[0] = v.n[0]; n[1] = v.n[1]; n[2] = v.n[2]; n[3] = v.n[3]; }
-
 inline Vec4::Vec4(Vec3 const & v)
 { n[0] = v.n[0]; n[1] = v.n[1]; n[2] = v.n[2]; n[3] = 1.0; }
 
@@ -859,10 +845,6 @@ inline Vec4::Vec4(Vec3 const & v, double const d)
 
 // ASSIGNMENT OPERATORS
 
-inline Vec4 & Vec4::operator = (Vec4 const & v)
-{ n[0] = v.n[0]; n[1] = v.n[1]; n[2] = v.n[2]; n[3] = v.n[3];
-return *this; }
-
 inline Vec4 & Vec4::operator += (Vec4 const & v)
 { n[0] += v.n[0]; n[1] += v.n[1]; n[2] += v.n[2]; n[3] += v.n[3];
 return *this; }
@@ -1418,4 +1400,318 @@ inline Mat4 perspective3D(double const d)
               Vec4(0.0, 0.0, 1.0/d, 0.0)); }
 
 
+/****************************************************************
+*                                                               *
+*          SIMD lanes and packets of 2D vectors                 *
+*                                                               *
+****************************************************************/
+//
+//  Lanes<T, N> holds N scalars, one per SIMD lane, and Vec2P<L> a
+//  2D vector per lane of L, so that geometry written once against
+//  Vec2P (with the same operators as Vec2) evaluates N points at a
+//  time. Lanes are stored as native vectors of the widest width the
+//  target enables, 16 bytes with SSE2 and 32 with AVX, using the
+//  GCC/Clang vector extensions, so each operation compiles to one
+//  instruction per native vector. Operations mixing packets and
+//  Vec2 broadcast the Vec2, and evaluate in the same order as the
+//  scalar operators, so double packets give bit-identical results.
+//
+
+#if defined(__AVX__)
+#  define ALG3_SIMD_BYTES 32
+#else
+#  define ALG3_SIMD_BYTES 16
+#endif
+
+template <typename T> struct NativeLanes;
+
+template <> struct NativeLanes<double>
+{
+  typedef double Type __attribute__((vector_size(ALG3_SIMD_BYTES)));
+  typedef long long Mask __attribute__((vector_size(ALG3_SIMD_BYTES)));
+};
+
+template <> struct NativeLanes<float>
+{
+  typedef float Type __attribute__((vector_size(ALG3_SIMD_BYTES)));
+  typedef int Mask __attribute__((vector_size(ALG3_SIMD_BYTES)));
+};
+
+template <typename T, int N> class LaneMask;
+
+template <typename T, int N>
+class Lanes
+{
+  public:
+
+    typedef T Scalar;
+    typedef typename NativeLanes<T>::Type Native;
+
+    enum { WIDTH = N, NATIVE_WIDTH = ALG3_SIMD_BYTES / sizeof(T), NUM_NATIVE = N / NATIVE_WIDTH };
+
+    Native v[NUM_NATIVE];
+
+    // Constructors
+
+    Lanes() {}
+    Lanes(T const s)                               // s in every lane
+    { for (int k = 0; k < NUM_NATIVE; ++k) v[k] = Native{} + s; }
+
+    static Lanes load(T const * p)                 // lanes from N consecutive scalars
+    { Lanes r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+
+    void store(T * p) const                        // lanes to N consecutive scalars
+    { std::memcpy(p, v, sizeof(v)); }
+
+    // Indexing
+
+    T operator [] (int i) const { return v[i / NATIVE_WIDTH][i % NATIVE_WIDTH]; }
+    void set(int i, T const s) { v[i / NATIVE_WIDTH][i % NATIVE_WIDTH] = s; }
+
+    // Assignment operators
+
+    Lanes & operator += (Lanes const & a) { for (int k = 0; k < NUM_NATIVE; ++k) v[k] += a.v[k]; return *this; }
+    Lanes & operator -= (Lanes const & a) { for (int k = 0; k < NUM_NATIVE; ++k) v[k] -= a.v[k]; return *this; }
+    Lanes & operator *= (Lanes const & a) { for (int k = 0; k < NUM_NATIVE; ++k) v[k] *= a.v[k]; return *this; }
+    Lanes & operator /= (Lanes const & a) { for (int k = 0; k < NUM_NATIVE; ++k) v[k] /= a.v[k]; return *this; }
+
+}; // class Lanes
+
+template <typename T, int N>
+class LaneMask
+{
+  public:
+
+    typedef typename NativeLanes<T>::Mask Native;
+
+    Native m[Lanes<T, N>::NUM_NATIVE];   // all bits set in lanes where true
+
+    bool any() const                     // true in any lane?
+    { for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k)
+        for (int i = 0; i < Lanes<T, N>::NATIVE_WIDTH; ++i)
+          if (m[k][i]) return true;
+      return false; }
+
+    bool all() const                     // true in every lane?
+    { for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k)
+        for (int i = 0; i < Lanes<T, N>::NATIVE_WIDTH; ++i)
+          if (!m[k][i]) return false;
+      return true; }
+
+}; // class LaneMask
+
+typedef Lanes<double, 4> Lanes4d;
+typedef Lanes<float, 8> Lanes8f;
+
+// ARITHMETIC, lane by lane
+
+#define ALG3_LANES_BINARY_OP(OP) \
+template <typename T, int N> inline Lanes<T, N> operator OP (Lanes<T, N> const & a, Lanes<T, N> const & b) \
+{ Lanes<T, N> r; for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k) r.v[k] = a.v[k] OP b.v[k]; return r; } \
+template <typename T, int N> inline Lanes<T, N> operator OP (Lanes<T, N> const & a, T const s) \
+{ return a OP Lanes<T, N>(s); } \
+template <typename T, int N> inline Lanes<T, N> operator OP (T const s, Lanes<T, N> const & b) \
+{ return Lanes<T, N>(s) OP b; }
+
+ALG3_LANES_BINARY_OP(+)
+ALG3_LANES_BINARY_OP(-)
+ALG3_LANES_BINARY_OP(*)
+ALG3_LANES_BINARY_OP(/)
+
+#undef ALG3_LANES_BINARY_OP
+
+#define ALG3_LANES_COMPARISON(OP) \
+template <typename T, int N> inline LaneMask<T, N> operator OP (Lanes<T, N> const & a, Lanes<T, N> const & b) \
+{ LaneMask<T, N> r; for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k) r.m[k] = (a.v[k] OP b.v[k]); return r; } \
+template <typename T, int N> inline LaneMask<T, N> operator OP (Lanes<T, N> const & a, T const s) \
+{ return a OP Lanes<T, N>(s); }
+
+ALG3_LANES_COMPARISON(<)
+ALG3_LANES_COMPARISON(>)
+ALG3_LANES_COMPARISON(<=)
+ALG3_LANES_COMPARISON(>=)
+
+#undef ALG3_LANES_COMPARISON
+
+template <typename T, int N>
+inline Lanes<T, N> operator - (Lanes<T, N> const & a)
+{ Lanes<T, N> r; for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k) r.v[k] = -a.v[k]; return r; }
+
+template <typename T, int N>
+inline LaneMask<T, N> operator | (LaneMask<T, N> const & a, LaneMask<T, N> const & b)
+{ LaneMask<T, N> r; for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k) r.m[k] = a.m[k] | b.m[k]; return r; }
+
+template <typename T, int N>
+inline LaneMask<T, N> operator & (LaneMask<T, N> const & a, LaneMask<T, N> const & b)
+{ LaneMask<T, N> r; for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k) r.m[k] = a.m[k] & b.m[k]; return r; }
+
+template <typename T, int N>
+inline LaneMask<T, N> operator ~ (LaneMask<T, N> const & a)
+{ LaneMask<T, N> r; for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k) r.m[k] = ~a.m[k]; return r; }
+
+// SPECIAL FUNCTIONS, lane by lane
+
+template <typename T, int N>
+inline Lanes<T, N> select(LaneMask<T, N> const & m, Lanes<T, N> const & a, Lanes<T, N> const & b) // m ? a : b
+{
+  typedef typename LaneMask<T, N>::Native Bits;
+  Lanes<T, N> r;
+  for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k)
+    r.v[k] = (typename Lanes<T, N>::Native)((m.m[k] & (Bits)a.v[k]) | (~m.m[k] & (Bits)b.v[k]));
+  return r;
+}
+
+template <typename T, int N>
+inline Lanes<T, N> fabs(Lanes<T, N> const & a)
+{ return select(a < T(0), -a, a); }
+
+template <typename T, int N>
+inline Lanes<T, N> truncInt(Lanes<T, N> const & a) // (T)(int)a, i.e. truncated toward zero
+{ Lanes<T, N> r; for (int i = 0; i < N; ++i) r.set(i, (T)(int)a[i]); return r; }
+
+inline NativeLanes<double>::Type nativeSqrt(NativeLanes<double>::Type const & x)
+{
+#if defined(__AVX__)
+  return _mm256_sqrt_pd(x);
+#elif defined(__SSE2__)
+  return _mm_sqrt_pd(x);
+#else
+  NativeLanes<double>::Type r;
+  for (int i = 0; i < (int)(ALG3_SIMD_BYTES / sizeof(double)); ++i) r[i] = std::sqrt(x[i]);
+  return r;
+#endif
+}
+
+inline NativeLanes<float>::Type nativeSqrt(NativeLanes<float>::Type const & x)
+{
+#if defined(__AVX__)
+  return _mm256_sqrt_ps(x);
+#elif defined(__SSE2__)
+  return _mm_sqrt_ps(x);
+#else
+  NativeLanes<float>::Type r;
+  for (int i = 0; i < (int)(ALG3_SIMD_BYTES / sizeof(float)); ++i) r[i] = std::sqrt(x[i]);
+  return r;
+#endif
+}
+
+template <typename T, int N>
+inline Lanes<T, N> sqrt(Lanes<T, N> const & a)
+{ Lanes<T, N> r; for (int k = 0; k < Lanes<T, N>::NUM_NATIVE; ++k) r.v[k] = nativeSqrt(a.v[k]); return r; }
+
+/****************************************************************
+*                                                               *
+*               Packet of 2D vectors                            *
+*                                                               *
+****************************************************************/
+
+template <typename L>
+class Vec2P
+{
+  protected:
+
+    L n[2];
+
+  public:
+
+    typedef L LaneType;
+    typedef typename L::Scalar Scalar;
+
+    // Constructors
+
+    Vec2P() {}
+    Vec2P(L const & x, L const & y) { n[0] = x; n[1] = y; }
+    explicit Vec2P(Vec2 const & v)                  // v in every lane
+    { n[0] = L((Scalar)v[0]); n[1] = L((Scalar)v[1]); }
+
+    static Vec2P gather(Vec2 const * v)             // lane i from v[i]
+    {
+      Vec2P r;
+      for (int i = 0; i < L::WIDTH; ++i) { r.n[0].set(i, (Scalar)v[i][0]); r.n[1].set(i, (Scalar)v[i][1]); }
+      return r;
+    }
+
+    Vec2 lane(int i) const { return Vec2(n[0][i], n[1][i]); }   // vector in lane i
+
+    // Assignment operators
+
+    Vec2P & operator += (Vec2P const & v) { n[0] += v.n[0]; n[1] += v.n[1]; return *this; }
+    Vec2P & operator -= (Vec2P const & v) { n[0] -= v.n[0]; n[1] -= v.n[1]; return *this; }
+    Vec2P & operator *= (L const & d) { n[0] *= d; n[1] *= d; return *this; }
+    Vec2P & operator /= (L const & d) { n[0] /= d; n[1] /= d; return *this; }
+
+    L & x() { return n[0]; }           // indexing by axis name
+    L & y() { return n[1]; }
+    L const & x() const { return n[0]; }
+    L const & y() const { return n[1]; }
+
+    // special functions
+
+    L length() const { return sqrt(length2()); }              // length in each lane
+    L length2() const { return n[0]*n[0] + n[1]*n[1]; }       // squared length in each lane
+    Vec2P perp() const { return Vec2P(-n[1], n[0]); }         // perpendicular of same length, going ccw
+
+}; // class Vec2P
+
+typedef Vec2P<Lanes4d> Vec2x4d;
+typedef Vec2P<Lanes8f> Vec2x8f;
+
+// FRIENDS, as free functions; a Vec2 operand is broadcast to every lane
+
+template <typename L> inline Vec2P<L> operator - (Vec2P<L> const & a)
+{ return Vec2P<L>(-a.x(), -a.y()); }
+
+template <typename L> inline Vec2P<L> operator + (Vec2P<L> const & a, Vec2P<L> const & b)
+{ return Vec2P<L>(a.x() + b.x(), a.y() + b.y()); }
+
+template <typename L> inline Vec2P<L> operator + (Vec2P<L> const & a, Vec2 const & b)
+{ return a + Vec2P<L>(b); }
+
+template <typename L> inline Vec2P<L> operator + (Vec2 const & a, Vec2P<L> const & b)
+{ return Vec2P<L>(a) + b; }
+
+template <typename L> inline Vec2P<L> operator - (Vec2P<L> const & a, Vec2P<L> const & b)
+{ return Vec2P<L>(a.x() - b.x(), a.y() - b.y()); }
+
+template <typename L> inline Vec2P<L> operator - (Vec2P<L> const & a, Vec2 const & b)
+{ return a - Vec2P<L>(b); }
+
+template <typename L> inline Vec2P<L> operator - (Vec2 const & a, Vec2P<L> const & b)
+{ return Vec2P<L>(a) - b; }
+
+template <typename T, int N> inline Vec2P< Lanes<T, N> > operator * (Vec2P< Lanes<T, N> > const & a, Lanes<T, N> const & d)
+{ return Vec2P< Lanes<T, N> >(d*a.x(), d*a.y()); }
+
+template <typename T, int N> inline Vec2P< Lanes<T, N> > operator * (Lanes<T, N> const & d, Vec2P< Lanes<T, N> > const & a)
+{ return a*d; }
+
+template <typename T, int N> inline Vec2P< Lanes<T, N> > operator * (Vec2 const & a, Lanes<T, N> const & d)
+{ return Vec2P< Lanes<T, N> >(d*(T)a[0], d*(T)a[1]); }
+
+template <typename T, int N> inline Vec2P< Lanes<T, N> > operator * (Lanes<T, N> const & d, Vec2 const & a)
+{ return a*d; }
+
+template <typename L> inline L operator * (Vec2P<L> const & a, Vec2P<L> const & b)       // dot product
+{ return a.x()*b.x() + a.y()*b.y(); }
+
+template <typename L> inline L operator * (Vec2P<L> const & a, Vec2 const & b)           // dot product
+{ return a * Vec2P<L>(b); }
+
+template <typename L> inline L operator * (Vec2 const & a, Vec2P<L> const & b)           // dot product
+{ return Vec2P<L>(a) * b; }
+
+template <typename T, int N> inline Vec2P< Lanes<T, N> > operator / (Vec2P< Lanes<T, N> > const & a, Lanes<T, N> const & d)
+{ Lanes<T, N> d_inv = T(1) / d; return Vec2P< Lanes<T, N> >(a.x()*d_inv, a.y()*d_inv); }
+
+template <typename L> inline Vec2P<L> prod(Vec2P<L> const & a, Vec2P<L> const & b)       // term by term *
+{ return Vec2P<L>(a.x() * b.x(), a.y() * b.y()); }
+
+template <typename L> inline Vec2P<L> lerp(Vec2P<L> const & a, Vec2P<L> const & b, L const & t)
+{ return a + t * (b - a); }
+
+template <typename T, int N>
+inline Vec2P< Lanes<T, N> > select(LaneMask<T, N> const & m, Vec2P< Lanes<T, N> > const & a, Vec2P< Lanes<T, N> > const & b)
+{ return Vec2P< Lanes<T, N> >(select(m, a.x(), b.x()), select(m, a.y(), b.y())); }
+
+
 #endif // __Algebra3_hpp__
@@ -0,0 +1,166 @@
+#include "DeepZoom.hpp"
+#include "MipPyramid.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/** Create a directory unless it already exists. */
+static bool
+makeDirectory(std::string const & path)
+{
+  if (mkdir(path.c_str(), 0777) == 0 || errno == EEXIST)
+    return true;
+
+  std::cerr << "Could not create directory " << path << ": " << std::strerror(errno) << std::endl;
+  return false;
+}
+
+bool
+DeepZoomWriter::isDeepZoomPath(std::string const & path)
+{
+  if (path.length() < 4)
+    return false;
+
+  std::string ext = path.substr(path.length() - 4);
+  for (size_t i = 0; i < ext.length(); ++i)
+    ext[i] = (char)std::tolower(ext[i]);
+
+  return ext == ".dzi";
+}
+
+bool
+DeepZoomWriter::open(std::string const & path, int w_, int h_, int nc_, int tile_size_)
+{
+  if (w_ <= 0 || h_ <= 0 || tile_size_ <= 0)
+  {
+    std::cerr << "Invalid deep zoom image dimensions" << std::endl;
+    return false;
+  }
+
+  dzi_path = path;
+  files_dir = (isDeepZoomPath(path) ? path.substr(0, path.length() - 4) : path) + "_files";
+  w = w_;
+  h = h_;
+  nc = nc_;
+  tile_size = tile_size_ + (tile_size_ % 2);  // quadrants of coarser tiles must line up
+  num_written = 0;
+  num_expected = 0;
+  failed = false;
+
+  // Halve the dimensions, rounding up, down to a single pixel
+  level_w.assign(1, w);
+  level_h.assign(1, h);
+  while (level_w.back() > 1 || level_h.back() > 1)
+  {
+    level_w.push_back((level_w.back() + 1) / 2);
+    level_h.push_back((level_h.back() + 1) / 2);
+  }
+
+  std::reverse(level_w.begin(), level_w.end());
+  std::reverse(level_h.begin(), level_h.end());
+  pending.assign(level_w.size(), std::map<long, Pending>());
+
+  if (!makeDirectory(files_dir))
+    return false;
+
+  for (size_t level = 0; level < level_w.size(); ++level)
+  {
+    std::ostringstream dir;
+    dir << files_dir << '/' << level;
+    if (!makeDirectory(dir.str()))
+      return false;
+
+    num_expected += (long)numCols((int)level) * numRows((int)level);
+  }
+
+  return true;
+}
+
+void
+DeepZoomWriter::putTile(int level, int col, int row, Image const & tile)
+{
+  std::ostringstream tile_path;
+  tile_path << files_dir << '/' << level << '/' << col << '_' << row << ".png";
+  bool saved = tile.save(tile_path.str());
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    num_written++;
+    failed = failed || !saved;
+  }
+
+  if (level == 0)
+    return;
+
+  // Reduce the tile into its quadrant of the parent tile, outside the lock
+  Image reduced = MipPyramid::reduce(tile);
+  int parent_col = col / 2, parent_row = row / 2;
+  int col_off = (col % 2) * tile_size / 2, row_off = (row % 2) * tile_size / 2;
+
+  Image parent;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    int parent_level = level - 1;
+    long index = (long)parent_row * numCols(parent_level) + parent_col;
+    std::map<long, Pending>::iterator it = pending[parent_level].find(index);
+    if (it == pending[parent_level].end())
+    {
+      Pending p;
+      p.tile = Image(std::min(tile_size, level_w[parent_level] - parent_col * tile_size),
+                     std::min(tile_size, level_h[parent_level] - parent_row * tile_size), nc);
+      p.num_received = 0;
+      it = pending[parent_level].insert(std::make_pair(index, p)).first;
+    }
+
+    Image & dst = it->second.tile;
+    int copy_w = std::min(reduced.width(), dst.width() - col_off);
+    int copy_h = std::min(reduced.height(), dst.height() - row_off);
+    for (int r = 0; r < copy_h; ++r)
+      std::memcpy(dst.pixel(row_off + r, col_off), reduced.scanline(r), (size_t)copy_w * nc);
+
+    // The parent is complete once all of its quadrants that exist at this level are in
+    int num_children = (std::min(2 * parent_col + 1, numCols(level) - 1) - 2 * parent_col + 1)
+                     * (std::min(2 * parent_row + 1, numRows(level) - 1) - 2 * parent_row + 1);
+    if (++it->second.num_received < num_children)
+      return;
+
+    parent = it->second.tile;
+    pending[parent_level].erase(it);
+  }
+
+  putTile(level - 1, parent_col, parent_row, parent);
+}
+
+bool
+DeepZoomWriter::close()
+{
+  if (failed || num_written != num_expected)
+  {
+    std::cerr << "Deep zoom pyramid " << dzi_path << " is incomplete: " << num_written << " of " << num_expected
+              << " tiles written" << std::endl;
+    return false;
+  }
+
+  std::ofstream out(dzi_path.c_str());
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"png\" Overlap=\"0\" TileSize=\""
+      << tile_size << "\">\n"
+      << "  <Size Width=\"" << w << "\" Height=\"" << h << "\"/>\n"
+      << "</Image>\n";
+
+  out.close();
+  if (!out)
+  {
+    std::cerr << "Could not write " << dzi_path << std::endl;
+    return false;
+  }
+
+  return true;
+}
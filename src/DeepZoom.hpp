@@ -0,0 +1,76 @@
+#ifndef __DeepZoom_hpp__
+#define __DeepZoom_hpp__
+
+#include "Image.hpp"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Writes an image as a Deep Zoom (DZI) tile pyramid, as read by web deep-zoom viewers, from its full-resolution tiles as they
+ * are rendered, without ever holding the whole image. For an output path "name.dzi", tiles go to
+ * "name_files/<level>/<column>_<row>.png", level 0 being a single pixel and each level doubling the dimensions of the
+ * previous one (rounding up) up to the full resolution, and the XML descriptor goes to "name.dzi" once every tile has been
+ * written. Tiles do not overlap.
+ *
+ * Each full-resolution tile is saved as soon as it is put, then reduced by averaging 2x2 blocks of pixels (as in
+ * MipPyramid::reduce) into its quadrant of the tile of the next coarser level, which is saved and reduced in turn once all its
+ * quadrants are in. Only partially assembled coarser tiles are kept in memory, so rendering tiles in row order keeps about one
+ * row of tiles per level alive. Tiles may be put in any order, and from several threads at once.
+ */
+class DeepZoomWriter
+{
+  private:
+    /** A tile of a coarser level that is being assembled from its quadrants. */
+    struct Pending
+    {
+      Image tile;
+      int num_received;
+    };
+
+    std::string dzi_path, files_dir;
+    int w, h, nc, tile_size;
+    std::vector<int> level_w, level_h;               ///< Dimensions of each level, coarsest first
+    std::vector< std::map<long, Pending> > pending;  ///< Tiles being assembled at each level, by index
+    long num_written, num_expected;
+    bool failed;
+    std::mutex mutex;
+
+    /** Get the number of columns of tiles at a level. */
+    int numCols(int level) const { return (level_w[level] + tile_size - 1) / tile_size; }
+
+    /** Get the number of rows of tiles at a level. */
+    int numRows(int level) const { return (level_h[level] + tile_size - 1) / tile_size; }
+
+    /** Save a complete tile of a level, and pass it on to the next coarser level. */
+    void putTile(int level, int col, int row, Image const & tile);
+
+  public:
+    /** Default constructor. */
+    DeepZoomWriter() : w(0), h(0), nc(0), tile_size(0), num_written(0), num_expected(0), failed(false) {}
+
+    /**
+     * Start writing a \a w_ x \a h_ image with \a nc_ channels to a pyramid of \a tile_size_ x \a tile_size_ tiles (rounded up
+     * to an even size), creating its tile directories.
+     */
+    bool open(std::string const & path, int w_, int h_, int nc_, int tile_size_ = 256);
+
+    /** Get the size of the tiles. */
+    int tileSize() const { return tile_size; }
+
+    /**
+     * Put the full-resolution tile at column \a col and row \a row of the tile grid, which must have the full tile size, or
+     * whatever is left of the image at its right and bottom edges.
+     */
+    void putTile(int col, int row, Image const & tile) { putTile((int)level_w.size() - 1, col, row, tile); }
+
+    /** Write the descriptor. Returns false if any tile is missing or could not be saved. */
+    bool close();
+
+    /** Check if a path names a Deep Zoom descriptor, i.e. ends in .dzi. */
+    static bool isDeepZoomPath(std::string const & path);
+
+}; // class DeepZoomWriter
+
+#endif // __DeepZoom_hpp__
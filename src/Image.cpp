@@ -1,4 +1,5 @@
 #include "Image.hpp"
+#include "Parallel.hpp"
 #include "stb_image.hpp"
 #include "stb_image_write.hpp"
 #include <algorithm>
@@ -6,6 +7,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <vector>
 
 std::string
 toLower(std::string const & s)
@@ -15,6 +17,13 @@ toLower(std::string const & s)
   return result;
 }
 
+/** Run the restart intervals of JPEGs being decoded on the worker threads. */
+static void
+stbiParallelFor(stbi_parallel_task task, void * data, int count)
+{
+  parallelFor(0, count, [&](int i) { task(data, i); });
+}
+
 Image::Image(int w_, int h_, int nc_)
 : w(0), h(0), nc(0), buf(NULL)
 {
@@ -27,31 +36,53 @@ Image::Image(std::string const & path, int req_nc)
     throw ("Could not load image from " + path).c_str();
 }
 
-Image::Image(Image const & src)
-: w(0), h(0), nc(0), buf(NULL)
+Image &
+Image::operator=(Image const & src)
 {
-  *this = src;
+  w = src.w;
+  h = src.h;
+  nc = src.nc;
+  storage = src.storage;
+  buf = src.buf;
+
+  return *this;
 }
 
-Image::~Image()
+void
+Image::adopt(unsigned char * pixels)
 {
-  std::free(buf);
+  if (pixels)
+    storage.reset(pixels, std::free);
+  else
+    storage.reset();
+
+  buf = pixels;
 }
 
-Image &
-Image::operator=(Image const & src)
+void
+Image::detach()
 {
-  resize(src.w, src.h, src.nc);
-  std::memcpy(buf, src.buf, (size_t)(w * h * nc));
-
-  return *this;
+  size_t num_bytes = (size_t)w * h * nc;
+  unsigned char * copy = (unsigned char *)std::malloc(num_bytes);
+  std::memcpy(copy, buf, num_bytes);
+  adopt(copy);
 }
 
 bool
-Image::load(std::string const & path, int req_nc)
+Image::load(std::string const & path, int req_nc, int scale)
 {
-  std::free(buf);
-  buf = stbi_load(path.c_str(), &w, &h, &nc, req_nc);
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+  {
+    std::cerr << "Images can only be loaded at 1/1, 1/2, 1/4 or 1/8 scale" << std::endl;
+    return false;
+  }
+
+  // Install the parallel loop for the decoder on first use (thread-safely, as a local static)
+  static bool const PARALLEL_DECODE = (stbi_set_parallel_for(stbiParallelFor), true);
+  (void)PARALLEL_DECODE;
+
+  int decoded_scale = scale;
+  adopt(stbi_load_reduced(path.c_str(), &w, &h, &nc, req_nc, &decoded_scale));
 
   if (!buf)
   {
@@ -62,6 +93,61 @@ Image::load(std::string const & path, int req_nc)
   if (req_nc != 0)
     nc = req_nc;
 
+  // Formats the decoder cannot reduce come back at full size
+  if (decoded_scale < scale)
+    boxReduce(scale / decoded_scale);
+
+  return true;
+}
+
+void
+Image::boxReduce(int factor)
+{
+  int rw = (w + factor - 1) / factor, rh = (h + factor - 1) / factor;
+  unsigned char * reduced = (unsigned char *)std::malloc((size_t)rw * rh * nc);
+  std::vector<unsigned int> sums((size_t)rw * nc);
+
+  for (int rrow = 0; rrow < rh; ++rrow)
+  {
+    int row0 = rrow * factor, row1 = std::min(row0 + factor, h);
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int row = row0; row < row1; ++row)
+    {
+      unsigned char const * src = scanline(row);
+      for (int rcol = 0; rcol < rw; ++rcol)
+      {
+        unsigned int * sum = &sums[(size_t)rcol * nc];
+        int col1 = std::min((rcol + 1) * factor, w);
+        for (int col = rcol * factor; col < col1; ++col, src += nc)
+          for (int c = 0; c < nc; ++c)
+            sum[c] += src[c];
+      }
+    }
+
+    // Boxes at the right and bottom edges may be partial
+    unsigned char * dst = reduced + (size_t)rrow * rw * nc;
+    for (int rcol = 0; rcol < rw; ++rcol)
+    {
+      unsigned int count = (unsigned int)((row1 - row0) * (std::min((rcol + 1) * factor, w) - rcol * factor));
+      for (int c = 0; c < nc; ++c, ++dst)
+        *dst = (unsigned char)((sums[(size_t)rcol * nc + c] + count / 2) / count);
+    }
+  }
+
+  adopt(reduced);
+  w = rw;
+  h = rh;
+}
+
+bool
+Image::readInfo(std::string const & path, int & w_, int & h_, int & nc_)
+{
+  if (!stbi_info(path.c_str(), &w_, &h_, &nc_))
+  {
+    std::cerr << "Could not read image information from " << path << std::endl;
+    return false;
+  }
+
   return true;
 }
 
@@ -106,13 +192,8 @@ Image::resize(int w_, int h_, int nc_)
     return false;
   }
 
-  std::free(buf);
-
   size_t num_bytes = (size_t)(w_ * h_ * nc_);
-  if (num_bytes > 0)
-    buf = (unsigned char *)std::malloc(num_bytes);
-  else
-    buf = NULL;
+  adopt(num_bytes > 0 ? (unsigned char *)std::malloc(num_bytes) : NULL);
 
   w = w_;
   h = h_;
@@ -1,14 +1,32 @@
 #ifndef __Image_hpp__
 #define __Image_hpp__
 
+#include <memory>
 #include <string>
 
-/** An image with 1 byte per channel. */
+/**
+ * An image with 1 byte per channel. Copies of an image share its pixels, which are reference-counted, so images can be passed
+ * around and kept by value at constant cost. The pixels are copied on write: mutable access to pixels shared with other
+ * images, through the non-const data(), pixel() or scanline(), first gives the image a copy of its own, so pointers they
+ * return must not be written through once the image has been copied. Like any other change to an image, that access must not
+ * race with other accesses to the same Image object, so a shared image must be unshared (see unshare()) before its pixels are
+ * written from several threads. Images sharing pixels may be used from different threads.
+ */
 class Image
 {
   private:
     int w, h, nc;
-    unsigned char * buf;
+    std::shared_ptr<unsigned char> storage;  ///< Owner of the pixels, shared by copies
+    unsigned char * buf;                     ///< The pixels, i.e. storage.get()
+
+    /** Take ownership of pixels allocated with malloc(), releasing the current ones. */
+    void adopt(unsigned char * pixels);
+
+    /** Replace the pixels by a copy of their own. */
+    void detach();
+
+    /** Shrink the image by \a factor in each dimension (rounding up), averaging each factor x factor box of pixels. */
+    void boxReduce(int factor);
 
   public:
     /** Default constructor. */
@@ -23,30 +41,43 @@ class Image
      */
     Image(std::string const & path, int req_nc = 0);
 
-    /** Copy constructor. */
-    Image(Image const & src);
+    /** Copy constructor. Shares the pixels of \a src. */
+    Image(Image const & src) : w(src.w), h(src.h), nc(src.nc), storage(src.storage), buf(src.buf) {}
 
-    /** Destructor. */
-    ~Image();
-
-    /** Assignment operator. */
+    /** Assignment operator. Shares the pixels of \a src. */
     Image & operator=(Image const & src);
 
     /**
      * Load from a file. \a req_nc is the requested number of channels in the loaded image. If it is zero, the number of
      * channels in the disk image will be preserved. Else, the image will be converted to \a req_nc channels.
+     *
+     * A \a scale of 2, 4 or 8 loads a proxy of the image at that fraction of its size in each dimension (rounding up). JPEGs
+     * are decoded at the reduced size directly, which skips most of the decoding work; other formats are decoded in full and
+     * then box-filtered.
+     */
+    bool load(std::string const & path, int req_nc = 0, int scale = 1);
+
+    /**
+     * Read the dimensions and number of channels of an image file without decoding its pixels. Returns false if the file is not
+     * a readable image.
      */
-    bool load(std::string const & path, int req_nc = 0);
+    static bool readInfo(std::string const & path, int & w_, int & h_, int & nc_);
 
     /** Save to a file. */
     bool save(std::string const & path) const;
 
     /**
      * Resize the image to a given width, height and number of channels. Existing data will be destroyed unless the dimensions
-     * match exactly.
+     * match exactly, in which case the pixels stay shared with any other images until they are written.
      */
     bool resize(int w_, int h_, int nc_);
 
+    /** Check if the pixels are shared with other images. */
+    bool isShared() const { return storage.use_count() > 1; }
+
+    /** Give the image a copy of its pixels of its own if they are shared with other images. */
+    void unshare() { if (isShared()) detach(); }
+
     /** Check if this image has dimensions identical to another image. */
     bool hasSameDimsAs(Image const & other) const;
 
@@ -62,20 +93,20 @@ class Image
     /** Get a pointer to the pixel data. */
     unsigned char const * data() const { return buf; }
 
-    /** Get a pointer to the pixel data. */
-    unsigned char * data() { return buf; }
+    /** Get a pointer to the pixel data, unsharing them first. */
+    unsigned char * data() { unshare(); return buf; }
 
     /** Get a pointer to the first byte of a pixel. */
     unsigned char const * pixel(int row, int col) const { return buf + (row * w + col) * nc; }
 
-    /** Get a pointer to the first byte of a pixel. */
-    unsigned char * pixel(int row, int col) { return buf + (row * w + col) * nc; }
+    /** Get a pointer to the first byte of a pixel, unsharing the pixels first. */
+    unsigned char * pixel(int row, int col) { unshare(); return buf + (row * w + col) * nc; }
 
     /** Get a pointer to the first byte of a row of pixels. */
     unsigned char const * scanline(int row) const { return buf + (row * w) * nc; }
 
-    /** Get a pointer to the first byte of a row of pixels. */
-    unsigned char * scanline(int row) { return buf + (row * w) * nc; }
+    /** Get a pointer to the first byte of a row of pixels, unsharing the pixels first. */
+    unsigned char * scanline(int row) { unshare(); return buf + (row * w) * nc; }
 
 }; // class Image
 
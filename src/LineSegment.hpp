@@ -3,9 +3,13 @@
 
 #include "Algebra3.hpp"
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 
-/** A line segment, defined by its start and end point. */
+/**
+ * A line segment, defined by its start and end point. A segment whose endpoints coincide stands for a point feature, e.g. a
+ * landmark, which the warp evaluates as a point rather than as a line (see PointPairTerms).
+ */
 class LineSegment
 {
   private:
@@ -22,6 +26,12 @@ class LineSegment
       pts[1] = e;
     }
 
+    /** Construct a point feature, i.e. a segment with both endpoints at \a p. */
+    static LineSegment point(Vec2 const & p) { return LineSegment(p, p); }
+
+    /** Check if the segment is a point feature, i.e. its endpoints coincide. */
+    bool isPoint() const { return pts[0] == pts[1]; }
+
     Vec2 const & start() const { return pts[0]; }  ///< Get the start of the segment.
     Vec2 const & end()   const { return pts[1]; }  ///< Get the end of the segment.
 
@@ -91,10 +101,32 @@ class LineSegment
         return (p - start()).length();
       // projects after end()
       else
-        return abs(v);
+        return std::abs((int)v);  // the distance has always been truncated, through the int overload of abs
       return 0;
     }
 
+    /** Get the parametric locations of a packet of points projected onto the line, as lineParameter() does for one point. */
+    template <typename L> L lineParameter(Vec2P<L> const & p) const
+    {
+      return ((end() - start()) * (p - start()))/length2();
+    }
+
+    /** Get the signed distances of a packet of points from the line, as signedLineDistance() does for one point. */
+    template <typename L> L signedLineDistance(Vec2P<L> const & p) const
+    {
+      return ((p - start()) * perp())/length();
+    }
+
+    /**
+     * Get the unsigned distances of a packet of points from the segment, as segmentDistance() does for one point, given their
+     * line parameters and signed line distances.
+     */
+    template <typename L> L segmentDistance(Vec2P<L> const & p, L const & u, L const & v) const
+    {
+      typedef typename L::Scalar Scalar;
+      return select((u < Scalar(0)) | (u > Scalar(1)), (p - start()).length(), truncInt(fabs(v)));
+    }
+
     /** Get the unsigned distance of a point from the segment. */
     double segmentDistance(Vec2 const & p) const
     {
@@ -0,0 +1,140 @@
+#include "MeshWarp.hpp"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+
+MeshWarp::MeshWarp(std::vector<LineSegment> const & seg_start, std::vector<LineSegment> const & seg_end, double t,
+                   Vec2 const & lo, Vec2 const & hi)
+{
+  std::vector<Vec2> points;
+  std::vector< std::pair<int, int> > constraints;
+
+  // The first four vertices are the box corners, filled in once the extent of the segments is known
+  points.resize(4);
+  sources.resize(4);
+
+  Vec2 box_lo(std::min(lo.x(), hi.x()), std::min(lo.y(), hi.y()));
+  Vec2 box_hi(std::max(lo.x(), hi.x()), std::max(lo.y(), hi.y()));
+  std::map<std::pair<double, double>, int> index;
+  for (size_t i = 0; i < seg_start.size(); ++i)
+  {
+    LineSegment at = seg_start[i].lerp(seg_end[i], t);
+    int ends[2];
+    for (int k = 0; k < (seg_start[i].isPoint() ? 1 : 2); ++k)
+    {
+      Vec2 const & p = at.endpoint(k);
+      std::pair<std::map<std::pair<double, double>, int>::iterator, bool> inserted
+          = index.insert(std::make_pair(std::make_pair(p.x(), p.y()), (int)points.size()));
+      ends[k] = inserted.first->second;
+      if (!inserted.second)
+        continue;
+
+      points.push_back(p);
+      sources.push_back(seg_start[i].endpoint(k));
+      box_lo = Vec2(std::min(box_lo.x(), p.x()), std::min(box_lo.y(), p.y()));
+      box_hi = Vec2(std::max(box_hi.x(), p.x()), std::max(box_hi.y(), p.y()));
+    }
+
+    if (!seg_start[i].isPoint())
+      constraints.push_back(std::make_pair(ends[0], ends[1]));
+  }
+
+  // Keep every vertex strictly inside the box, whose corners stay in place
+  double margin = 1 + 1e-3 * std::max(box_hi.x() - box_lo.x(), box_hi.y() - box_lo.y());
+  box_lo -= Vec2(margin, margin);
+  box_hi += Vec2(margin, margin);
+  points[0] = Vec2(box_lo.x(), box_lo.y());
+  points[1] = Vec2(box_hi.x(), box_lo.y());
+  points[2] = Vec2(box_hi.x(), box_hi.y());
+  points[3] = Vec2(box_lo.x(), box_hi.y());
+  for (int k = 0; k < 4; ++k)
+    sources[(size_t)k] = points[(size_t)k];
+
+  mesh = Triangulation(points, 4, constraints);
+}
+
+/** Get the x coordinate at height \a y of the edge from \a a down to \a b, the same way for both triangles sharing it. */
+static double
+edgeX(Vec2 const & a, Vec2 const & b, double y)
+{
+  return a.x() + (y - a.y()) * (b.x() - a.x()) / (b.y() - a.y());
+}
+
+/** Order points by y, then x. */
+static bool
+aboveOf(Vec2 const & a, Vec2 const & b)
+{
+  return a.y() < b.y() || (a.y() == b.y() && a.x() < b.x());
+}
+
+void
+MeshWarp::rasterize(WarpField & field, int col0, int row0, int col1, int row1) const
+{
+  // Pixels no triangle claims, which only rounding could cause, are left undisplaced
+  for (int row = row0; row < row1; ++row)
+    std::fill(field.data() + ((size_t)row * field.width() + col0) * 2, field.data() + ((size_t)row * field.width() + col1) * 2,
+              0.0f);
+
+  // Triangles are scanned in the pixel coordinates of the grid the field is a window of
+  GridTransform to_pixel = field.gridTransform().inverse();
+  int ox = field.originCol(), oy = field.originRow();
+  col0 += ox; col1 += ox;
+  row0 += oy; row1 += oy;
+
+  std::vector<Vec2> const & points = mesh.points();
+  for (int i = 0; i < mesh.numTriangles(); ++i)
+  {
+    Triangulation::Triangle const & tri = mesh.triangle(i);
+    Vec2 p[3], d[3];
+    for (int k = 0; k < 3; ++k)
+    {
+      p[k] = to_pixel.apply(points[(size_t)tri.v[k]]);
+      d[k] = sources[(size_t)tri.v[k]] - points[(size_t)tri.v[k]];
+    }
+
+    // The barycentric coordinates (u, v) of vertices 1 and 2 are affine over the triangle, and so is the displacement
+    // d0 + u (d1 - d0) + v (d2 - d0). They are clamped to the triangle, which bounds the rounding error on slivers.
+    Vec2 e1 = p[1] - p[0], e2 = p[2] - p[0];
+    double det = e1.x() * e2.y() - e1.y() * e2.x();
+    if (det == 0)
+      continue;
+
+    Vec2 du(e2.y() / det, -e2.x() / det), dv(-e1.y() / det, e1.x() / det);
+    float d0x = (float)d[0].x(), d0y = (float)d[0].y();
+    float d1x = (float)(d[1] - d[0]).x(), d1y = (float)(d[1] - d[0]).y();
+    float d2x = (float)(d[2] - d[0]).x(), d2y = (float)(d[2] - d[0]).y();
+
+    int top = 0, mid = 1, bot = 2;
+    if (aboveOf(p[mid], p[top])) std::swap(top, mid);
+    if (aboveOf(p[bot], p[mid])) std::swap(mid, bot);
+    if (aboveOf(p[mid], p[top])) std::swap(top, mid);
+
+    // Pixel centers are covered with half-open spans [y_top, y_bot) and [x_left, x_right), so that triangles sharing an edge
+    // never both cover a pixel on it
+    int r0 = std::max(row0, (int)std::ceil(p[top].y())), r1 = std::min(row1, (int)std::ceil(p[bot].y()));
+    for (int row = r0; row < r1; ++row)
+    {
+      double x_long = edgeX(p[top], p[bot], row);
+      double x_short = (row < p[mid].y() ? edgeX(p[top], p[mid], row) : edgeX(p[mid], p[bot], row));
+      int start = std::max(0, (int)std::ceil(std::min(x_long, x_short)));
+      int c0 = std::max(col0, start);
+      int c1 = std::min(col1, (int)std::ceil(std::max(x_long, x_short)));
+      if (c0 >= c1)
+        continue;
+
+      // Step the barycentric coordinates along the span from their values at its first pixel on the grid, wherever the
+      // rectangle starts, so that every window of a field rounds them alike
+      Vec2 q = Vec2(start, row) - p[0];
+      float u0 = (float)(du * q), v0 = (float)(dv * q), step_u = (float)du.x(), step_v = (float)dv.x();
+      float * dst = field.data() + ((size_t)(row - oy) * field.width() + (c0 - ox)) * 2;
+      for (int col = c0; col < c1; ++col, dst += 2)
+      {
+        float u = std::min(std::max(u0 + (col - start) * step_u, 0.0f), 1.0f);
+        float v = std::min(std::max(v0 + (col - start) * step_v, 0.0f), 1.0f - u);
+        dst[0] = d0x + u * d1x + v * d2x;
+        dst[1] = d0y + u * d1y + v * d2y;
+      }
+    }
+  }
+}
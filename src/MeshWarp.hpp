@@ -0,0 +1,50 @@
+#ifndef __MeshWarp_hpp__
+#define __MeshWarp_hpp__
+
+#include "Algebra3.hpp"
+#include "LineSegment.hpp"
+#include "Triangulation.hpp"
+#include "WarpField.hpp"
+#include <vector>
+
+/**
+ * A piecewise-affine warp between two sets of segments, a fast approximation of the field warp for previews and large jobs.
+ * The segment endpoints (and point features), interpolated to the current time, are triangulated together with the corners of
+ * a box around the warp domain, with each segment constrained to be an edge of the mesh (see Triangulation). Each triangle is
+ * then mapped affinely onto the triangle with the same vertices in the image being distorted. The box corners stay in place,
+ * so the warp fades out towards the edges of the domain.
+ *
+ * Unlike the field warp, which weights every segment at every pixel, the cost per pixel is constant: rasterize() walks each
+ * triangle's scanlines, stepping the affine displacement by a constant per pixel. The warp follows the segment endpoints
+ * exactly and the segments themselves linearly, but only a segment's own triangles move with it, so the mesh is an
+ * approximation that is only continuous, not smooth, across triangle edges.
+ */
+class MeshWarp
+{
+  private:
+    Triangulation mesh;          ///< Triangulation of the vertices at the current time
+    std::vector<Vec2> sources;   ///< Location of each vertex in the image being distorted
+
+  public:
+    /**
+     * Triangulate the segments linearly interpolated from seg_start to seg_end at time \a t, which are given in warp coordinates,
+     * within a box enclosing [lo, hi] and all the segments. Endpoints coinciding at time t are merged, keeping the first.
+     */
+    MeshWarp(std::vector<LineSegment> const & seg_start, std::vector<LineSegment> const & seg_end, double t, Vec2 const & lo,
+             Vec2 const & hi);
+
+    /** Get the number of triangles of the mesh. */
+    int numTriangles() const { return mesh.numTriangles(); }
+
+    /** Get the number of segments that are not edges of the mesh, because they cross other segments at time t. */
+    int numDroppedSegments() const { return mesh.numDroppedConstraints(); }
+
+    /**
+     * Set the displacements of \a field in the rectangle [col0, col1) x [row0, row1) to those of the mesh at the field's grid
+     * locations. Every pixel is covered by exactly one triangle.
+     */
+    void rasterize(WarpField & field, int col0, int row0, int col1, int row1) const;
+
+}; // class MeshWarp
+
+#endif // __MeshWarp_hpp__
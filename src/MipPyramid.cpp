@@ -0,0 +1,73 @@
+#include "MipPyramid.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+MipPyramid::MipPyramid(Image const & base_, int levels)
+: base(base_)
+{
+  Image const * prev = &base;
+  while ((prev->width() > 1 || prev->height() > 1) && (levels < 0 || (int)coarser.size() < levels))
+  {
+    coarser.push_back(reduce(*prev));
+    prev = &coarser.back();
+  }
+}
+
+Image
+MipPyramid::reduce(Image const & src)
+{
+  int w = src.width();
+  int h = src.height();
+  int n = src.numChannels();
+  int w2 = (w + 1) / 2;
+  int h2 = (h + 1) / 2;
+
+  Image dst(w2, h2, n);
+  for (int row = 0; row < h2; ++row)
+  {
+    unsigned char const * r0 = src.scanline(2 * row);
+    unsigned char const * r1 = src.scanline(std::min(2 * row + 1, h - 1));
+    unsigned char * out = dst.scanline(row);
+    int col = 0;
+
+#if defined(__SSE2__)
+    // Two output pixels from four input pixels per iteration, for RGBA images
+    if (n == 4)
+    {
+      __m128i const zero = _mm_setzero_si128();
+      __m128i const two = _mm_set1_epi16(2);
+      for ( ; col + 2 <= w / 2; col += 2)
+      {
+        __m128i a = _mm_loadu_si128((__m128i const *)(r0 + 8 * col));
+        __m128i b = _mm_loadu_si128((__m128i const *)(r1 + 8 * col));
+
+        // Sum the two rows, as 16-bit lanes holding input pixels (0, 1) and (2, 3)
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+        // Sum horizontally adjacent pixels into the low half of each register
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+        __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+        _mm_storel_epi64((__m128i *)(out + 4 * col), _mm_packus_epi16(sum, zero));
+      }
+    }
+#endif
+
+    for ( ; col < w2; ++col)
+    {
+      unsigned char const * p00 = r0 + 2 * col * n;
+      unsigned char const * p01 = r0 + std::min(2 * col + 1, w - 1) * n;
+      unsigned char const * p10 = r1 + 2 * col * n;
+      unsigned char const * p11 = r1 + std::min(2 * col + 1, w - 1) * n;
+      for (int channel = 0; channel < n; ++channel)
+        out[col * n + channel] = (unsigned char)((p00[channel] + p01[channel] + p10[channel] + p11[channel] + 2) >> 2);
+    }
+  }
+
+  return dst;
+}
@@ -0,0 +1,38 @@
+#ifndef __MipPyramid_hpp__
+#define __MipPyramid_hpp__
+
+#include "Image.hpp"
+#include <vector>
+
+/**
+ * A mip pyramid of an image: level 0 is the image itself, and each further level halves the dimensions of the previous one
+ * (rounding up) by averaging 2x2 blocks of pixels, down to a single pixel. Pixel centers stay at integer coordinates on every
+ * level, so location (x, y) on level 0 corresponds to ((x + 0.5) / 2^L - 0.5, (y + 0.5) / 2^L - 0.5) on level L.
+ *
+ * The pyramid shares the pixels of the base image (see Image), so the image may be destroyed or changed afterwards.
+ */
+class MipPyramid
+{
+  private:
+    Image base;
+    std::vector<Image> coarser;  ///< Levels 1, 2, ...
+
+  public:
+    /** Default constructor. */
+    MipPyramid() {}
+
+    /** Build the pyramid of an image. If \a levels is non-negative, at most that many levels beyond the base are built. */
+    explicit MipPyramid(Image const & base_, int levels = -1);
+
+    /** Get the number of levels, including the base image. */
+    int numLevels() const { return base.data() ? (int)coarser.size() + 1 : 0; }
+
+    /** Get a level of the pyramid. */
+    Image const & level(int i) const { return i == 0 ? base : coarser[i - 1]; }
+
+    /** Reduce an image to half its dimensions (rounding up) by averaging 2x2 blocks of pixels. */
+    static Image reduce(Image const & src);
+
+}; // class MipPyramid
+
+#endif // __MipPyramid_hpp__
@@ -0,0 +1,197 @@
+#include "MorphMask.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+/** Squared distance standing in for infinity, for pixels with nothing covered in reach. */
+static double const FAR_AWAY = 1e20;
+
+/**
+ * Compute the squared distance transform of a sampled function in one dimension, as described in Distance Transforms of
+ * Sampled Functions (Felzenszwalb and Huttenlocher): d[q] = min over p of (q - p)^2 + f[p]. \a v and \a z are scratch space
+ * for n and n + 1 values.
+ */
+static void
+distanceTransform1D(double const * f, int n, double * d, int * v, double * z)
+{
+  // Lower envelope of the parabolas rooted at each sample
+  int k = 0;
+  v[0] = 0;
+  z[0] = -FAR_AWAY;
+  z[1] = FAR_AWAY;
+  for (int q = 1; q < n; ++q)
+  {
+    double s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * (q - v[k]));
+    while (s <= z[k])
+    {
+      --k;
+      s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * (q - v[k]));
+    }
+
+    ++k;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = FAR_AWAY;
+  }
+
+  k = 0;
+  for (int q = 0; q < n; ++q)
+  {
+    while (z[k + 1] < q)
+      ++k;
+
+    d[q] = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+  }
+}
+
+void
+MorphMask::feather(double feather_px)
+{
+  if (feather_px <= 0 || coverage.empty())
+    return;
+
+  // Squared distance of every pixel from the nearest pixel that is at least half covered, by columns and then by rows
+  std::vector<double> dist2(coverage.size());
+  for (size_t i = 0; i < coverage.size(); ++i)
+    dist2[i] = (coverage[i] >= 0.5f ? 0.0 : FAR_AWAY);
+
+  int n = std::max(w, h);
+  std::vector<double> f(n), d(n), z(n + 1);
+  std::vector<int> v(n);
+  for (int col = 0; col < w; ++col)
+  {
+    for (int row = 0; row < h; ++row)
+      f[row] = dist2[(size_t)row * w + col];
+
+    distanceTransform1D(&f[0], h, &d[0], &v[0], &z[0]);
+    for (int row = 0; row < h; ++row)
+      dist2[(size_t)row * w + col] = d[row];
+  }
+
+  for (int row = 0; row < h; ++row)
+  {
+    double * r = &dist2[(size_t)row * w];
+    distanceTransform1D(r, w, &d[0], &v[0], &z[0]);
+    std::copy(d.begin(), d.begin() + w, r);
+  }
+
+  for (size_t i = 0; i < coverage.size(); ++i)
+  {
+    float ramp = (float)(1 - std::sqrt(dist2[i]) / feather_px);
+    coverage[i] = std::max(coverage[i], ramp);
+  }
+}
+
+void
+MorphMask::setImage(Image const & mask, int w_, int h_, double feather_px)
+{
+  w = w_;
+  h = h_;
+  coverage.assign((size_t)w * h, 0.0f);
+
+  // Bilinearly sample the first channel at the center of each pixel of the grid
+  GridTransform to_mask = GridTransform::betweenGrids(w, h, mask.width(), mask.height());
+  for (int row = 0; row < h; ++row)
+    for (int col = 0; col < w; ++col)
+    {
+      Vec2 loc = to_mask.apply(Vec2(col, row));
+      double x = std::max(0.0, std::min(loc.x(), mask.width() - 1.0));
+      double y = std::max(0.0, std::min(loc.y(), mask.height() - 1.0));
+      int col0 = (int)x, row0 = (int)y;
+      int col1 = std::min(col0 + 1, mask.width() - 1), row1 = std::min(row0 + 1, mask.height() - 1);
+      double fx = x - col0, fy = y - row0;
+      double value = (1 - fy) * ((1 - fx) * mask.pixel(row0, col0)[0] + fx * mask.pixel(row0, col1)[0])
+                   + fy * ((1 - fx) * mask.pixel(row1, col0)[0] + fx * mask.pixel(row1, col1)[0]);
+
+      coverage[(size_t)row * w + col] = (float)(value / 255.0);
+    }
+
+  feather(feather_px);
+}
+
+void
+MorphMask::setPolygon(std::vector<Vec2> const & vertices, GridTransform const & grid, int w_, int h_, double feather_px)
+{
+  w = w_;
+  h = h_;
+  coverage.assign((size_t)w * h, 0.0f);
+
+  // Fill between successive crossings of each row of pixel centers with the edges of the polygon
+  GridTransform from_grid = grid.inverse();
+  std::vector<double> crossings;
+  size_t n = vertices.size();
+  for (int row = 0; row < h; ++row)
+  {
+    double y = grid.apply(Vec2(0, row)).y();
+    crossings.clear();
+    for (size_t i = 0; i < n; ++i)
+    {
+      Vec2 const & p = vertices[i];
+      Vec2 const & q = vertices[(i + 1) % n];
+      if ((p.y() <= y) != (q.y() <= y))
+      {
+        double x = p.x() + (y - p.y()) / (q.y() - p.y()) * (q.x() - p.x());
+        crossings.push_back(from_grid.apply(Vec2(x, y)).x());
+      }
+    }
+
+    std::sort(crossings.begin(), crossings.end());
+    for (size_t i = 0; i + 1 < crossings.size(); i += 2)
+    {
+      int col0 = std::max(0, (int)std::ceil(crossings[i]));
+      int col1 = std::min(w - 1, (int)std::floor(crossings[i + 1]));
+      for (int col = col0; col <= col1; ++col)
+        coverage[(size_t)row * w + col] = 1.0f;
+    }
+  }
+
+  feather(feather_px);
+}
+
+bool
+MorphMask::loadPolygon(std::string const & path, std::vector<Vec2> & vertices)
+{
+  std::ifstream in(path.c_str());
+  if (!in)
+  {
+    std::cerr << "Could not open polygon file " << path << std::endl;
+    return false;
+  }
+
+  long num_vertices;
+  if (!(in >> num_vertices) || num_vertices < 3)
+  {
+    std::cerr << "Polygon file " << path << " must start with a vertex count of at least 3" << std::endl;
+    return false;
+  }
+
+  vertices.resize(num_vertices);
+  for (long i = 0; i < num_vertices; ++i)
+  {
+    double x, y;
+    if (!(in >> x >> y))
+    {
+      std::cerr << "Could not read vertex " << i << " of polygon file " << path << std::endl;
+      return false;
+    }
+
+    vertices[i] = Vec2(x, y);
+  }
+
+  return true;
+}
+
+bool
+MorphMask::anyCovered(int col0, int row0, int col1, int row1) const
+{
+  for (int row = row0; row < row1; ++row)
+  {
+    float const * r = &coverage[(size_t)row * w];
+    for (int col = col0; col < col1; ++col)
+      if (r[col] > 0)
+        return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,61 @@
+#ifndef __MorphMask_hpp__
+#define __MorphMask_hpp__
+
+#include "Algebra3.hpp"
+#include "Image.hpp"
+#include "WarpField.hpp"
+#include <string>
+#include <vector>
+
+/**
+ * The region of an output grid that is morphed, as a coverage value in [0, 1] per pixel. The region is given by a mask image
+ * or a polygon, and is feathered outwards over a band of pixels, over which the coverage falls linearly from 1 to 0, so that
+ * the morph fades smoothly into whatever is outside. Coverage is also used to tell which tiles of the output need a warp at
+ * all.
+ */
+class MorphMask
+{
+  private:
+    int w, h;
+    std::vector<float> coverage;  ///< Row-major
+
+    /** Extend the coverage outwards from the pixels that are at least half covered over a band of \a feather pixels. */
+    void feather(double feather_px);
+
+  public:
+    /** Default constructor. */
+    MorphMask() : w(0), h(0) {}
+
+    /**
+     * Set the region from a mask image covering the same extent as a \a w_ x \a h_ output grid, at any resolution. The first
+     * channel of the image is the coverage, 255 being fully covered.
+     */
+    void setImage(Image const & mask, int w_, int h_, double feather_px);
+
+    /**
+     * Set the region from a polygon, given by its vertices in the coordinates \a grid maps the pixels of a \a w_ x \a h_ output
+     * grid into. Pixels whose center is inside the polygon, by the even-odd rule, are covered.
+     */
+    void setPolygon(std::vector<Vec2> const & vertices, GridTransform const & grid, int w_, int h_, double feather_px);
+
+    /**
+     * Read the vertices of a polygon from a text file: the number of vertices on the first line, then the x and y coordinates
+     * of one vertex per line.
+     */
+    static bool loadPolygon(std::string const & path, std::vector<Vec2> & vertices);
+
+    /** Get the width of the grid. */
+    int width() const { return w; }
+
+    /** Get the height of the grid. */
+    int height() const { return h; }
+
+    /** Get the coverage of a pixel. */
+    float at(int row, int col) const { return coverage[(size_t)row * w + col]; }
+
+    /** Check if any pixel in the rectangle [col0, col1) x [row0, row1) is covered at all. */
+    bool anyCovered(int col0, int row0, int col1, int row1) const;
+
+}; // class MorphMask
+
+#endif // __MorphMask_hpp__
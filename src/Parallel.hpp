@@ -0,0 +1,111 @@
+#ifndef __Parallel_hpp__
+#define __Parallel_hpp__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Get the number of worker threads to use for parallel loops. */
+inline int
+numWorkerThreads()
+{
+  unsigned int n = std::thread::hardware_concurrency();
+  return n > 0 ? (int)n : 1;
+}
+
+/**
+ * Call body(i) for every i in [begin, end), distributing the iterations dynamically over all worker threads. Iterations must
+ * be independent of each other. Returns once all iterations have finished.
+ */
+template <typename Body>
+void
+parallelFor(int begin, int end, Body const & body)
+{
+  int num_threads = std::min(numWorkerThreads(), end - begin);
+  if (num_threads <= 1)
+  {
+    for (int i = begin; i < end; ++i)
+      body(i);
+
+    return;
+  }
+
+  std::atomic<int> next(begin);
+  auto worker = [&]()
+  {
+    for (int i = next++; i < end; i = next++)
+      body(i);
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i)
+    threads.push_back(std::thread(worker));
+
+  worker();
+
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+}
+
+/**
+ * A first-in first-out queue holding at most a fixed number of items, for passing work between the stages of a pipeline running
+ * on different threads. Producers block while it is full and consumers while it is empty, so a fast stage cannot run ahead of a
+ * slow one and pile up items in memory.
+ */
+template <typename T>
+class BoundedQueue
+{
+  private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable not_empty, not_full;
+
+  public:
+    /** Construct an empty queue holding at most \a capacity_ items. */
+    explicit BoundedQueue(size_t capacity_) : capacity(std::max(capacity_, (size_t)1)), closed(false) {}
+
+    /** Add an item, waiting while the queue is full. Returns false, dropping the item, if the queue has been closed. */
+    bool push(T item)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      not_full.wait(lock, [&]() { return closed || items.size() < capacity; });
+      if (closed)
+        return false;
+
+      items.push_back(std::move(item));
+      not_empty.notify_one();
+      return true;
+    }
+
+    /** Remove the oldest item, waiting while the queue is empty. Returns false once the queue is closed and drained. */
+    bool pop(T & item)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      not_empty.wait(lock, [&]() { return closed || !items.empty(); });
+      if (items.empty())
+        return false;
+
+      item = std::move(items.front());
+      items.pop_front();
+      not_full.notify_one();
+      return true;
+    }
+
+    /** Close the queue: no more items can be added, and consumers stop once the remaining items are taken. */
+    void close()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      not_empty.notify_all();
+      not_full.notify_all();
+    }
+
+}; // class BoundedQueue
+
+#endif // __Parallel_hpp__
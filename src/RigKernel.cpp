@@ -0,0 +1,331 @@
+#include "RigKernel.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+/** Number of terms of a segment pair and of a point pair, in the order prepare() stores them. */
+static int const SEGMENT_TERMS = 15;
+static int const POINT_TERMS = 4;
+
+/** Number of pairs evaluated by each function of a generated kernel. */
+static int const PAIRS_PER_FUNCTION = 16;
+
+RigKernel::RigKernel()
+: handle(NULL), a(0), b(0), p(0), row_function(NULL), warned(false)
+{}
+
+RigKernel::~RigKernel()
+{
+  if (handle)
+    dlclose(handle);
+}
+
+std::string
+RigKernel::layoutOf(std::vector<LineSegment> const & segs)
+{
+  std::string result(segs.size(), 's');
+  for (size_t i = 0; i < segs.size(); ++i)
+    if (segs[i].isPoint())
+      result[i] = 'p';
+
+  return result;
+}
+
+/** Get the text of a generated reference to a term. */
+static std::string
+term(int index)
+{
+  std::ostringstream out;
+  out << "t[" << index << "]";
+  return out.str();
+}
+
+bool
+RigKernel::generate(std::string const & src_path, std::vector<LineSegment> const & segs, WarpParams const & params)
+{
+  std::string rig_layout = layoutOf(segs);
+  int num_points = (int)std::count(rig_layout.begin(), rig_layout.end(), 'p');
+
+  std::ostringstream a_str, b_str, p_str;
+  a_str << std::setprecision(17) << params.a;
+  b_str << std::setprecision(17) << params.b;
+  p_str << std::setprecision(17) << params.p;
+
+  std::ofstream out(src_path.c_str());
+  if (!out)
+  {
+    std::cerr << "Could not open " << src_path << " for writing" << std::endl;
+    return false;
+  }
+
+  // One loop over a block of pixels per pair, segments first and then points in the order of the generic loop, so that the
+  // sums are rounded identically
+  std::vector<std::string> loops;
+  int base = 0;
+  for (size_t i = 0; i < segs.size(); ++i)
+  {
+    if (rig_layout[i] != 's')
+      continue;
+
+    // Terms as SegmentPairTerms: start, dir, unit_perp, len_p, end_start, end_dir, end_perp, end_len2, end_len
+    std::string sx = term(base), sy = term(base + 1);
+    std::ostringstream loop;
+    loop << "  // Segment " << i << "\n"
+         << "  for (int i = 0; i < n; ++i)\n"
+         << "  {\n"
+         << "    double x = xs[i];\n"
+         << "    double rx = x - " << term(base + 7) << ", ry = y - " << term(base + 8) << ";\n"
+         << "    double u = (" << term(base + 9) << " * rx + " << term(base + 10) << " * ry) / " << term(base + 13) << ";\n"
+         << "    double v = (rx * " << term(base + 11) << " + ry * " << term(base + 12) << ") / " << term(base + 14) << ";\n"
+         << "    double end_dist = std::sqrt((x - " << sx << ") * (x - " << sx << ") + (y - " << sy << ") * (y - " << sy
+         << "));\n"
+         << "    double line_dist = std::abs((int)v);\n"
+         << "    double dist = ((u < 0) | (u > 1)) ? end_dist : line_dist;\n";
+    if (params.b == 1)
+      loop << "    double wt = " << term(base + 6) << " / (" << a_str.str() << " + dist);\n";
+    else
+      loop << "    double wt = std::pow(" << term(base + 6) << " / (" << a_str.str() << " + dist), " << b_str.str()
+           << ");\n";
+    loop << "    dsx[i] += (" << sx << " + u * " << term(base + 2) << " + v * " << term(base + 4) << " - x) * wt;\n"
+         << "    dsy[i] += (" << sy << " + u * " << term(base + 3) << " + v * " << term(base + 5) << " - y) * wt;\n"
+         << "    ws[i] += wt;\n"
+         << "  }\n";
+    loops.push_back(loop.str());
+
+    base += SEGMENT_TERMS;
+  }
+
+  for (size_t i = 0; i < segs.size(); ++i)
+  {
+    if (rig_layout[i] != 'p')
+      continue;
+
+    // Terms as PointPairTerms: at, offset
+    std::string ax = term(base), ay = term(base + 1);
+    std::ostringstream loop;
+    loop << "  // Point " << i << "\n"
+         << "  for (int i = 0; i < n; ++i)\n"
+         << "  {\n"
+         << "    double x = xs[i];\n"
+         << "    double dist = std::sqrt((x - " << ax << ") * (x - " << ax << ") + (y - " << ay << ") * (y - " << ay
+         << "));\n";
+    if (params.b == 1)
+      loop << "    double wt = 1 / (" << a_str.str() << " + dist);\n";
+    else
+      loop << "    double wt = std::pow(1 / (" << a_str.str() << " + dist), " << b_str.str() << ");\n";
+    loop << "    dsx[i] += " << term(base + 2) << " * wt;\n"
+         << "    dsy[i] += " << term(base + 3) << " * wt;\n"
+         << "    ws[i] += wt;\n"
+         << "  }\n";
+    loops.push_back(loop.str());
+
+    base += POINT_TERMS;
+  }
+
+  out << "// Field warp kernel for a rig of " << segs.size() - num_points << " segments and " << num_points << " points,"
+      << " with a = " << a_str.str() << ", b = " << b_str.str() << ", p = " << p_str.str() << ".\n"
+      << "// Generated by morph --generate-kernel: see RigKernel.\n"
+      << "\n"
+      << "#include <cmath>\n"
+      << "#include <cstdlib>\n";
+
+  // The loops are split into functions of a bounded size, which compile in time linear in the number of pairs. Each loop
+  // evaluates a pair on a block of pixels, and is vectorized by the compiler.
+  int num_chunks = ((int)loops.size() + PAIRS_PER_FUNCTION - 1) / PAIRS_PER_FUNCTION;
+  for (int c = 0; c < num_chunks; ++c)
+  {
+    out << "\n"
+        << "static __attribute__((noinline)) void\n"
+        << "accumulate" << c << "(double const * __restrict__ t, double const * __restrict__ xs, double y, int n,"
+        << " double * __restrict__ dsx,\n"
+        << "            double * __restrict__ dsy, double * __restrict__ ws)\n"
+        << "{\n";
+    for (int k = c * PAIRS_PER_FUNCTION; k < (c + 1) * PAIRS_PER_FUNCTION && k < (int)loops.size(); ++k)
+      out << (k > c * PAIRS_PER_FUNCTION ? "\n" : "") << loops[(size_t)k];
+    out << "}\n";
+  }
+
+  out << "\n"
+      << "extern \"C\" {\n"
+      << "\n"
+      << "int morph_rig_version() { return " << VERSION << "; }\n"
+      << "\n"
+      << "char const * morph_rig_layout() { return \"" << rig_layout << "\"; }\n"
+      << "\n"
+      << "void morph_rig_params(double * abp) { abp[0] = " << a_str.str() << "; abp[1] = " << b_str.str() << "; abp[2] = "
+      << p_str.str() << "; }\n"
+      << "\n"
+      << "void\n"
+      << "morph_rig_warp_row(double const * t, double const * xs, double y, int count, float * disp)\n"
+      << "{\n"
+      << "  int const BLOCK = 64;\n"
+      << "  double dsx[BLOCK], dsy[BLOCK], ws[BLOCK];\n"
+      << "  for (int i0 = 0; i0 < count; i0 += BLOCK, xs += BLOCK, disp += 2 * BLOCK)\n"
+      << "  {\n"
+      << "    int n = (count - i0 < BLOCK ? count - i0 : BLOCK);\n"
+      << "    for (int i = 0; i < n; ++i)\n"
+      << "      dsx[i] = dsy[i] = ws[i] = 0;\n"
+      << "\n";
+  for (int c = 0; c < num_chunks; ++c)
+    out << "    accumulate" << c << "(t, xs, y, n, dsx, dsy, ws);\n";
+  out << "\n"
+      << "    for (int i = 0; i < n; ++i)\n"
+      << "    {\n"
+      << "      double inv = 1. / ws[i];\n"
+      << "      disp[2 * i] = (float)(dsx[i] * inv);\n"
+      << "      disp[2 * i + 1] = (float)(dsy[i] * inv);\n"
+      << "    }\n"
+      << "  }\n"
+      << "}\n"
+      << "\n"
+      << "} // extern \"C\"\n";
+
+  if (!out)
+  {
+    std::cerr << "Could not write kernel source to " << src_path << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/** Quote a path for the shell. */
+static std::string
+shellQuote(std::string const & s)
+{
+  std::string result = "'";
+  for (size_t i = 0; i < s.length(); ++i)
+    result += (s[i] == '\'' ? std::string("'\\''") : std::string(1, s[i]));
+
+  return result + "'";
+}
+
+bool
+RigKernel::compile(std::string const & src_path, std::string const & so_path)
+{
+  // The kernel is built for the local machine. Contracting into fused multiply-adds would round differently from the
+  // generic loop. The loops over pixels are only vectorized if sqrt() need not set errno and comparisons need not trap,
+  // neither of which changes any result.
+  char const * cxx = std::getenv("CXX");
+  std::string command = std::string(cxx && *cxx ? cxx : "c++") + " -O3 -march=native -std=c++11 -ffp-contract=off"
+                      + " -fno-math-errno -fno-trapping-math -fPIC -shared -o " + shellQuote(so_path) + " "
+                      + shellQuote(src_path);
+  std::cout << command << std::endl;
+
+  if (std::system(command.c_str()) != 0)
+  {
+    std::cerr << "Could not compile kernel " << src_path << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool
+RigKernel::load(std::string const & so_path)
+{
+  if (handle)
+  {
+    dlclose(handle);
+    handle = NULL;
+    row_function = NULL;
+  }
+
+  // Without a slash, dlopen() would search the library path instead of the working directory
+  std::string open_path = (so_path.find('/') == std::string::npos ? "./" + so_path : so_path);
+  handle = dlopen(open_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle)
+  {
+    std::cerr << "Could not load kernel: " << dlerror() << std::endl;
+    return false;
+  }
+
+  typedef int (*VersionFunction)();
+  typedef char const * (*LayoutFunction)();
+  typedef void (*ParamsFunction)(double *);
+
+  VersionFunction version = reinterpret_cast<VersionFunction>(dlsym(handle, "morph_rig_version"));
+  LayoutFunction layout_function = reinterpret_cast<LayoutFunction>(dlsym(handle, "morph_rig_layout"));
+  ParamsFunction params_function = reinterpret_cast<ParamsFunction>(dlsym(handle, "morph_rig_params"));
+  row_function = reinterpret_cast<RowFunction>(dlsym(handle, "morph_rig_warp_row"));
+
+  if (!version || !layout_function || !params_function || !row_function || version() != VERSION)
+  {
+    std::cerr << so_path << " is not a kernel generated by this version of morph" << std::endl;
+    dlclose(handle);
+    handle = NULL;
+    row_function = NULL;
+    return false;
+  }
+
+  double abp[3];
+  params_function(abp);
+  a = abp[0];
+  b = abp[1];
+  p = abp[2];
+  layout = layout_function();
+  path = so_path;
+  warned = false;
+
+  return true;
+}
+
+bool
+RigKernel::checkParams(WarpParams const & params) const
+{
+  if (params.a != a || params.b != b || params.p != p)
+  {
+    std::cerr << "Kernel " << path << " was generated for parameters { a : " << a << ", b : " << b << ", p : " << p << " }"
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool
+RigKernel::matches(std::vector<LineSegment> const & seg_start) const
+{
+  if (layoutOf(seg_start) == layout)
+    return true;
+
+  if (!warned.exchange(true))
+    std::cerr << "Segments do not have the layout of kernel " << path << ": warping them with the generic loop" << std::endl;
+
+  return false;
+}
+
+void
+RigKernel::prepare(std::vector<LineSegment> const & seg_start, std::vector<LineSegment> const & seg_end,
+                   WarpParams const & params, std::vector<double> & terms) const
+{
+  terms.clear();
+  terms.reserve(seg_start.size() * SEGMENT_TERMS);
+
+  for (size_t i = 0; i < seg_start.size(); ++i)
+  {
+    if (seg_start[i].isPoint())
+      continue;
+
+    SegmentPairTerms pair(seg_start[i], seg_end[i], params);
+    double values[SEGMENT_TERMS] = { pair.start.x(), pair.start.y(), pair.dir.x(), pair.dir.y(), pair.unit_perp.x(),
+                                     pair.unit_perp.y(), pair.len_p, pair.end_start.x(), pair.end_start.y(),
+                                     pair.end_dir.x(), pair.end_dir.y(), pair.end_perp.x(), pair.end_perp.y(),
+                                     pair.end_len2, pair.end_len };
+    terms.insert(terms.end(), values, values + SEGMENT_TERMS);
+  }
+
+  for (size_t i = 0; i < seg_start.size(); ++i)
+  {
+    if (!seg_start[i].isPoint())
+      continue;
+
+    PointPairTerms pair(seg_start[i], seg_end[i]);
+    double values[POINT_TERMS] = { pair.at.x(), pair.at.y(), pair.offset.x(), pair.offset.y() };
+    terms.insert(terms.end(), values, values + POINT_TERMS);
+  }
+}
@@ -0,0 +1,95 @@
+#ifndef __RigKernel_hpp__
+#define __RigKernel_hpp__
+
+#include "LineSegment.hpp"
+#include "WarpKernel.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+ * A field warp kernel generated ahead of time for one rig, i.e. a fixed layout of segments and points whose endpoints change
+ * from frame to frame, and loaded from a shared object. generate() writes C++ source evaluating a row of pixels with the loop
+ * over the rig's pairs unrolled and the warp parameters a and b folded into constants, which the local compiler turns into the
+ * shared object (see compile()). Such a kernel then evaluates any frame of the rig, from the terms of its pairs that do not
+ * depend on the pixel (see prepare()), with the same arithmetic as the generic loop of computeWarpField(), so the
+ * displacements are identical.
+ *
+ * The shared object exports, with C linkage:
+ *   int morph_rig_version()              the version of this interface, VERSION
+ *   char const * morph_rig_layout()      one character per pair, 's' for a segment and 'p' for a point
+ *   void morph_rig_params(double * abp)  the a, b and p the kernel was generated for
+ *   void morph_rig_warp_row(double const * terms, double const * xs, double y, int count, float * disp)
+ *                                        the displacements of the points (xs[i], y), i < count, as interleaved (dx, dy)
+ *                                        pairs
+ */
+class RigKernel
+{
+  public:
+    /** Version of the interface of the generated shared objects. */
+    static int const VERSION = 1;
+
+    /** The per-row kernel exported by a shared object. */
+    typedef void (*RowFunction)(double const * terms, double const * xs, double y, int count, float * disp);
+
+  private:
+    std::string path;
+    void * handle;
+    std::string layout;
+    double a, b, p;
+    RowFunction row_function;
+    mutable std::atomic<bool> warned;
+
+    RigKernel(RigKernel const &);              // not copyable
+    RigKernel & operator=(RigKernel const &);  // not copyable
+
+  public:
+    /** Construct without a kernel loaded. */
+    RigKernel();
+
+    /** Destructor. Unloads the shared object. */
+    ~RigKernel();
+
+    /** Get the layout of a rig: one character per pair, 's' for a segment and 'p' for a point. */
+    static std::string layoutOf(std::vector<LineSegment> const & segs);
+
+    /** Write the source of a kernel for the layout of \a segs and the warp parameters \a params to \a src_path. */
+    static bool generate(std::string const & src_path, std::vector<LineSegment> const & segs, WarpParams const & params);
+
+    /**
+     * Compile generated source into a shared object with the local compiler, $CXX if set and c++ otherwise, printing the
+     * command.
+     */
+    static bool compile(std::string const & src_path, std::string const & so_path);
+
+    /** Load a kernel from a shared object. */
+    bool load(std::string const & so_path);
+
+    /** Check if the kernel was generated for the warp parameters a, b and p of \a params, printing an error if not. */
+    bool checkParams(WarpParams const & params) const;
+
+    /**
+     * Check if the kernel's layout is that of the segments \a seg_start. If not, a warning is printed the first time, and the
+     * segments must be warped with the generic loop.
+     */
+    bool matches(std::vector<LineSegment> const & seg_start) const;
+
+    /**
+     * Get the terms of the pairs (\a seg_start, \a seg_end) that the kernel reads, i.e. those of SegmentPairTerms and
+     * PointPairTerms, for the warp parameters \a params. The segments must match the kernel's layout.
+     */
+    void prepare(std::vector<LineSegment> const & seg_start, std::vector<LineSegment> const & seg_end,
+                 WarpParams const & params, std::vector<double> & terms) const;
+
+    /**
+     * Compute the displacements of the \a count points (xs[i], y), with the terms from prepare(), into \a disp as interleaved
+     * (dx, dy) pairs.
+     */
+    void warpRow(double const * terms, double const * xs, double y, int count, float * disp) const
+    {
+      row_function(terms, xs, y, count, disp);
+    }
+
+}; // class RigKernel
+
+#endif // __RigKernel_hpp__
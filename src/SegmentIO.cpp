@@ -0,0 +1,638 @@
+#include "SegmentIO.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <locale>
+#include <sstream>
+
+enum
+{
+  SEGB_VERSION = 1,
+  SEGB_HEADER_SIZE = 24,
+  SEGB_FLOAT64 = 1,
+  SEGB_WEIGHTS = 2
+};
+
+/** Read a whole file into memory. */
+static bool
+readFile(std::string const & path, std::string & contents)
+{
+  std::ifstream in(path.c_str(), std::ios::binary);
+  if (!in)
+    return false;
+
+  in.seekg(0, std::ios::end);
+  std::streamoff size = in.tellg();
+  if (size < 0)
+    return false;
+
+  contents.resize((size_t)size);
+  in.seekg(0, std::ios::beg);
+  if (size > 0)
+    in.read(&contents[0], size);
+
+  return (bool)in;
+}
+
+/** Check if the host stores multi-byte values least significant byte first, as the binary format does. */
+static bool
+isLittleEndian()
+{
+  unsigned int one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+  return first == 1;
+}
+
+/** Reverse the byte order of \a count values of \a size bytes each, stored contiguously. */
+static void
+swapBytes(unsigned char * data, size_t size, size_t count)
+{
+  for (size_t i = 0; i < count; ++i, data += size)
+    for (size_t j = 0; j < size / 2; ++j)
+      std::swap(data[j], data[size - 1 - j]);
+}
+
+/** Read an unsigned little-endian integer of \a size bytes. */
+static unsigned long long
+readLittleEndian(unsigned char const * bytes, int size)
+{
+  unsigned long long value = 0;
+  for (int i = size - 1; i >= 0; --i)
+    value = (value << 8) | bytes[i];
+
+  return value;
+}
+
+/** Append an unsigned integer as \a size little-endian bytes. */
+static void
+appendLittleEndian(std::string & out, unsigned long long value, int size)
+{
+  for (int i = 0; i < size; ++i, value >>= 8)
+    out.push_back((char)(value & 0xff));
+}
+
+/** Append \a count values of \a size bytes each, converting them to little-endian. */
+static void
+appendValues(std::string & out, void const * values, size_t size, size_t count)
+{
+  size_t begin = out.size();
+  out.append((char const *)values, size * count);
+  if (!isLittleEndian())
+    swapBytes((unsigned char *)&out[begin], size, count);
+}
+
+/** Skip spaces and tabs, but not line breaks. */
+static inline void
+skipBlanks(char const *& p, char const * end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    ++p;
+}
+
+/** Check if \a p is at the end of a line's content, that is at a line break, a comment or the end of the text. */
+static inline bool
+atLineEnd(char const * p, char const * end)
+{
+  return p == end || *p == '\n' || *p == '#';
+}
+
+/**
+ * Parse a decimal number at \a p, advancing past it, independently of the locale. Values whose digits fit in a double and whose
+ * power of ten is exactly representable are correctly rounded, which covers anything an editor or exporter writes for pixel
+ * coordinates; longer values may be off in the last bit.
+ */
+static bool
+parseNumber(char const *& p, char const * end, double & value)
+{
+  static double const POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                   1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+  char const * q = p;
+  bool negative = false;
+  if (q < end && (*q == '-' || *q == '+'))
+    negative = (*q++ == '-');
+
+  unsigned long long mantissa = 0;
+  int exponent = 0, num_digits = 0;
+  for (; q < end && *q >= '0' && *q <= '9'; ++q, ++num_digits)
+  {
+    if (mantissa < 100000000000000000ULL)
+      mantissa = 10 * mantissa + (unsigned long long)(*q - '0');
+    else
+      ++exponent;
+  }
+
+  if (q < end && *q == '.')
+    for (++q; q < end && *q >= '0' && *q <= '9'; ++q, ++num_digits)
+    {
+      if (mantissa < 100000000000000000ULL)
+      {
+        mantissa = 10 * mantissa + (unsigned long long)(*q - '0');
+        --exponent;
+      }
+    }
+
+  if (num_digits == 0)
+    return false;
+
+  if (q < end && (*q == 'e' || *q == 'E'))
+  {
+    char const * r = q + 1;
+    bool exp_negative = false;
+    if (r < end && (*r == '-' || *r == '+'))
+      exp_negative = (*r++ == '-');
+
+    if (r < end && *r >= '0' && *r <= '9')
+    {
+      int e = 0;
+      for (; r < end && *r >= '0' && *r <= '9'; ++r)
+        e = std::min(10 * e + (*r - '0'), 100000);
+
+      exponent += (exp_negative ? -e : e);
+      q = r;
+    }
+  }
+
+  double m = (double)mantissa;
+  if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+    value = (exponent < 0 ? m / POW10[-exponent] : m * POW10[exponent]);
+  else
+    value = m * std::pow(10.0, exponent);
+
+  if (negative)
+    value = -value;
+
+  p = q;
+  return true;
+}
+
+/**
+ * Parse up to \a max_n numbers from the line at \a p into \a v, leaving \a p at the line break or the end of the text. The
+ * numbers may be followed only by blanks and a comment starting with '#'. Returns the number of numbers read, or -1 if anything
+ * else follows them.
+ */
+static int
+parseLine(char const *& p, char const * end, double * v, int max_n)
+{
+  int n = 0;
+  for (skipBlanks(p, end); n < max_n && !atLineEnd(p, end); skipBlanks(p, end))
+  {
+    if (!parseNumber(p, end, v[n]))
+      break;
+
+    ++n;
+  }
+
+  bool complete = atLineEnd(p, end);
+  while (p < end && *p != '\n')
+    ++p;
+
+  return complete ? n : -1;
+}
+
+/** Parse the number of segment pairs from a line. */
+static bool
+parseCount(char const *& p, char const * end, size_t & num_segs)
+{
+  double count;
+  if (parseLine(p, end, &count, 1) != 1 || count < 0 || count != std::floor(count))
+    return false;
+
+  num_segs = (size_t)count;
+  return true;
+}
+
+/**
+ * Parse a segment pair of eight numbers or a point pair of four, and its weight if there is one, from a line. Returns false if
+ * the line is incomplete or holds anything else.
+ */
+static bool
+parsePair(char const *& p, char const * end, std::vector<LineSegment> & seg1, std::vector<LineSegment> & seg2,
+          std::vector<double> * weights)
+{
+  double v[9];
+  int n = parseLine(p, end, v, 9);
+  if (n == 4 || n == 5)
+  {
+    seg1.push_back(LineSegment::point(Vec2(v[0], v[1])));
+    seg2.push_back(LineSegment::point(Vec2(v[2], v[3])));
+    if (weights)
+      weights->push_back(n > 4 ? v[4] : 1.0);
+
+    return true;
+  }
+
+  if (n < 8)
+    return false;
+
+  seg1.push_back(LineSegment(Vec2(v[0], v[1]), Vec2(v[2], v[3])));
+  seg2.push_back(LineSegment(Vec2(v[4], v[5]), Vec2(v[6], v[7])));
+  if (weights)
+    weights->push_back(n > 8 ? v[8] : 1.0);
+
+  return true;
+}
+
+/** Check that every pair is a point in both images or in neither. */
+static bool
+checkPointPairs(std::string const & name, std::vector<LineSegment> const & seg1, std::vector<LineSegment> const & seg2)
+{
+  for (size_t i = 0; i < seg1.size(); ++i)
+    if (seg1[i].isPoint() != seg2[i].isPoint())
+    {
+      std::cerr << "Pair " << i << " of " << name << " is a point in one image and a segment in the other" << std::endl;
+      return false;
+    }
+
+  return true;
+}
+
+/** Check if the line at \a p is blank or holds only a comment. */
+static bool
+isBlankLine(char const * p, char const * end)
+{
+  skipBlanks(p, end);
+  return atLineEnd(p, end);
+}
+
+/** Read segments from the text format in \a text. */
+static bool
+parseText(std::string const & path, std::string const & text, std::vector<LineSegment> & seg1,
+          std::vector<LineSegment> & seg2, std::vector<double> * weights)
+{
+  char const * p = text.data();
+  char const * end = p + text.size();
+
+  // Skip blank and comment lines before the count
+  while (p < end && isBlankLine(p, end))
+  {
+    while (p < end && *p != '\n')
+      ++p;
+
+    if (p < end)
+      ++p;  // past the line break
+  }
+
+  size_t num_segs;
+  if (!parseCount(p, end, num_segs))
+  {
+    std::cerr << "Could not read number of segments from " << path << std::endl;
+    return false;
+  }
+
+  seg1.reserve(num_segs);
+  seg2.reserve(num_segs);
+  if (weights)
+    weights->reserve(num_segs);
+
+  while (seg1.size() < num_segs && p < end)
+  {
+    ++p;  // past the line break
+    if (isBlankLine(p, end))
+    {
+      while (p < end && *p != '\n')
+        ++p;
+
+      continue;
+    }
+
+    if (!parsePair(p, end, seg1, seg2, weights))
+    {
+      std::cerr << "Could not read segment pair " << seg1.size() << " from " << path << std::endl;
+      return false;
+    }
+  }
+
+  if (seg1.size() != num_segs)
+  {
+    std::cerr << "Expected " << num_segs << " segment pairs in " << path << ", found " << seg1.size() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/** Read segments from the binary format in \a data. */
+static bool
+parseBinary(std::string const & path, std::string const & data, std::vector<LineSegment> & seg1,
+            std::vector<LineSegment> & seg2, std::vector<double> * weights)
+{
+  unsigned char const * bytes = (unsigned char const *)data.data();
+  if (data.size() < SEGB_HEADER_SIZE)
+  {
+    std::cerr << "Truncated header in binary segment file " << path << std::endl;
+    return false;
+  }
+
+  unsigned long long version = readLittleEndian(bytes + 4, 4);
+  unsigned long long flags = readLittleEndian(bytes + 8, 4);
+  unsigned long long num_segs = readLittleEndian(bytes + 16, 8);
+  if (version < 1 || version > SEGB_VERSION)
+  {
+    std::cerr << "Unsupported version " << version << " of binary segment file " << path << std::endl;
+    return false;
+  }
+
+  size_t coord_size = ((flags & SEGB_FLOAT64) ? 8 : 4);
+  size_t record_size = 8 * coord_size + ((flags & SEGB_WEIGHTS) ? 4 : 0);
+  if (num_segs > (data.size() - SEGB_HEADER_SIZE) / record_size)
+  {
+    std::cerr << "Binary segment file " << path << " is too short for its " << num_segs << " segment pairs" << std::endl;
+    return false;
+  }
+
+  // Copy out to get aligned values in host byte order
+  size_t num_coords = 8 * (size_t)num_segs;
+  std::vector<unsigned char> coord_bytes(bytes + SEGB_HEADER_SIZE, bytes + SEGB_HEADER_SIZE + num_coords * coord_size);
+  if (!isLittleEndian())
+    swapBytes(coord_bytes.empty() ? NULL : &coord_bytes[0], coord_size, num_coords);
+
+  std::vector<double> coords(num_coords);
+  if (coord_size == 8 && num_coords > 0)
+    std::memcpy(&coords[0], &coord_bytes[0], num_coords * 8);
+  else
+    for (size_t i = 0; i < num_coords; ++i)
+    {
+      float f;
+      std::memcpy(&f, &coord_bytes[4 * i], 4);
+      coords[i] = f;
+    }
+
+  seg1.resize((size_t)num_segs);
+  seg2.resize((size_t)num_segs);
+  for (size_t i = 0; i < (size_t)num_segs; ++i)
+  {
+    double const * c = &coords[8 * i];
+    seg1[i] = LineSegment(Vec2(c[0], c[1]), Vec2(c[2], c[3]));
+    seg2[i] = LineSegment(Vec2(c[4], c[5]), Vec2(c[6], c[7]));
+  }
+
+  if (weights)
+  {
+    weights->assign((size_t)num_segs, 1.0);
+    if (flags & SEGB_WEIGHTS)
+    {
+      unsigned char const * w = bytes + SEGB_HEADER_SIZE + num_coords * coord_size;
+      for (size_t i = 0; i < (size_t)num_segs; ++i)
+      {
+        unsigned char b[4];
+        std::memcpy(b, w + 4 * i, 4);
+        if (!isLittleEndian())
+          swapBytes(b, 4, 1);
+
+        float f;
+        std::memcpy(&f, b, 4);
+        (*weights)[i] = f;
+      }
+    }
+  }
+
+  return true;
+}
+
+SegmentFormat
+segmentFormatForPath(std::string const & path)
+{
+  std::string const ext = ".segb";
+  if (path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0)
+    return SEGMENTS_BINARY32;
+
+  return SEGMENTS_TEXT;
+}
+
+bool
+loadSegments(std::string const & path, std::vector<LineSegment> & seg1, std::vector<LineSegment> & seg2,
+             std::vector<double> * weights)
+{
+  seg1.clear();
+  seg2.clear();
+  if (weights)
+    weights->clear();
+
+  std::string contents;
+  if (!readFile(path, contents))
+  {
+    std::cerr << "Could not open correspondence file " << path << std::endl;
+    return false;
+  }
+
+  bool ok;
+  if (contents.compare(0, 4, "SEGB") == 0)
+    ok = parseBinary(path, contents, seg1, seg2, weights);
+  else
+    ok = parseText(path, contents, seg1, seg2, weights);
+
+  assert(seg1.size() == seg2.size());
+  return ok && checkPointPairs(path, seg1, seg2);
+}
+
+bool
+saveSegments(std::string const & path, std::vector<LineSegment> const & seg1, std::vector<LineSegment> const & seg2,
+             SegmentFormat format, std::vector<double> const * weights)
+{
+  assert(seg1.size() == seg2.size());
+  assert(!weights || weights->size() == seg1.size());
+
+  // Only store weights that say something
+  bool has_weights = false;
+  for (size_t i = 0; weights && i < weights->size() && !has_weights; ++i)
+    has_weights = ((*weights)[i] != 1);
+
+  std::string out;
+  if (format == SEGMENTS_TEXT)
+  {
+    std::ostringstream text;
+    text.imbue(std::locale::classic());
+    text.precision(10);
+    text << seg1.size() << '\n';
+    for (size_t i = 0; i < seg1.size(); ++i)
+    {
+      if (seg1[i].isPoint() && seg2[i].isPoint())
+        text << seg1[i].start().x() << ' ' << seg1[i].start().y() << ' ' << seg2[i].start().x() << ' ' << seg2[i].start().y();
+      else
+        text << seg1[i].start().x() << ' ' << seg1[i].start().y() << ' ' << seg1[i].end().x() << ' ' << seg1[i].end().y() << ' '
+             << seg2[i].start().x() << ' ' << seg2[i].start().y() << ' ' << seg2[i].end().x() << ' ' << seg2[i].end().y();
+
+      if (has_weights)
+        text << ' ' << (*weights)[i];
+
+      text << '\n';
+    }
+
+    out = text.str();
+  }
+  else
+  {
+    bool float64 = (format == SEGMENTS_BINARY64);
+    out = "SEGB";
+    appendLittleEndian(out, SEGB_VERSION, 4);
+    appendLittleEndian(out, (float64 ? SEGB_FLOAT64 : 0) | (has_weights ? SEGB_WEIGHTS : 0), 4);
+    appendLittleEndian(out, 0, 4);
+    appendLittleEndian(out, seg1.size(), 8);
+
+    std::vector<double> coords;
+    coords.reserve(8 * seg1.size());
+    for (size_t i = 0; i < seg1.size(); ++i)
+      for (int j = 0; j < 2; ++j)
+      {
+        LineSegment const & s = (j == 0 ? seg1 : seg2)[i];
+        coords.push_back(s.start().x());
+        coords.push_back(s.start().y());
+        coords.push_back(s.end().x());
+        coords.push_back(s.end().y());
+      }
+
+    if (float64)
+    {
+      if (!coords.empty())
+        appendValues(out, &coords[0], 8, coords.size());
+    }
+    else
+    {
+      std::vector<float> coords32(coords.begin(), coords.end());
+      if (!coords32.empty())
+        appendValues(out, &coords32[0], 4, coords32.size());
+    }
+
+    if (has_weights)
+    {
+      std::vector<float> weights32(weights->begin(), weights->end());
+      appendValues(out, &weights32[0], 4, weights32.size());
+    }
+  }
+
+  std::ofstream file(path.c_str(), std::ios::binary);
+  if (!file)
+  {
+    std::cerr << "Could not open " << path << " for writing" << std::endl;
+    return false;
+  }
+
+  file.write(out.data(), (std::streamsize)out.size());
+  file.flush();
+  if (!file)
+  {
+    std::cerr << "Could not write segments to " << path << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool
+SegmentReader::open(std::string const & path_)
+{
+  path = path_;
+  num_read = 0;
+  in.close();
+  in.clear();
+  in.open(path.c_str(), std::ios::binary);
+  if (!in)
+  {
+    std::cerr << "Could not open segment stream " << path << std::endl;
+    return false;
+  }
+
+  char magic[4] = { 0, 0, 0, 0 };
+  in.read(magic, 4);
+  binary = (in.gcount() == 4 && std::memcmp(magic, "SEGB", 4) == 0);
+  in.clear();
+  in.seekg(0, std::ios::beg);
+
+  return (bool)in;
+}
+
+bool
+SegmentReader::next(std::vector<LineSegment> & seg1, std::vector<LineSegment> & seg2, std::vector<double> * weights)
+{
+  seg1.clear();
+  seg2.clear();
+  if (weights)
+    weights->clear();
+
+  std::ostringstream name;
+  name << path << " (set " << num_read << ")";
+
+  if (binary)
+  {
+    std::string data(SEGB_HEADER_SIZE, '\0');
+    in.read(&data[0], SEGB_HEADER_SIZE);
+    if (in.gcount() == 0)
+      return false;
+
+    unsigned char const * header = (unsigned char const *)data.data();
+    if (in.gcount() != SEGB_HEADER_SIZE || data.compare(0, 4, "SEGB") != 0)
+    {
+      std::cerr << "Could not read binary segment header of " << name.str() << std::endl;
+      return false;
+    }
+
+    unsigned long long flags = readLittleEndian(header + 8, 4);
+    unsigned long long num_segs = readLittleEndian(header + 16, 8);
+    size_t record_size = 8 * ((flags & SEGB_FLOAT64) ? 8 : 4) + ((flags & SEGB_WEIGHTS) ? 4 : 0);
+    if (num_segs > (1ULL << 32))
+    {
+      std::cerr << "Implausible number of segments in " << name.str() << std::endl;
+      return false;
+    }
+
+    data.resize(SEGB_HEADER_SIZE + (size_t)num_segs * record_size);
+    if (num_segs > 0)
+      in.read(&data[SEGB_HEADER_SIZE], (std::streamsize)(data.size() - SEGB_HEADER_SIZE));
+
+    data.resize(SEGB_HEADER_SIZE + (size_t)(num_segs > 0 ? in.gcount() : 0));
+    if (!parseBinary(name.str(), data, seg1, seg2, weights))
+      return false;
+  }
+  else
+  {
+    // Skip blank lines before the count, and stop quietly at the end of the stream
+    std::string line;
+    char const * p = NULL;
+    char const * end = NULL;
+    do
+    {
+      if (!std::getline(in, line))
+        return false;
+
+      p = line.data();
+      end = p + line.size();
+    } while (isBlankLine(p, end));
+
+    size_t num_segs;
+    if (!parseCount(p, end, num_segs))
+    {
+      std::cerr << "Could not read number of segments from " << name.str() << std::endl;
+      return false;
+    }
+
+    while (seg1.size() < num_segs && std::getline(in, line))
+    {
+      p = line.data();
+      end = p + line.size();
+      if (isBlankLine(p, end))
+        continue;
+
+      if (!parsePair(p, end, seg1, seg2, weights))
+      {
+        std::cerr << "Could not read segment pair " << seg1.size() << " from " << name.str() << std::endl;
+        return false;
+      }
+    }
+
+    if (seg1.size() != num_segs)
+    {
+      std::cerr << "Expected " << num_segs << " segment pairs in " << name.str() << ", found " << seg1.size() << std::endl;
+      return false;
+    }
+  }
+
+  if (!checkPointPairs(name.str(), seg1, seg2))
+    return false;
+
+  ++num_read;
+  return true;
+}
@@ -0,0 +1,76 @@
+#ifndef __SegmentIO_hpp__
+#define __SegmentIO_hpp__
+
+#include "LineSegment.hpp"
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Formats for files of segment pairs.
+ *
+ * The text format has the number of pairs on the first line, followed by one pair per line: the start and end of the segment
+ * in the first image, then those of the segment in the second image, as eight numbers separated by whitespace. An optional
+ * ninth number is the weight of the pair. A line of four numbers, the location of a point feature in the first image and in
+ * the second, and an optional fifth for the weight, is a point pair, which is loaded as a pair of segments whose endpoints
+ * coincide (see LineSegment::isPoint()). Numbers always use '.' as the decimal point, whatever the locale.
+ *
+ * The binary format, conventionally with the extension .segb, is little-endian and starts with a 24-byte header: the magic
+ * "SEGB", a uint32 version (currently 1), uint32 flags, a reserved uint32 and the uint64 number of pairs. It is followed by the
+ * eight endpoint coordinates of each pair, packed as float64 if the SEGB_FLOAT64 flag is set and as float32 otherwise, and,
+ * if the SEGB_WEIGHTS flag is set, one float32 weight per pair. Point pairs are stored with coinciding endpoints.
+ *
+ * In either format, a pair must be a point in both images or in neither.
+ */
+enum SegmentFormat
+{
+  SEGMENTS_TEXT,
+  SEGMENTS_BINARY32,
+  SEGMENTS_BINARY64
+};
+
+/** Get the format for a segment file from its extension: binary (float32) for .segb, else text. */
+SegmentFormat segmentFormatForPath(std::string const & path);
+
+/**
+ * Read segment pairs from a file in either format, detected from its contents. If \a weights is non-null, it receives the
+ * weight of each pair, which is 1 unless the file specifies otherwise.
+ */
+bool loadSegments(std::string const & path, std::vector<LineSegment> & seg1, std::vector<LineSegment> & seg2,
+                  std::vector<double> * weights = NULL);
+
+/** Save segment pairs, and optionally their weights, to a file in the specified format. */
+bool saveSegments(std::string const & path, std::vector<LineSegment> const & seg1, std::vector<LineSegment> const & seg2,
+                  SegmentFormat format = SEGMENTS_TEXT, std::vector<double> const * weights = NULL);
+
+/**
+ * Reads a stream of segment sets, e.g. one per frame of a video, one set at a time. The stream is a concatenation of segment
+ * files, all in the text or all in the binary format, so a single segment file is a stream of one set.
+ */
+class SegmentReader
+{
+  private:
+    std::ifstream in;
+    std::string path;
+    bool binary;
+    long num_read;  ///< Number of sets read so far
+
+  public:
+    /** Default constructor. */
+    SegmentReader() : binary(false), num_read(0) {}
+
+    /** Open a stream, detecting its format. */
+    bool open(std::string const & path_);
+
+    /**
+     * Read the next set of segment pairs, and optionally their weights. Returns false at the end of the stream or on error,
+     * which is reported.
+     */
+    bool next(std::vector<LineSegment> & seg1, std::vector<LineSegment> & seg2, std::vector<double> * weights = NULL);
+
+    /** Get the number of sets read so far. */
+    long numRead() const { return num_read; }
+
+}; // class SegmentReader
+
+#endif // __SegmentIO_hpp__
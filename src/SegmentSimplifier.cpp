@@ -0,0 +1,231 @@
+#include "SegmentSimplifier.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+/** Samples along each axis of the grid the fields are checked on. */
+static int const GRID_SAMPLES = 32;
+
+/** Orders segment indices by the shorter of the lengths of each pair. */
+struct ShorterPair
+{
+  std::vector<LineSegment> const * seg1;
+  std::vector<LineSegment> const * seg2;
+
+  double key(int i) const { return std::min((*seg1)[i].length2(), (*seg2)[i].length2()); }
+  bool operator()(int i, int j) const { return key(i) < key(j); }
+};
+
+SegmentSimplifier::SegmentSimplifier(std::vector<LineSegment> const & seg1_, std::vector<LineSegment> const & seg2_,
+                                     int w, int h, WarpParams const & params_, Options const & opts_)
+: seg1(seg1_), seg2(seg2_), params(params_), opts(opts_), max_change(0)
+{
+  assert(seg1.size() == seg2.size());
+
+  for (int r = 0; r < GRID_SAMPLES; ++r)
+    for (int c = 0; c < GRID_SAMPLES; ++c)
+      samples.push_back(Vec2((c + 0.5) * w / GRID_SAMPLES - 0.5, (r + 0.5) * h / GRID_SAMPLES - 0.5));
+
+  double const times[] = { 0.5, 1.0 };
+  for (int reverse = 0; reverse < 2; ++reverse)
+    for (int k = 0; k < 2; ++k)
+    {
+      SampledField f;
+      f.t = times[k];
+      f.reverse = (reverse != 0);
+      f.dissum.assign(samples.size(), Vec2(0, 0));
+      f.wtsum.assign(samples.size(), 0.0);
+      f.ref.assign(samples.size(), Vec2(0, 0));
+
+      for (size_t i = 0; i < samples.size(); ++i)
+      {
+        for (size_t j = 0; j < seg1.size(); ++j)
+          accumulate(seg1[j], seg2[j], f, i, 1, f.dissum[i], f.wtsum[i]);
+
+        if (f.wtsum[i] > 0)
+          f.ref[i] = f.dissum[i] / f.wtsum[i];
+      }
+
+      fields.push_back(f);
+    }
+}
+
+void
+SegmentSimplifier::accumulate(LineSegment const & s1, LineSegment const & s2, SampledField const & f, size_t i, double sign,
+                              Vec2 & dissum, double & wtsum) const
+{
+  LineSegment const & start_ln = (f.reverse ? s2 : s1);
+  LineSegment end_ln = start_ln.lerp(f.reverse ? s1 : s2, f.t);
+
+  Vec2 dis(0, 0);
+  double wt = 0;
+  accumulateSegmentPair(start_ln, end_ln, samples[i], params, dis, wt);
+  dissum += sign * dis;
+  wtsum += sign * wt;
+}
+
+bool
+SegmentSimplifier::tryChange(std::vector<int> const & removed, bool add, LineSegment const & add1, LineSegment const & add2)
+{
+  std::vector< std::vector<Vec2> > new_dissum(fields.size());
+  std::vector< std::vector<double> > new_wtsum(fields.size());
+  double change = 0;
+
+  for (size_t k = 0; k < fields.size(); ++k)
+  {
+    SampledField const & f = fields[k];
+    new_dissum[k] = f.dissum;
+    new_wtsum[k] = f.wtsum;
+
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+      Vec2 & dissum = new_dissum[k][i];
+      double & wtsum = new_wtsum[k][i];
+      for (size_t j = 0; j < removed.size(); ++j)
+        accumulate(seg1[removed[j]], seg2[removed[j]], f, i, -1, dissum, wtsum);
+
+      if (add)
+        accumulate(add1, add2, f, i, 1, dissum, wtsum);
+
+      // Weights are positive, so a vanishing sum means the sample has lost all its segments
+      if (wtsum <= 1e-12 * f.wtsum[i])
+        return false;
+
+      change = std::max(change, (dissum / wtsum - f.ref[i]).length());
+      if (change > opts.tolerance)
+        return false;
+    }
+  }
+
+  for (size_t k = 0; k < fields.size(); ++k)
+  {
+    fields[k].dissum.swap(new_dissum[k]);
+    fields[k].wtsum.swap(new_wtsum[k]);
+  }
+
+  max_change = change;
+  return true;
+}
+
+/** Check if a segment runs in nearly the same direction as another, to within an angle whose cosine is \a min_cos. */
+static bool
+isAligned(LineSegment const & s, LineSegment const & other, double min_cos)
+{
+  double len = s.length() * other.length();
+  return len > 0 && s.direction() * other.direction() >= min_cos * len;
+}
+
+bool
+SegmentSimplifier::joinable(int i, int j, LineSegment & join1, LineSegment & join2) const
+{
+  double min_cos = std::cos(opts.max_angle * M_PI / 180);
+
+  // Try each pairing of an endpoint of i with an endpoint of j, which must coincide in both sets
+  for (int ei = 0; ei < 2; ++ei)
+    for (int ej = 0; ej < 2; ++ej)
+    {
+      bool ok = true;
+      LineSegment joins[2];
+      for (int set = 0; set < 2 && ok; ++set)
+      {
+        LineSegment const & si = (set == 0 ? seg1 : seg2)[i];
+        LineSegment const & sj = (set == 0 ? seg1 : seg2)[j];
+        if ((si.endpoint(ei) - sj.endpoint(ej)).length() > opts.max_gap)
+        {
+          ok = false;
+          break;
+        }
+
+        // The joined segment keeps the orientation of i, so j runs along it only if it leaves from the shared end
+        LineSegment joined = (ei == 1 ? LineSegment(si.start(), sj.endpoint(1 - ej))
+                                      : LineSegment(sj.endpoint(1 - ej), si.end()));
+        LineSegment sj_along = (ej != ei ? sj : LineSegment(sj.end(), sj.start()));
+        ok = isAligned(si, joined, min_cos) && isAligned(sj_along, joined, min_cos);
+        joins[set] = joined;
+      }
+
+      if (ok)
+      {
+        join1 = joins[0];
+        join2 = joins[1];
+        return true;
+      }
+    }
+
+  return false;
+}
+
+int
+SegmentSimplifier::mergeCollinear()
+{
+  int num_merged = 0;
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (int i = 0; i < (int)seg1.size(); ++i)
+      for (int j = 0; j < (int)seg1.size(); ++j)
+      {
+        LineSegment join1, join2;
+        if (j == i || !joinable(i, j, join1, join2))
+          continue;
+
+        std::vector<int> removed;
+        removed.push_back(i);
+        removed.push_back(j);
+        if (!tryChange(removed, true, join1, join2))
+          continue;
+
+        seg1[i] = join1;
+        seg2[i] = join2;
+        seg1.erase(seg1.begin() + j);
+        seg2.erase(seg2.begin() + j);
+        ++num_merged;
+        changed = true;
+
+        // Keep extending the merged segment
+        if (j < i)
+          --i;
+        j = -1;
+      }
+  }
+
+  return num_merged;
+}
+
+int
+SegmentSimplifier::prune()
+{
+  std::vector<int> order(seg1.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = (int)i;
+
+  ShorterPair shorter = { &seg1, &seg2 };
+  std::stable_sort(order.begin(), order.end(), shorter);
+
+  std::vector<bool> keep(seg1.size(), true);
+  size_t num_kept = seg1.size();
+  for (size_t k = 0; k < order.size() && num_kept > 1; ++k)
+  {
+    std::vector<int> removed(1, order[k]);
+    if (tryChange(removed, false, LineSegment(), LineSegment()))
+    {
+      keep[order[k]] = false;
+      --num_kept;
+    }
+  }
+
+  std::vector<LineSegment> kept1, kept2;
+  for (size_t i = 0; i < seg1.size(); ++i)
+    if (keep[i])
+    {
+      kept1.push_back(seg1[i]);
+      kept2.push_back(seg2[i]);
+    }
+
+  int num_pruned = (int)(seg1.size() - kept1.size());
+  seg1.swap(kept1);
+  seg2.swap(kept2);
+
+  return num_pruned;
+}
@@ -0,0 +1,88 @@
+#ifndef __SegmentSimplifier_hpp__
+#define __SegmentSimplifier_hpp__
+
+#include "Algebra3.hpp"
+#include "LineSegment.hpp"
+#include "WarpKernel.hpp"
+#include <vector>
+
+/**
+ * Reduces a set of segment pairs to a smaller one inducing nearly the same warp. Collinear runs of segments that continue each
+ * other in both images are merged into single segments, and segments are dropped if the warp barely depends on them. Every
+ * change is checked against the warp fields of the original set, sampled on a regular grid, and is only accepted if it moves
+ * no sample by more than the tolerance. The fields are checked halfway through and at the end of the morph, in both
+ * directions. Since the field at a point is a ratio of sums over the segments, the effect of a change is found by updating
+ * the running sums at each sample, without re-evaluating the other segments.
+ */
+class SegmentSimplifier
+{
+  public:
+    /** Options controlling the simplification. */
+    struct Options
+    {
+      double tolerance;  ///< Largest change in displacement, in pixels, allowed at any sample
+      double max_angle;  ///< Largest angle, in degrees, between two segments merged into one
+      double max_gap;    ///< Largest gap, in pixels, between two segments merged into one
+
+      /** Constructor. */
+      Options(double tolerance_ = 0.5, double max_angle_ = 5, double max_gap_ = 2)
+      : tolerance(tolerance_), max_angle(max_angle_), max_gap(max_gap_) {}
+    };
+
+  private:
+    /** A warp field sampled on the grid, as running sums over the current segments. */
+    struct SampledField
+    {
+      double t;                  ///< Time of the field
+      bool reverse;              ///< Distorting the second set of segments towards the first
+      std::vector<Vec2> dissum;  ///< Sum of weighted displacements at each sample
+      std::vector<double> wtsum; ///< Sum of weights at each sample
+      std::vector<Vec2> ref;     ///< Displacements of the original segments at each sample
+    };
+
+    std::vector<LineSegment> seg1, seg2;
+    std::vector<Vec2> samples;
+    std::vector<SampledField> fields;
+    WarpParams params;
+    Options opts;
+    double max_change;
+
+    /** Add the contribution of segment pair (s1, s2) to field \a f at sample \a i, scaled by \a sign, to the given sums. */
+    void accumulate(LineSegment const & s1, LineSegment const & s2, SampledField const & f, size_t i, double sign,
+                    Vec2 & dissum, double & wtsum) const;
+
+    /**
+     * Check whether removing the segments \a removed and adding the pair (\a add1, \a add2), unless \a add is false, keeps every
+     * sampled displacement within tolerance. If so, apply the change to the running sums and return true.
+     */
+    bool tryChange(std::vector<int> const & removed, bool add, LineSegment const & add1, LineSegment const & add2);
+
+    /** Try to join segment \a j onto the end of segment \a i in both sets, returning the joined pairs on success. */
+    bool joinable(int i, int j, LineSegment & join1, LineSegment & join2) const;
+
+  public:
+    /**
+     * Construct from segments \a seg1_ and \a seg2_, both in the coordinates of a \a w x \a h image, which is where the
+     * fields are sampled.
+     */
+    SegmentSimplifier(std::vector<LineSegment> const & seg1_, std::vector<LineSegment> const & seg2_, int w, int h,
+                      WarpParams const & params_, Options const & opts_);
+
+    /** Merge collinear runs of segments. Returns the number of merges. */
+    int mergeCollinear();
+
+    /** Drop segments, shortest first, that the warp barely depends on. Returns the number of segments dropped. */
+    int prune();
+
+    /** Get the simplified segments in the first image. */
+    std::vector<LineSegment> const & segments1() const { return seg1; }
+
+    /** Get the simplified segments in the second image. */
+    std::vector<LineSegment> const & segments2() const { return seg2; }
+
+    /** Get the largest change of a sampled displacement from the original segments, in pixels. */
+    double maxChange() const { return max_change; }
+
+}; // class SegmentSimplifier
+
+#endif // __SegmentSimplifier_hpp__
@@ -0,0 +1,185 @@
+#include "SegmentTree.hpp"
+#include <algorithm>
+#include <cassert>
+
+/** Segments per leaf group. Leaves are always evaluated exactly. */
+static int const LEAF_SIZE = 2;
+
+/** Orders segment indices by one coordinate of their midpoints. */
+struct MidpointLess
+{
+  std::vector<Vec2> const * mids;
+  int axis;
+
+  bool operator()(int i, int j) const { return (*mids)[i][axis] < (*mids)[j][axis]; }
+};
+
+SegmentTree::SegmentTree(std::vector<LineSegment> const & seg_start, std::vector<LineSegment> const & seg_end, double t,
+                         WarpParams const & params_)
+: params(params_)
+{
+  assert(seg_start.size() == seg_end.size());
+
+  starts = seg_start;
+  ends.resize(seg_start.size());
+  std::vector<Vec2> mids(seg_start.size());
+  for (size_t i = 0; i < seg_start.size(); ++i)
+  {
+    ends[i] = seg_start[i].lerp(seg_end[i], t);
+    mids[i] = 0.25 * (starts[i].start() + starts[i].end() + ends[i].start() + ends[i].end());
+  }
+
+  if (!starts.empty())
+    build(0, (int)starts.size(), mids);
+
+  pairs.resize(starts.size());
+  points.resize(starts.size());
+  for (size_t i = 0; i < starts.size(); ++i)
+  {
+    if (starts[i].isPoint())
+      points[i] = PointPairTerms(starts[i], ends[i]);
+    else
+      pairs[i] = SegmentPairTerms(starts[i], ends[i], params);
+  }
+}
+
+int
+SegmentTree::build(int first, int last, std::vector<Vec2> & mids)
+{
+  Node node;
+  node.center = node.k = Vec2(0, 0);
+  node.radius = node.len_wt = 0;
+  node.m[0] = node.m[1] = node.m[2] = node.m[3] = 0;
+  node.first = first;
+  node.last = last;
+  node.child[0] = node.child[1] = -1;
+
+  int index = (int)nodes.size();
+  nodes.push_back(node);
+
+  if (last - first > LEAF_SIZE)
+  {
+    // Split at the median along the axis in which the midpoints are most spread out
+    Vec2 lo = mids[first], hi = mids[first];
+    for (int i = first + 1; i < last; ++i)
+    {
+      lo = min(lo, mids[i]);
+      hi = max(hi, mids[i]);
+    }
+
+    std::vector<int> order(last - first);
+    for (int i = first; i < last; ++i)
+      order[i - first] = i;
+
+    MidpointLess less = { &mids, (hi.x() - lo.x() >= hi.y() - lo.y()) ? 0 : 1 };
+    std::nth_element(order.begin(), order.begin() + order.size() / 2, order.end(), less);
+
+    std::vector<LineSegment> s(order.size()), e(order.size());
+    std::vector<Vec2> m(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+      s[i] = starts[order[i]];
+      e[i] = ends[order[i]];
+      m[i] = mids[order[i]];
+    }
+    std::copy(s.begin(), s.end(), starts.begin() + first);
+    std::copy(e.begin(), e.end(), ends.begin() + first);
+    std::copy(m.begin(), m.end(), mids.begin() + first);
+
+    int split = first + (int)order.size() / 2;
+    node.child[0] = build(first, split, mids);
+    node.child[1] = build(split, last, mids);
+  }
+
+  // Aggregate the length-weighted affine displacement maps of the members
+  Vec2 weighted_mid(0, 0), plain_mid(0, 0);
+  for (int i = first; i < last; ++i)
+  {
+    LineSegment const & start_ln = starts[i];
+    LineSegment const & end_ln = ends[i];
+
+    if (start_ln.isPoint())
+    {
+      // A constant displacement, with the length factor of a unit segment
+      node.k += start_ln.start() - end_ln.start();
+      node.len_wt += 1;
+      weighted_mid += mids[i];
+      plain_mid += mids[i];
+      continue;
+    }
+
+    // u = gu . (x - P) and v = gv . (x - P) on the current segment, which map to P' + u Q' + v R' on the source segment
+    Vec2 gu = end_ln.direction() / end_ln.length2();
+    Vec2 gv = end_ln.perp() / end_ln.length();
+    Vec2 q = start_ln.direction();
+    Vec2 r = start_ln.perp() / start_ln.length();
+    Vec2 org = start_ln.start() - q * (gu * end_ln.start()) - r * (gv * end_ln.start());
+
+    double len_wt = std::pow(start_ln.length(), params.p * params.b);
+    node.m[0] += len_wt * (q.x() * gu.x() + r.x() * gv.x() - 1);
+    node.m[1] += len_wt * (q.x() * gu.y() + r.x() * gv.y());
+    node.m[2] += len_wt * (q.y() * gu.x() + r.y() * gv.x());
+    node.m[3] += len_wt * (q.y() * gu.y() + r.y() * gv.y() - 1);
+    node.k += len_wt * org;
+    node.len_wt += len_wt;
+
+    weighted_mid += len_wt * mids[i];
+    plain_mid += mids[i];
+  }
+
+  node.center = (node.len_wt > 0 ? weighted_mid / node.len_wt : plain_mid / (last - first));
+  node.radius = 0;
+  for (int i = first; i < last; ++i)
+  {
+    node.radius = std::max(node.radius, std::max((starts[i].start() - node.center).length(),
+                                                 (starts[i].end() - node.center).length()));
+    node.radius = std::max(node.radius, std::max((ends[i].start() - node.center).length(),
+                                                 (ends[i].end() - node.center).length()));
+  }
+
+  nodes[index] = node;
+  return index;
+}
+
+void
+SegmentTree::accumulate(Vec2 const & curr, Vec2 & dissum, double & wtsum) const
+{
+  if (nodes.empty())
+    return;
+
+  int stack[64];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0)
+  {
+    Node const & node = nodes[stack[--top]];
+
+    if (node.child[0] < 0)
+    {
+      for (int i = node.first; i < node.last; ++i)
+      {
+        if (starts[i].isPoint())
+          accumulatePointPair(points[i], curr, params, dissum, wtsum);
+        else
+          accumulateSegmentPair(pairs[i], curr, params, dissum, wtsum);
+      }
+
+      continue;
+    }
+
+    double d = (curr - node.center).length();
+    if (node.radius < params.theta * d)
+    {
+      // Far away: the whole group acts like one segment at its center
+      double f = (params.weight_table ? params.weight_table->falloff(d) : std::pow(params.a + d, -params.b));
+      dissum += f * (Vec2(node.m[0] * curr.x() + node.m[1] * curr.y(), node.m[2] * curr.x() + node.m[3] * curr.y()) + node.k);
+      wtsum += f * node.len_wt;
+    }
+    else
+    {
+      stack[top++] = node.child[0];
+      stack[top++] = node.child[1];
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef __SegmentTree_hpp__
+#define __SegmentTree_hpp__
+
+#include "Algebra3.hpp"
+#include "LineSegment.hpp"
+#include "WarpKernel.hpp"
+#include <vector>
+
+/**
+ * A bounding hierarchy of segment pairs for evaluating the field warp in time roughly logarithmic in the number of segments,
+ * in the manner of Barnes-Hut. The displacement a segment pair induces at a point is an affine function of the point, so each
+ * group of segments stores the sum of its members' affine maps and weights, scaled by their length factors. A group that
+ * is far from the point relative to its size (see WarpParams::theta) then contributes as a single aggregate, with the
+ * distance of the point to the group's center standing in for the distances to its members; nearby groups are opened and
+ * their segments evaluated exactly. Point pairs are members like segments, with a constant displacement and unit length factor.
+ */
+class SegmentTree
+{
+  private:
+    /** A group of segment pairs. */
+    struct Node
+    {
+      Vec2 center;         ///< Length-weighted centroid of the members' endpoints
+      double radius;       ///< Distance from the center to the farthest member endpoint
+      double len_wt;       ///< Sum of the members' length factors len^(p b)
+      double m[4];         ///< Sum of the members' length-weighted displacement Jacobians, row-major
+      Vec2 k;              ///< Sum of the members' length-weighted displacements at the origin
+      int first, last;     ///< Range of members in the segment order
+      int child[2];        ///< Child groups, or -1 for a leaf
+    };
+
+    std::vector<LineSegment> starts, ends;  ///< Segment pairs in tree order, end segments interpolated to the current time
+    std::vector<SegmentPairTerms> pairs;    ///< Precomputed terms of the segment pairs, for evaluating leaves exactly
+    std::vector<PointPairTerms> points;     ///< Precomputed terms of the point pairs, at the same indices
+    std::vector<Node> nodes;
+    WarpParams params;
+
+    /** Build the group holding segments [first, last) and return its index. */
+    int build(int first, int last, std::vector<Vec2> & mids);
+
+  public:
+    /** Build the hierarchy of segment pairs interpolated from seg_start to seg_end at time \a t. */
+    SegmentTree(std::vector<LineSegment> const & seg_start, std::vector<LineSegment> const & seg_end, double t,
+                WarpParams const & params_);
+
+    /** Get the number of segment groups in the hierarchy. */
+    int numNodes() const { return (int)nodes.size(); }
+
+    /**
+     * Add the weighted displacements of all segment pairs at point \a curr to \a dissum and their weights to \a wtsum,
+     * aggregating distant groups per the opening criterion.
+     */
+    void accumulate(Vec2 const & curr, Vec2 & dissum, double & wtsum) const;
+
+}; // class SegmentTree
+
+#endif // __SegmentTree_hpp__
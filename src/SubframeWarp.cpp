@@ -0,0 +1,105 @@
+#include "SubframeWarp.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
+SubframeWarp::SubframeWarp(std::vector<LineSegment> const & seg_start, std::vector< std::vector<LineSegment> > const & seg_ends,
+                           WarpParams const & params_)
+: num_sets((int)seg_ends.size()), params(params_)
+{
+  starts.resize(seg_start.size());
+  for (size_t i = 0; i < seg_start.size(); ++i)
+  {
+    LineSegment const & s = seg_start[i];
+    starts[i].start = s.start();
+    starts[i].point = s.isPoint();
+    if (starts[i].point)
+    {
+      // Weighted as a segment of unit length
+      starts[i].len_p = starts[i].len_pb = 1;
+      continue;
+    }
+
+    starts[i].dir = s.direction();
+    starts[i].unit_perp = s.perp() / s.length();
+    starts[i].len_p = std::pow(s.length(), params.p);
+    starts[i].len_pb = std::pow(starts[i].len_p, params.b);
+  }
+
+  ends.resize(seg_ends.size() * seg_start.size());
+  for (size_t k = 0; k < seg_ends.size(); ++k)
+  {
+    assert(seg_ends[k].size() == seg_start.size());
+
+    for (size_t i = 0; i < seg_start.size(); ++i)
+    {
+      LineSegment const & e = seg_ends[k][i];
+      End & end = ends[k * seg_start.size() + i];
+      end.at = e.start();
+      if (starts[i].point)
+        continue;
+
+      end.gu = e.direction() / e.length2();
+      end.gv = e.perp() / e.length();
+      end.cu = end.gu * e.start();
+      end.cv = end.gv * e.start();
+    }
+  }
+}
+
+void
+SubframeWarp::displacements(Vec2 const & curr, Vec2 * disp, Vec2 * dissum, double * wtsum) const
+{
+  for (int k = 0; k < num_sets; ++k)
+  {
+    dissum[k] = Vec2(0, 0);
+    wtsum[k] = 0;
+  }
+
+  size_t num_segs = starts.size();
+  bool linear_falloff = (params.b == 1);
+  for (size_t i = 0; i < num_segs; ++i)
+  {
+    Start const & s = starts[i];
+    End const * end = &ends[i];
+
+    // Shared by all sets of a segment: the distance used where the point projects beyond the segment
+    double end_dist = (s.point ? 0 : (curr - s.start).length());
+
+    for (int k = 0; k < num_sets; ++k, end += num_segs)
+    {
+      Vec2 dis;
+      double dist;
+      if (s.point)
+      {
+        dis = s.start - end->at;
+        dist = (curr - end->at).length();
+      }
+      else
+      {
+        double u = end->gu * curr - end->cu;
+        double v = end->gv * curr - end->cv;
+
+        dis = s.start + u * s.dir + v * s.unit_perp - curr;
+        // As LineSegment::segmentDistance(), which truncates the distance from the line to an integer
+        dist = (u < 0 || u > 1) ? end_dist : std::abs((int)v);
+      }
+
+      double wt;
+      if (params.weight_table)
+        wt = s.len_pb * params.weight_table->falloff(dist);
+      else
+      {
+        wt = s.len_p / (params.a + dist);
+        if (!linear_falloff)
+          wt = std::pow(wt, params.b);
+      }
+
+      dissum[k] += dis * wt;
+      wtsum[k] += wt;
+    }
+  }
+
+  for (int k = 0; k < num_sets; ++k)
+    disp[k] = dissum[k] / wtsum[k];
+}
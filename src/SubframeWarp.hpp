@@ -0,0 +1,64 @@
+#ifndef __SubframeWarp_hpp__
+#define __SubframeWarp_hpp__
+
+#include "Algebra3.hpp"
+#include "LineSegment.hpp"
+#include "WarpKernel.hpp"
+#include <vector>
+
+/**
+ * Evaluates the field warp of one set of start segments towards several sets of end segments at once, e.g. the sub-frames of
+ * a motion-blurred frame. Everything that only depends on the start segments and the point, i.e. the geometry of each start
+ * segment, its length factor and the point's distance to its start, is computed once per point and segment and shared by all
+ * sets of end segments. For each set, the line coordinates of the point with respect to every end segment reduce to two dot
+ * products with precomputed coefficients. Point pairs only need the distance to their location in each set. Matches
+ * accumulateSegmentPair() and accumulatePointPair() up to rounding.
+ */
+class SubframeWarp
+{
+  private:
+    /** A start segment, with what the kernel needs of it. */
+    struct Start
+    {
+      Vec2 start, dir, unit_perp;
+      double len_p;  ///< length^p
+      double len_pb; ///< length^(p b), for weights with a tabulated falloff
+      bool point;    ///< Is this a point pair?
+    };
+
+    /**
+     * The line coordinates u = gu . x - cu and v = gv . x - cv of a point x with respect to an end segment, or for a point
+     * pair, the location of the point.
+     */
+    struct End
+    {
+      Vec2 gu, gv;
+      double cu, cv;
+      Vec2 at;
+    };
+
+    std::vector<Start> starts;
+    std::vector<End> ends;  ///< Indexed by set, then segment
+    int num_sets;
+    WarpParams params;
+
+  public:
+    /**
+     * Construct from the segments to warp from, and the sets of segments to warp to, which must all correspond to
+     * \a seg_start segment by segment.
+     */
+    SubframeWarp(std::vector<LineSegment> const & seg_start, std::vector< std::vector<LineSegment> > const & seg_ends,
+                 WarpParams const & params_);
+
+    /** Get the number of sets of end segments. */
+    int numSets() const { return num_sets; }
+
+    /**
+     * Get the displacements of point \a curr towards every set of end segments. \a dissum and \a wtsum are scratch space with
+     * room for numSets() values each.
+     */
+    void displacements(Vec2 const & curr, Vec2 * disp, Vec2 * dissum, double * wtsum) const;
+
+}; // class SubframeWarp
+
+#endif // __SubframeWarp_hpp__
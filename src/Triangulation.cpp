@@ -0,0 +1,365 @@
+#include "Triangulation.hpp"
+#include <deque>
+
+/** Twice the signed area of triangle (a, b, c): positive if counter-clockwise, negative if clockwise, zero if collinear. */
+static double
+orient(Vec2 const & a, Vec2 const & b, Vec2 const & c)
+{
+  return (b.x() - a.x()) * (c.y() - a.y()) - (b.y() - a.y()) * (c.x() - a.x());
+}
+
+/** Positive if \a d is inside the circumcircle of the counter-clockwise triangle (a, b, c), negative if outside. */
+static double
+inCircle(Vec2 const & a, Vec2 const & b, Vec2 const & c, Vec2 const & d)
+{
+  double adx = a.x() - d.x(), ady = a.y() - d.y();
+  double bdx = b.x() - d.x(), bdy = b.y() - d.y();
+  double cdx = c.x() - d.x(), cdy = c.y() - d.y();
+
+  return (adx * adx + ady * ady) * (bdx * cdy - cdx * bdy)
+       + (bdx * bdx + bdy * bdy) * (cdx * ady - adx * cdy)
+       + (cdx * cdx + cdy * cdy) * (adx * bdy - bdx * ady);
+}
+
+/** Check if segments (a, b) and (c, d) cross at a point interior to both. */
+static bool
+properlyCross(Vec2 const & a, Vec2 const & b, Vec2 const & c, Vec2 const & d)
+{
+  return orient(a, b, c) * orient(a, b, d) < 0 && orient(c, d, a) * orient(c, d, b) < 0;
+}
+
+/** Successor of a vertex index of a triangle. */
+static inline int next(int i) { return i == 2 ? 0 : i + 1; }
+
+/** Predecessor of a vertex index of a triangle. */
+static inline int prev(int i) { return i == 0 ? 2 : i - 1; }
+
+/** Set the vertices, neighbors and constraint flags of a triangle. */
+static void
+setTriangle(Triangulation::Triangle & tri, int a, int b, int c, int na, int nb, int nc, bool fa, bool fb, bool fc)
+{
+  tri.v[0] = a; tri.v[1] = b; tri.v[2] = c;
+  tri.n[0] = na; tri.n[1] = nb; tri.n[2] = nc;
+  tri.fixed[0] = fa; tri.fixed[1] = fb; tri.fixed[2] = fc;
+}
+
+/** Get the index of the edge of a triangle shared with a neighbor. */
+static int
+neighborIndex(Triangulation::Triangle const & tri, int neighbor)
+{
+  return tri.n[0] == neighbor ? 0 : (tri.n[1] == neighbor ? 1 : 2);
+}
+
+Triangulation::Triangulation(std::vector<Vec2> const & points, int num_hull,
+                             std::vector< std::pair<int, int> > const & constraints)
+: pts(points), num_dropped(0)
+{
+  // Fan the hull from its first vertex
+  for (int k = 1; k + 1 < num_hull; ++k)
+  {
+    Triangle tri;
+    setTriangle(tri, 0, k, k + 1, -1, (k + 2 < num_hull ? k : -1), k - 2, false, false, false);
+    tris.push_back(tri);
+  }
+
+  std::vector<bool> present(pts.size(), false);
+  for (int i = 0; i < num_hull && i < (int)pts.size(); ++i)
+    present[(size_t)i] = true;
+
+  int hint = 0;
+  for (int i = num_hull; i < (int)pts.size(); ++i)
+  {
+    size_t num_tris = tris.size();
+    insert(i, hint);
+    present[(size_t)i] = (tris.size() != num_tris);
+  }
+
+  for (size_t i = 0; i < constraints.size(); ++i)
+  {
+    int a = constraints[i].first, b = constraints[i].second;
+    if (a == b || !present[(size_t)a] || !present[(size_t)b] || !enforce(a, b))
+      ++num_dropped;
+  }
+}
+
+int
+Triangulation::locate(Vec2 const & p, int start) const
+{
+  // Visibility walk, which terminates on Delaunay triangulations; the step limit guards against rounding
+  int t = start;
+  for (size_t steps = 0; t >= 0 && steps < 4 * tris.size() + 16; ++steps)
+  {
+    Triangle const & tri = tris[(size_t)t];
+    int across = -1;
+    for (int k = 0; k < 3 && across < 0; ++k)
+      if (orient(pts[(size_t)tri.v[next(k)]], pts[(size_t)tri.v[prev(k)]], p) < 0)
+        across = k;
+
+    if (across < 0)
+      return t;
+
+    t = tri.n[across];
+  }
+
+  return -1;
+}
+
+void
+Triangulation::insert(int i, int & hint)
+{
+  Vec2 const & p = pts[(size_t)i];
+  int t = locate(p, hint);
+  for (int u = 0; t < 0 && u < (int)tris.size(); ++u)
+  {
+    Triangle const & tri = tris[(size_t)u];
+    if (orient(pts[(size_t)tri.v[0]], pts[(size_t)tri.v[1]], p) >= 0
+     && orient(pts[(size_t)tri.v[1]], pts[(size_t)tri.v[2]], p) >= 0
+     && orient(pts[(size_t)tri.v[2]], pts[(size_t)tri.v[0]], p) >= 0)
+      t = u;
+  }
+
+  if (t < 0)
+    return;
+
+  Triangle tri = tris[(size_t)t];
+  int on_edge = -1;
+  for (int k = 0; k < 3; ++k)
+  {
+    if (pts[(size_t)tri.v[k]] == p)
+      return;
+
+    if (orient(pts[(size_t)tri.v[next(k)]], pts[(size_t)tri.v[prev(k)]], p) == 0)
+      on_edge = k;
+  }
+
+  std::vector< std::pair<int, int> > stack;
+  if (on_edge < 0 || tri.n[on_edge] < 0)
+  {
+    // Split the triangle (a, b, c) into three around p
+    int a = tri.v[0], b = tri.v[1], c = tri.v[2];
+    int t1 = (int)tris.size(), t2 = t1 + 1;
+    tris.resize(tris.size() + 2);
+    setTriangle(tris[(size_t)t], i, b, c, tri.n[0], t1, t2, tri.fixed[0], false, false);
+    setTriangle(tris[(size_t)t1], i, c, a, tri.n[1], t2, t, tri.fixed[1], false, false);
+    setTriangle(tris[(size_t)t2], i, a, b, tri.n[2], t, t1, tri.fixed[2], false, false);
+
+    if (tri.n[1] >= 0)
+      tris[(size_t)tri.n[1]].n[neighborIndex(tris[(size_t)tri.n[1]], t)] = t1;
+    if (tri.n[2] >= 0)
+      tris[(size_t)tri.n[2]].n[neighborIndex(tris[(size_t)tri.n[2]], t)] = t2;
+
+    stack.push_back(std::make_pair(t, 0));
+    stack.push_back(std::make_pair(t1, 0));
+    stack.push_back(std::make_pair(t2, 0));
+  }
+  else
+  {
+    // Split the edge (b, c) shared by triangles (a, b, c) and (d, c, b), and both triangles with it
+    int k = on_edge;
+    int a = tri.v[k], b = tri.v[next(k)], c = tri.v[prev(k)];
+    int u = tri.n[k];
+    Triangle other = tris[(size_t)u];
+    int j = neighborIndex(other, t);
+    int d = other.v[j];
+    int n_ca = tri.n[next(k)], n_ab = tri.n[prev(k)], n_bd = other.n[next(j)], n_dc = other.n[prev(j)];
+    bool split_fixed = tri.fixed[k];
+
+    int t2 = (int)tris.size(), t4 = t2 + 1;
+    tris.resize(tris.size() + 2);
+    setTriangle(tris[(size_t)t], i, c, a, n_ca, t2, t4, tri.fixed[next(k)], false, split_fixed);
+    setTriangle(tris[(size_t)t2], i, a, b, n_ab, u, t, tri.fixed[prev(k)], split_fixed, false);
+    setTriangle(tris[(size_t)u], i, b, d, n_bd, t4, t2, other.fixed[next(j)], false, split_fixed);
+    setTriangle(tris[(size_t)t4], i, d, c, n_dc, t, u, other.fixed[prev(j)], split_fixed, false);
+
+    if (n_ab >= 0)
+      tris[(size_t)n_ab].n[neighborIndex(tris[(size_t)n_ab], t)] = t2;
+    if (n_dc >= 0)
+      tris[(size_t)n_dc].n[neighborIndex(tris[(size_t)n_dc], u)] = t4;
+
+    stack.push_back(std::make_pair(t, 0));
+    stack.push_back(std::make_pair(t2, 0));
+    stack.push_back(std::make_pair(u, 0));
+    stack.push_back(std::make_pair(t4, 0));
+  }
+
+  legalize(stack);
+  hint = t;
+}
+
+void
+Triangulation::legalize(std::vector< std::pair<int, int> > & stack)
+{
+  while (!stack.empty())
+  {
+    int t = stack.back().first, i = stack.back().second;
+    stack.pop_back();
+
+    if (!isIllegal(t, i) || !isConvexQuad(t, i))
+      continue;
+
+    int u = tris[(size_t)t].n[i];
+    flip(t, i);
+    stack.push_back(std::make_pair(t, 0));
+    stack.push_back(std::make_pair(u, 0));
+  }
+}
+
+void
+Triangulation::flip(int t, int i)
+{
+  // (a, b, c) and (d, c, b) become (a, b, d) and (a, d, c)
+  Triangle tri = tris[(size_t)t];
+  int u = tri.n[i];
+  Triangle other = tris[(size_t)u];
+  int j = neighborIndex(other, t);
+
+  int a = tri.v[i], b = tri.v[next(i)], c = tri.v[prev(i)], d = other.v[j];
+  int n_ca = tri.n[next(i)], n_ab = tri.n[prev(i)], n_bd = other.n[next(j)], n_dc = other.n[prev(j)];
+
+  setTriangle(tris[(size_t)t], a, b, d, n_bd, u, n_ab, other.fixed[next(j)], false, tri.fixed[prev(i)]);
+  setTriangle(tris[(size_t)u], a, d, c, n_dc, n_ca, t, other.fixed[prev(j)], tri.fixed[next(i)], false);
+
+  if (n_bd >= 0)
+    tris[(size_t)n_bd].n[neighborIndex(tris[(size_t)n_bd], u)] = t;
+  if (n_ca >= 0)
+    tris[(size_t)n_ca].n[neighborIndex(tris[(size_t)n_ca], t)] = u;
+}
+
+bool
+Triangulation::isConvexQuad(int t, int i) const
+{
+  Triangle const & tri = tris[(size_t)t];
+  if (tri.n[i] < 0)
+    return false;
+
+  Triangle const & other = tris[(size_t)tri.n[i]];
+  Vec2 const & a = pts[(size_t)tri.v[i]];
+  Vec2 const & b = pts[(size_t)tri.v[next(i)]];
+  Vec2 const & c = pts[(size_t)tri.v[prev(i)]];
+  Vec2 const & d = pts[(size_t)other.v[neighborIndex(other, t)]];
+
+  // The triangles flipping would create must both be counter-clockwise
+  return orient(a, b, d) > 0 && orient(a, d, c) > 0;
+}
+
+bool
+Triangulation::isIllegal(int t, int i) const
+{
+  Triangle const & tri = tris[(size_t)t];
+  if (tri.n[i] < 0 || tri.fixed[i])
+    return false;
+
+  Triangle const & other = tris[(size_t)tri.n[i]];
+  return inCircle(pts[(size_t)tri.v[0]], pts[(size_t)tri.v[1]], pts[(size_t)tri.v[2]],
+                  pts[(size_t)other.v[neighborIndex(other, t)]]) > 0;
+}
+
+bool
+Triangulation::findEdge(int a, int b, int & t, int & i) const
+{
+  for (size_t u = 0; u < tris.size(); ++u)
+    for (int k = 0; k < 3; ++k)
+      if (tris[u].v[next(k)] == a && tris[u].v[prev(k)] == b)
+      {
+        t = (int)u;
+        i = k;
+        return true;
+      }
+
+  return false;
+}
+
+bool
+Triangulation::enforce(int a, int b)
+{
+  Vec2 const & pa = pts[(size_t)a];
+  Vec2 const & pb = pts[(size_t)b];
+
+  int t, i;
+  if (!findEdge(a, b, t, i) && !findEdge(b, a, t, i))
+  {
+    // The constraint cannot pass through a point
+    for (size_t k = 0; k < pts.size(); ++k)
+      if ((int)k != a && (int)k != b && orient(pa, pb, pts[k]) == 0 && (pts[k] - pa) * (pb - pa) > 0
+       && (pts[k] - pb) * (pa - pb) > 0)
+        return false;
+
+    // Collect the edges crossing the constraint, each once, none of which may be a constraint itself
+    std::deque< std::pair<int, int> > crossing;
+    for (size_t u = 0; u < tris.size(); ++u)
+      for (int k = 0; k < 3; ++k)
+      {
+        int e0 = tris[u].v[next(k)], e1 = tris[u].v[prev(k)];
+        if (tris[u].n[k] < (int)u || e0 == a || e0 == b || e1 == a || e1 == b
+         || !properlyCross(pa, pb, pts[(size_t)e0], pts[(size_t)e1]))
+          continue;
+
+        if (tris[u].fixed[k])
+          return false;
+
+        crossing.push_back(std::make_pair(e0, e1));
+      }
+
+    // Flip crossing edges that are diagonals of convex quads until none cross; those that do not are retried later
+    std::vector< std::pair<int, int> > created;
+    size_t max_steps = 64 + 16 * crossing.size() * crossing.size();
+    for (size_t steps = 0; !crossing.empty(); ++steps)
+    {
+      if (steps > max_steps)
+        return false;
+
+      std::pair<int, int> e = crossing.front();
+      crossing.pop_front();
+      if (!findEdge(e.first, e.second, t, i))
+        continue;
+
+      if (!isConvexQuad(t, i))
+      {
+        crossing.push_back(e);
+        continue;
+      }
+
+      flip(t, i);
+      std::pair<int, int> flipped(tris[(size_t)t].v[0], tris[(size_t)t].v[2]);
+      if (flipped.first != a && flipped.first != b && flipped.second != a && flipped.second != b
+       && properlyCross(pa, pb, pts[(size_t)flipped.first], pts[(size_t)flipped.second]))
+        crossing.push_back(flipped);
+      else
+        created.push_back(flipped);
+    }
+
+    // Restore the empty circumcircle property across the new edges
+    bool swapped = true;
+    for (size_t pass = 0; swapped && pass < 4 * created.size() + 4; ++pass)
+    {
+      swapped = false;
+      for (size_t k = 0; k < created.size(); ++k)
+      {
+        int e0 = created[k].first, e1 = created[k].second;
+        if ((e0 == a && e1 == b) || (e0 == b && e1 == a) || !findEdge(e0, e1, t, i))
+          continue;
+
+        if (isIllegal(t, i) && isConvexQuad(t, i))
+        {
+          flip(t, i);
+          created[k] = std::make_pair(tris[(size_t)t].v[0], tris[(size_t)t].v[2]);
+          swapped = true;
+        }
+      }
+    }
+
+    if (!findEdge(a, b, t, i) && !findEdge(b, a, t, i))
+      return false;
+  }
+
+  // Mark the edge on both sides
+  Triangle & tri = tris[(size_t)t];
+  tri.fixed[i] = true;
+  if (tri.n[i] >= 0)
+  {
+    Triangle & other = tris[(size_t)tri.n[i]];
+    other.fixed[neighborIndex(other, t)] = true;
+  }
+
+  return true;
+}
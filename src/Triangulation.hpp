@@ -0,0 +1,86 @@
+#ifndef __Triangulation_hpp__
+#define __Triangulation_hpp__
+
+#include "Algebra3.hpp"
+#include <utility>
+#include <vector>
+
+/**
+ * A constrained Delaunay triangulation of a set of points: the Delaunay triangulation, except that a given set of constraint
+ * edges between the points appear as edges of the triangulation, and only triangles seeing each other across unconstrained
+ * edges need satisfy the empty circumcircle property. The first three or more points must form the convex hull of all the
+ * points, with every other point strictly inside it, e.g. the corners of a box around them.
+ *
+ * Points are inserted incrementally and the triangulation is kept Delaunay by flipping edges (Lawson's algorithm). Constraint
+ * edges are then recovered by flipping the edges they cross (Sloan's algorithm), and the flipped region restored to
+ * constrained Delaunay. A constraint that crosses an earlier one, or runs through another point, cannot be an edge and is
+ * dropped. Points coinciding with earlier points are ignored.
+ */
+class Triangulation
+{
+  public:
+    /** A triangle, with its vertices in counter-clockwise order. */
+    struct Triangle
+    {
+      int v[3];      ///< Indices of the vertices
+      int n[3];      ///< Triangle across the edge opposite each vertex, or -1 on the hull
+      bool fixed[3]; ///< Whether the edge opposite each vertex is a constraint
+    };
+
+  private:
+    std::vector<Vec2> pts;
+    std::vector<Triangle> tris;
+    int num_dropped;
+
+    /** Insert point \a i, which lies strictly inside the hull, starting the search for its triangle at \a hint. */
+    void insert(int i, int & hint);
+
+    /** Find the triangle containing point \a p by walking from \a start, or -1 if it could not be found. */
+    int locate(Vec2 const & p, int start) const;
+
+    /** Flip the edges around a new vertex, on the stack of (triangle, index of the new vertex) pairs, until Delaunay. */
+    void legalize(std::vector< std::pair<int, int> > & stack);
+
+    /**
+     * Flip the edge opposite vertex \a i of triangle \a t. Afterwards \a t and its former neighbor are the two triangles
+     * sharing the new edge, with t's vertex i at index 0 of both.
+     */
+    void flip(int t, int i);
+
+    /** Check if the two triangles sharing the edge opposite vertex \a i of triangle \a t form a strictly convex quad. */
+    bool isConvexQuad(int t, int i) const;
+
+    /** Check if the vertex across the edge opposite vertex \a i of triangle \a t is inside the circumcircle of \a t. */
+    bool isIllegal(int t, int i) const;
+
+    /** Find the triangle with directed edge (a, b) and the index of the vertex opposite it, or return false if none. */
+    bool findEdge(int a, int b, int & t, int & i) const;
+
+    /** Make the edge between points \a a and \a b an edge of the triangulation, or return false if it cannot be. */
+    bool enforce(int a, int b);
+
+  public:
+    /** Default constructor, with no triangles. */
+    Triangulation() : num_dropped(0) {}
+
+    /**
+     * Triangulate \a points with the given constraint edges, as pairs of indices into \a points. The first \a num_hull points
+     * are the vertices of the convex hull, in counter-clockwise order.
+     */
+    Triangulation(std::vector<Vec2> const & points, int num_hull, std::vector< std::pair<int, int> > const & constraints);
+
+    /** Get the triangulated points. */
+    std::vector<Vec2> const & points() const { return pts; }
+
+    /** Get the number of triangles. */
+    int numTriangles() const { return (int)tris.size(); }
+
+    /** Get a triangle. */
+    Triangle const & triangle(int i) const { return tris[(size_t)i]; }
+
+    /** Get the number of constraints that were dropped because they crossed another constraint or ran through a point. */
+    int numDroppedConstraints() const { return num_dropped; }
+
+}; // class Triangulation
+
+#endif // __Triangulation_hpp__
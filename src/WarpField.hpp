@@ -0,0 +1,209 @@
+#ifndef __WarpField_hpp__
+#define __WarpField_hpp__
+
+#include "Algebra3.hpp"
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+/** An axis-aligned affine map, e.g. between the pixel coordinates of two grids covering the same extent. */
+struct GridTransform
+{
+  Vec2 scale, offset;
+
+  /** Identity transform. */
+  GridTransform() : scale(1, 1), offset(0, 0) {}
+
+  /** Construct from per-axis scale and offset. */
+  GridTransform(Vec2 const & scale_, Vec2 const & offset_) : scale(scale_), offset(offset_) {}
+
+  /**
+   * Get the transform taking pixel coordinates on a \a w0 x \a h0 grid to those on a \a w1 x \a h1 grid covering the same
+   * extent. Pixels are centered at integer coordinates on both grids.
+   */
+  static GridTransform betweenGrids(int w0, int h0, int w1, int h1)
+  {
+    Vec2 s(w1 / (double)w0, h1 / (double)h0);
+    return GridTransform(s, 0.5 * s - Vec2(0.5, 0.5));
+  }
+
+  /** Check if this is the identity transform. */
+  bool isIdentity() const { return scale == Vec2(1, 1) && offset == Vec2(0, 0); }
+
+  /** Transform a point. */
+  Vec2 apply(Vec2 const & p) const { return prod(scale, p) + offset; }
+
+  /** Transform a direction, ignoring the offset. */
+  Vec2 applyLinear(Vec2 const & v) const { return prod(scale, v); }
+
+  /** Get the transform applying this one and then \a next. */
+  GridTransform then(GridTransform const & next) const
+  {
+    return GridTransform(prod(next.scale, scale), next.apply(offset));
+  }
+
+  /** Get the inverse transform. */
+  GridTransform inverse() const
+  {
+    Vec2 s(1 / scale.x(), 1 / scale.y());
+    return GridTransform(s, -prod(s, offset));
+  }
+
+}; // struct GridTransform
+
+/**
+ * A dense per-pixel displacement field. Displacements live in a warp coordinate frame, which the field's grid transform maps
+ * its pixels into: the output pixel at (row, col) is at gridLocation(row, col) in the warp frame, and is sampled from the
+ * source image at gridLocation(row, col) + displacement(row, col), mapped to source pixel coordinates through the field's
+ * source transform. The transforms let the output, the warp frame and the source image all have different dimensions. Both
+ * are the identity by default. Displacements are stored as single-precision (dx, dy) pairs, which halves the memory of keeping
+ * several fields alive at once. They are computed in double precision and only rounded when stored, but that rounding shifts
+ * sample positions by up to about 1e-4 pixels on large images, so output is not bit-identical to a double-precision field:
+ * pixels near a rounding boundary may differ by a level or two. A field may also cover just a window of a larger grid, e.g.
+ * one tile of an output rendered tile by tile: its pixels are then those of the larger grid from an origin on (see
+ * setOrigin()), so their grid locations are exactly those of the same pixels of a field covering the whole grid.
+ */
+class WarpField
+{
+  private:
+    int w, h;
+    std::vector<float> buf;  ///< Interleaved (dx, dy) pairs, row-major
+    GridTransform grid;      ///< Map from field pixel coordinates to warp coordinates
+    GridTransform xform;     ///< Map from warp coordinates to source pixel coordinates
+    int col0, row0;          ///< Pixel of the grid at the first pixel of the field
+
+  public:
+    /** Default constructor. */
+    WarpField() : w(0), h(0), col0(0), row0(0) {}
+
+    /** Create a zero displacement field of the specified dimensions. */
+    WarpField(int w_, int h_) : w(w_), h(h_), buf((size_t)w_ * h_ * 2, 0.0f), col0(0), row0(0) {}
+
+    /** Get the width of the field. */
+    int width() const { return w; }
+
+    /** Get the height of the field. */
+    int height() const { return h; }
+
+    /** Check if this field has dimensions identical to another field. */
+    bool hasSameDimsAs(WarpField const & other) const { return w == other.w && h == other.h; }
+
+    /** Get a pointer to the interleaved (dx, dy) data. */
+    float const * data() const { return buf.empty() ? NULL : &buf[0]; }
+
+    /** Get a pointer to the interleaved (dx, dy) data. */
+    float * data() { return buf.empty() ? NULL : &buf[0]; }
+
+    /** Get the displacement at a pixel. */
+    Vec2 displacement(int row, int col) const
+    {
+      float const * d = &buf[((size_t)row * w + col) * 2];
+      return Vec2(d[0], d[1]);
+    }
+
+    /** Set the displacement at a pixel. */
+    void setDisplacement(int row, int col, Vec2 const & d)
+    {
+      float * dst = &buf[((size_t)row * w + col) * 2];
+      dst[0] = (float)d.x();
+      dst[1] = (float)d.y();
+    }
+
+    /** Get the map from field pixel coordinates to warp coordinates. */
+    GridTransform const & gridTransform() const { return grid; }
+
+    /** Set the map from field pixel coordinates to warp coordinates. */
+    void setGridTransform(GridTransform const & grid_) { grid = grid_; }
+
+    /** Get the map from warp coordinates to source pixel coordinates. */
+    GridTransform const & sourceTransform() const { return xform; }
+
+    /** Set the map from warp coordinates to source pixel coordinates. */
+    void setSourceTransform(GridTransform const & xform_) { xform = xform_; }
+
+    /** Get the column of the grid at the first column of the field. */
+    int originCol() const { return col0; }
+
+    /** Get the row of the grid at the first row of the field. */
+    int originRow() const { return row0; }
+
+    /**
+     * Make the field a window of a larger grid, whose pixel (row0 + row, col0 + col) is the field's pixel (row, col). The grid
+     * transform still maps pixels of the larger grid. The origin is (0, 0) by default.
+     */
+    void setOrigin(int col0_, int row0_) { col0 = col0_; row0 = row0_; }
+
+    /** Get the location of a pixel in warp coordinates. */
+    Vec2 gridLocation(int row, int col) const { return grid.apply(Vec2(col + col0, row + row0)); }
+
+    /** Get the location in the source image sampled by a pixel. */
+    Vec2 sourceLocation(int row, int col) const { return xform.apply(gridLocation(row, col) + displacement(row, col)); }
+
+    /**
+     * Estimate the derivatives \a dx and \a dy of the source location with respect to the column and row of the output pixel
+     * by finite differences, i.e. the footprint of an output pixel in the source image.
+     */
+    void jacobian(int row, int col, Vec2 & dx, Vec2 & dy) const
+    {
+      int c0 = std::max(col - 1, 0), c1 = std::min(col + 1, w - 1);
+      int r0 = std::max(row - 1, 0), r1 = std::min(row + 1, h - 1);
+      dx = (c1 > c0 ? (sourceLocation(row, c1) - sourceLocation(row, c0)) / (c1 - c0) : Vec2(1, 0));
+      dy = (r1 > r0 ? (sourceLocation(r1, col) - sourceLocation(r0, col)) / (r1 - r0) : Vec2(0, 1));
+    }
+
+    /**
+     * Set the displacements in the rectangle [col0, col1) x [row0, row1) by linearly interpolating between the displacements
+     * of two other fields of the same dimensions.
+     */
+    void setLerp(WarpField const & f0, WarpField const & f1, double t, int col0, int row0, int col1, int row1)
+    {
+      assert(hasSameDimsAs(f0) && hasSameDimsAs(f1));
+
+      float s = (float)(1 - t), u = (float)t;
+      for (int row = row0; row < row1; ++row)
+      {
+        size_t begin = ((size_t)row * w + col0) * 2, end = ((size_t)row * w + col1) * 2;
+        for (size_t i = begin; i < end; ++i)
+          buf[i] = s * f0.buf[i] + u * f1.buf[i];
+      }
+    }
+
+    /** Get a new field by linearly interpolating between the displacements of this field and another one. */
+    WarpField lerp(WarpField const & target, double t) const
+    {
+      WarpField result(w, h);
+      result.setGridTransform(grid);
+      result.setSourceTransform(xform);
+      result.setOrigin(col0, row0);
+      result.setLerp(*this, target, t, 0, 0, w, h);
+      return result;
+    }
+
+    /**
+     * Get the largest per-pixel distance, in the rectangle [col0, col1) x [row0, row1), between the displacements of this field
+     * and those obtained by linearly interpolating between two other fields of the same dimensions.
+     */
+    double maxLerpDifference(WarpField const & f0, WarpField const & f1, double t, int col0, int row0, int col1, int row1)
+    const
+    {
+      assert(hasSameDimsAs(f0) && hasSameDimsAs(f1));
+
+      float s = (float)(1 - t), u = (float)t;
+      float max_d2 = 0;
+      for (int row = row0; row < row1; ++row)
+      {
+        size_t begin = ((size_t)row * w + col0) * 2, end = ((size_t)row * w + col1) * 2;
+        for (size_t i = begin; i < end; i += 2)
+        {
+          float dx = buf[i] - (s * f0.buf[i] + u * f1.buf[i]);
+          float dy = buf[i + 1] - (s * f0.buf[i + 1] + u * f1.buf[i + 1]);
+          max_d2 = std::max(max_d2, dx * dx + dy * dy);
+        }
+      }
+
+      return std::sqrt((double)max_d2);
+    }
+
+}; // class WarpField
+
+#endif // __WarpField_hpp__
@@ -0,0 +1,250 @@
+#ifndef __WarpKernel_hpp__
+#define __WarpKernel_hpp__
+
+#include "Algebra3.hpp"
+#include "LineSegment.hpp"
+#include "WeightTable.hpp"
+#include <cmath>
+#include <cstdlib>
+
+class RigKernel;
+
+/** Ways of computing the warp between two sets of segments. */
+enum WarpEngine
+{
+  ENGINE_FIELD,  ///< The field warp of Feature-Based Image Metamorphosis, weighting every segment at every pixel
+  ENGINE_MESH    ///< A piecewise-affine warp over a triangulation of the segment endpoints (see MeshWarp)
+};
+
+/** Parameters of the field warp described in Feature-Based Image Metamorphosis. */
+struct WarpParams
+{
+  double a;      ///< Smoothness of the warp: larger values weaken the pull of segments on nearby points
+  double b;      ///< How quickly the influence of a segment falls off with distance
+  double p;      ///< How much the influence of a segment grows with its length
+
+  /**
+   * Barnes-Hut opening criterion: a group of segments whose bounding radius is less than theta times its distance from a
+   * point contributes to it as a single aggregate. Zero evaluates every segment exactly.
+   */
+  double theta;
+
+  /**
+   * Blocks of pixels whose displacement is provably below this many pixels are left undisplaced without evaluating any
+   * segment, and are then copied rather than resampled where possible. Zero evaluates every pixel.
+   */
+  double identity_tolerance;
+
+  /**
+   * If not null, the distance falloff of the weights is looked up in this table, built for the same a and b, instead of being
+   * computed exactly. Not owned.
+   */
+  WeightTable const * weight_table;
+
+  /** How to compute the warp. The mesh engine ignores all the parameters above. */
+  WarpEngine engine;
+
+  /**
+   * If not null, a kernel generated for the segment layout and the parameters a, b and p, which evaluates the segments
+   * exactly in place of the generic loop wherever the segments have its layout. Not owned.
+   */
+  RigKernel const * kernel;
+
+  /** Construct from the warp parameters, evaluating every segment at every pixel exactly by default. */
+  WarpParams(double a_ = 0.5, double b_ = 1, double p_ = 0.2, double theta_ = 0, double identity_tolerance_ = 0)
+  : a(a_), b(b_), p(p_), theta(theta_), identity_tolerance(identity_tolerance_), weight_table(NULL), engine(ENGINE_FIELD),
+    kernel(NULL) {}
+
+}; // struct WarpParams
+
+/**
+ * The terms of the displacement due to one segment pair that do not depend on the point, evaluated once so that the per-point
+ * kernel below is left with the arithmetic that does. Every term is computed exactly as the LineSegment methods compute it, so
+ * the displacements are identical to evaluating the segments directly.
+ */
+struct SegmentPairTerms
+{
+  Vec2 start;          ///< Start point of the segment in the image being distorted
+  Vec2 dir;            ///< Direction (end - start) of that segment
+  Vec2 unit_perp;      ///< Unit perpendicular of that segment
+  double len_p;        ///< Length of that segment raised to the power p
+  double len_pb;       ///< len_p raised to the power b, for weights with a tabulated falloff
+
+  Vec2 end_start;      ///< Start point of the corresponding segment at the current time
+  Vec2 end_dir;        ///< Direction of that segment
+  Vec2 end_perp;       ///< Perpendicular of that segment, of the same length
+  double end_len2;     ///< Squared length of that segment
+  double end_len;      ///< Length of that segment
+
+  /** Default constructor. */
+  SegmentPairTerms() {}
+
+  /** Evaluate the terms of the pair (\a start_ln, \a end_ln), which must not be points, for the warp parameters \a params. */
+  SegmentPairTerms(LineSegment const & start_ln, LineSegment const & end_ln, WarpParams const & params)
+  : start(start_ln.start()), dir(start_ln.direction()), unit_perp(start_ln.perp() / start_ln.length()),
+    len_p(std::pow(start_ln.length(), params.p)), len_pb(params.weight_table ? std::pow(len_p, params.b) : 0),
+    end_start(end_ln.start()), end_dir(end_ln.direction()), end_perp(end_ln.perp()), end_len2(end_ln.length2()),
+    end_len(end_ln.length())
+  {}
+
+}; // struct SegmentPairTerms
+
+/**
+ * Add the displacement of the point \a curr due to one segment pair, with precomputed terms, weighted by the segment's
+ * influence on the point, to \a dissum, and the weight to \a wtsum.
+ */
+inline void
+accumulateSegmentPair(SegmentPairTerms const & pair, Vec2 const & curr, WarpParams const & params, Vec2 & dissum,
+                      double & wtsum)
+{
+  Vec2 rel = curr - pair.end_start;
+  double u = (pair.end_dir * rel) / pair.end_len2;
+  double v = (rel * pair.end_perp) / pair.end_len;
+
+  // point interpolated wrt to the src line
+  Vec2 interpolated = pair.start + u * pair.dir + v * pair.unit_perp;
+
+  // displacement vector from the line
+  Vec2 dis = (interpolated - curr);
+  // weight of this displacement, with the distance as in LineSegment::segmentDistance()
+  double dist = (u < 0 || u > 1) ? (curr - pair.start).length() : std::abs((int)v);
+  double wt = (params.weight_table ? pair.len_pb * params.weight_table->falloff(dist)
+                                   : std::pow(pair.len_p / (params.a + dist), params.b));
+  dissum += dis * wt;
+  wtsum += wt;
+}
+
+/**
+ * The terms of the displacement due to a pair of point features (see LineSegment::isPoint()). A point pair translates the
+ * points around it by the offset between its two locations, with a weight falling off with the distance from its location at
+ * the current time as that of a segment of unit length does, i.e. (1 / (a + dist))^b. Evaluating it takes a distance and a
+ * weight, without any projection onto a line.
+ */
+struct PointPairTerms
+{
+  Vec2 at;      ///< Location of the point at the current time
+  Vec2 offset;  ///< Location of the point in the image being distorted, relative to \a at
+
+  /** Default constructor. */
+  PointPairTerms() {}
+
+  /** Evaluate the terms of the point pair (\a start_pt, \a end_pt). */
+  PointPairTerms(LineSegment const & start_pt, LineSegment const & end_pt)
+  : at(end_pt.start()), offset(start_pt.start() - end_pt.start())
+  {}
+
+}; // struct PointPairTerms
+
+/**
+ * Add the displacement of the point \a curr due to one point pair, weighted by its influence on the point, to \a dissum, and
+ * the weight to \a wtsum.
+ */
+inline void
+accumulatePointPair(PointPairTerms const & pair, Vec2 const & curr, WarpParams const & params, Vec2 & dissum, double & wtsum)
+{
+  double dist = (curr - pair.at).length();
+  double wt = (params.weight_table ? params.weight_table->falloff(dist) : std::pow(1 / (params.a + dist), params.b));
+  dissum += pair.offset * wt;
+  wtsum += wt;
+}
+
+/**
+ * Add the displacement of the point \a curr due to one segment pair, weighted by the segment's influence on the point, to
+ * \a dissum, and the weight to \a wtsum. \a start_ln is the segment in the image being distorted and \a end_ln the
+ * corresponding segment at the current time. Point pairs are evaluated as such.
+ */
+inline void
+accumulateSegmentPair(LineSegment const & start_ln, LineSegment const & end_ln, Vec2 const & curr, WarpParams const & params,
+                      Vec2 & dissum, double & wtsum)
+{
+  if (start_ln.isPoint())
+    accumulatePointPair(PointPairTerms(start_ln, end_ln), curr, params, dissum, wtsum);
+  else
+    accumulateSegmentPair(SegmentPairTerms(start_ln, end_ln, params), curr, params, dissum, wtsum);
+}
+
+/**
+ * Add the displacements of a packet of points due to one segment pair, with precomputed terms, to \a dissum, and the weights
+ * to \a wtsum, as accumulateSegmentPair() does for one point. With double lanes, the results are identical to evaluating each
+ * point alone.
+ */
+template <typename L>
+inline void
+accumulateSegmentPair(SegmentPairTerms const & pair, Vec2P<L> const & curr, WarpParams const & params, Vec2P<L> & dissum,
+                      L & wtsum)
+{
+  typedef typename L::Scalar Scalar;
+
+  Vec2P<L> rel = curr - pair.end_start;
+  L u = (pair.end_dir * rel) / pair.end_len2;
+  L v = (rel * pair.end_perp) / pair.end_len;
+
+  Vec2P<L> interpolated = pair.start + u * pair.dir + v * pair.unit_perp;
+
+  Vec2P<L> dis = (interpolated - curr);
+  L dist = select((u < Scalar(0)) | (u > Scalar(1)), (curr - pair.start).length(), truncInt(fabs(v)));
+  L wt;
+  if (params.weight_table)
+  {
+    for (int i = 0; i < L::WIDTH; ++i)
+      wt.set(i, (Scalar)(pair.len_pb * params.weight_table->falloff(dist[i])));
+  }
+  else
+  {
+    wt = (Scalar)pair.len_p / ((Scalar)params.a + dist);
+    if (params.b != 1)  // else pow() is exact
+    {
+      for (int i = 0; i < L::WIDTH; ++i)
+        wt.set(i, (Scalar)std::pow(wt[i], params.b));
+    }
+  }
+
+  dissum += dis * wt;
+  wtsum += wt;
+}
+
+/**
+ * Add the displacements of a packet of points due to one point pair to \a dissum, and the weights to \a wtsum, as
+ * accumulatePointPair() does for one point.
+ */
+template <typename L>
+inline void
+accumulatePointPair(PointPairTerms const & pair, Vec2P<L> const & curr, WarpParams const & params, Vec2P<L> & dissum,
+                    L & wtsum)
+{
+  typedef typename L::Scalar Scalar;
+
+  L dist = (curr - pair.at).length();
+  L wt;
+  if (params.weight_table)
+  {
+    for (int i = 0; i < L::WIDTH; ++i)
+      wt.set(i, (Scalar)params.weight_table->falloff(dist[i]));
+  }
+  else
+  {
+    wt = Scalar(1) / ((Scalar)params.a + dist);
+    if (params.b != 1)
+    {
+      for (int i = 0; i < L::WIDTH; ++i)
+        wt.set(i, (Scalar)std::pow(wt[i], params.b));
+    }
+  }
+
+  dissum += pair.offset * wt;
+  wtsum += wt;
+}
+
+/** Add the displacements of a packet of points due to one segment or point pair to \a dissum, and the weights to \a wtsum. */
+template <typename L>
+inline void
+accumulateSegmentPair(LineSegment const & start_ln, LineSegment const & end_ln, Vec2P<L> const & curr,
+                      WarpParams const & params, Vec2P<L> & dissum, L & wtsum)
+{
+  if (start_ln.isPoint())
+    accumulatePointPair(PointPairTerms(start_ln, end_ln), curr, params, dissum, wtsum);
+  else
+    accumulateSegmentPair(SegmentPairTerms(start_ln, end_ln, params), curr, params, dissum, wtsum);
+}
+
+#endif // __WarpKernel_hpp__
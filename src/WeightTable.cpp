@@ -0,0 +1,43 @@
+#include "WeightTable.hpp"
+#include <algorithm>
+
+double const WeightTable::MIN_SUM = 1.0 / 1024;
+double const WeightTable::MAX_SUM = 1 << 24;
+
+WeightTable::WeightTable(double a_, double b_)
+: a(a_), b(b_)
+{
+  first_key = bits(std::max(a, MIN_SUM)) >> FRAC_BITS;
+  last_key = bits(MAX_SUM) >> FRAC_BITS;
+
+  // The value at the start of each bin, where the interpolated bits are zero
+  values.resize(last_key - first_key + 1);
+  for (uint32_t key = first_key; key <= last_key; ++key)
+  {
+    uint32_t u = key << FRAC_BITS;
+    float x;
+    std::memcpy(&x, &u, sizeof(x));
+    values[key - first_key] = (float)std::pow((double)x, -b);
+  }
+
+  // Compare with the exact falloff at several points across each bin
+  int const samples_per_bin = 16;
+  max_rel_error = 0;
+  for (uint32_t key = first_key; key < last_key; ++key)
+  {
+    uint32_t u0 = key << FRAC_BITS, u1 = (key + 1) << FRAC_BITS;
+    float x0, x1;
+    std::memcpy(&x0, &u0, sizeof(x0));
+    std::memcpy(&x1, &u1, sizeof(x1));
+
+    for (int i = 0; i < samples_per_bin; ++i)
+    {
+      double x = x0 + (x1 - x0) * (i + 0.5) / samples_per_bin;
+      if (x < a)
+        continue;
+
+      double exact = std::pow(x, -b);
+      max_rel_error = std::max(max_rel_error, std::fabs(falloff(x - a) - exact) / exact);
+    }
+  }
+}
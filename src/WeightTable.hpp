@@ -0,0 +1,69 @@
+#ifndef __WeightTable_hpp__
+#define __WeightTable_hpp__
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * A lookup table for the distance falloff (a + d)^-b of the field warp. The weight of a segment, (len^p / (a + d))^b, is the
+ * product of a per-segment constant len^(p b) and this falloff, which is the same for every segment, so a table built once per
+ * render replaces the two pow() calls per segment and point with a lookup and a multiply.
+ *
+ * The table is indexed by the leading bits of the single-precision representation of a + d, i.e. its exponent and the top
+ * BIN_BITS bits of its mantissa, so bins are spaced logarithmically: short distances, where the falloff is steepest, get
+ * narrow bins, and the bins widen in proportion with distance, keeping the relative error of linear interpolation within a bin
+ * uniform over the whole range. Values of a + d outside the table (below a, or MIN_SUM if a is smaller, or beyond MAX_SUM) are
+ * evaluated exactly.
+ */
+class WeightTable
+{
+  private:
+    static int const BIN_BITS = 7;                       ///< Mantissa bits selecting a bin, i.e. 128 bins per octave
+    static int const FRAC_BITS = 23 - BIN_BITS;          ///< Mantissa bits interpolated within a bin
+    static uint32_t const FRAC_MASK = (1u << FRAC_BITS) - 1;
+
+    double a, b;
+    uint32_t first_key, last_key;  ///< Range of bin keys covered
+    std::vector<float> values;     ///< Falloff at the start of each bin, and at the end of the last
+    double max_rel_error;
+
+    /** Get the bit pattern of the single-precision representation of \a x: the bin key and the bits to interpolate. */
+    static uint32_t bits(double x)
+    {
+      float f = (float)x;
+      uint32_t u;
+      std::memcpy(&u, &f, sizeof(u));
+      return u;
+    }
+
+  public:
+    /** Smallest and largest values of a + d covered by the table. */
+    static double const MIN_SUM, MAX_SUM;
+
+    /** Tabulate the falloff (a_ + d)^-b_, and measure the largest relative error of the lookup. */
+    WeightTable(double a_, double b_);
+
+    /** Get the number of entries in the table. */
+    long size() const { return (long)values.size(); }
+
+    /** Get the largest relative error of falloff() over the tabulated range, measured at construction. */
+    double maxRelativeError() const { return max_rel_error; }
+
+    /** Get (a + dist)^-b. */
+    double falloff(double dist) const
+    {
+      uint32_t u = bits(a + dist);
+      uint32_t key = u >> FRAC_BITS;
+      if (key < first_key || key >= last_key)  // includes negative and non-finite values
+        return std::pow(a + dist, -b);
+
+      float const * v = &values[key - first_key];
+      float frac = (float)(u & FRAC_MASK) * (1.0f / (float)(1u << FRAC_BITS));
+      return v[0] + frac * (v[1] - v[0]);
+    }
+
+}; // class WeightTable
+
+#endif // __WeightTable_hpp__
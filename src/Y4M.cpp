@@ -0,0 +1,269 @@
+#include "Y4M.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+/** Longest header line accepted, which is far more than any real stream needs. */
+static size_t const MAX_HEADER_LENGTH = 4096;
+
+bool
+Y4MReader::readLine(std::string & line, size_t max_len)
+{
+  line.clear();
+  int c;
+  while ((c = std::fgetc(file)) != EOF && c != '\n')
+  {
+    if (line.size() >= max_len)
+      return false;
+
+    line.push_back((char)c);
+  }
+
+  return c == '\n';
+}
+
+bool
+Y4MReader::open(std::string const & path)
+{
+  close();
+
+  if (path == "-")
+    file = stdin;
+  else
+  {
+    file = std::fopen(path.c_str(), "rb");
+    owns_file = true;
+  }
+
+  if (!file)
+  {
+    std::cerr << "Could not open video " << path << std::endl;
+    return false;
+  }
+
+  std::string header;
+  if (!readLine(header, MAX_HEADER_LENGTH) || header.compare(0, 10, "YUV4MPEG2 ") != 0)
+  {
+    std::cerr << path << " is not a YUV4MPEG2 stream" << std::endl;
+    close();
+    return false;
+  }
+
+  fmt = Y4MFormat();
+  fmt.chroma_tag = "420jpeg";  // the default when the header does not say
+  std::istringstream tokens(header.substr(10));
+  std::string token;
+  while (tokens >> token)
+  {
+    std::string value = token.substr(1);
+    switch (token[0])
+    {
+      case 'W': fmt.w = std::atoi(value.c_str()); break;
+      case 'H': fmt.h = std::atoi(value.c_str()); break;
+      case 'F': fmt.rate = value; break;
+      case 'I': fmt.interlace = value; break;
+      case 'A': fmt.aspect = value; break;
+      case 'C': fmt.chroma_tag = value; break;
+      default: break;  // X (comment) and unknown parameters
+    }
+  }
+
+  std::string const & c = fmt.chroma_tag;
+  if (c == "420jpeg" || c == "420paldv" || c == "420mpeg2" || c == "420")
+    fmt.chroma = Y4M_420;
+  else if (c == "422")
+    fmt.chroma = Y4M_422;
+  else if (c == "444")
+    fmt.chroma = Y4M_444;
+  else if (c == "mono")
+    fmt.chroma = Y4M_MONO;
+  else
+  {
+    std::cerr << "Unsupported chroma format " << c << " in " << path << ": only 8-bit 420, 422, 444 and mono are supported"
+              << std::endl;
+    close();
+    return false;
+  }
+
+  if (fmt.w <= 0 || fmt.h <= 0)
+  {
+    std::cerr << "Invalid frame size " << fmt.w << 'x' << fmt.h << " in " << path << std::endl;
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void
+Y4MReader::close()
+{
+  if (file && owns_file)
+    std::fclose(file);
+
+  file = NULL;
+  owns_file = false;
+}
+
+long
+Y4MReader::countFrames()
+{
+  long start = std::ftell(file);
+  if (start < 0 || std::fseek(file, 0, SEEK_END) != 0)
+    return -1;
+
+  long end = std::ftell(file);
+  if (end < 0 || std::fseek(file, start, SEEK_SET) != 0)
+    return -1;
+
+  // Seeking past the end of the file succeeds, so check that each frame is complete against its length
+  long num_frames = 0;
+  std::string line;
+  while (readLine(line, MAX_HEADER_LENGTH) && line.compare(0, 5, "FRAME") == 0)
+  {
+    long next = std::ftell(file) + (long)fmt.frameSize();
+    if (next > end || std::fseek(file, next, SEEK_SET) != 0)
+      break;
+
+    ++num_frames;
+  }
+
+  std::clearerr(file);
+  if (std::fseek(file, start, SEEK_SET) != 0)
+    return -1;
+
+  return num_frames;
+}
+
+bool
+Y4MReader::readFrame(Image & yuv)
+{
+  std::string line;
+  if (!file || !readLine(line, MAX_HEADER_LENGTH) || line.compare(0, 5, "FRAME") != 0)
+    return false;
+
+  planes.resize(fmt.frameSize());
+  if (std::fread(&planes[0], 1, planes.size(), file) != planes.size())
+    return false;
+
+  int w = fmt.w, h = fmt.h, nc = fmt.numChannels();
+  if (!yuv.resize(w, h, nc))
+    return false;
+
+  unsigned char const * luma = &planes[0];
+  if (nc == 1)
+  {
+    std::memcpy(yuv.data(), luma, (size_t)w * h);
+    return true;
+  }
+
+  // Replicate chroma samples over the pixels they cover
+  int cw = fmt.chromaWidth(), ch = fmt.chromaHeight();
+  int sx = (cw < w ? 2 : 1), sy = (ch < h ? 2 : 1);
+  unsigned char const * u = luma + (size_t)w * h;
+  unsigned char const * v = u + (size_t)cw * ch;
+  for (int row = 0; row < h; ++row)
+  {
+    unsigned char * pix = yuv.scanline(row);
+    unsigned char const * y_row = luma + (size_t)row * w;
+    unsigned char const * u_row = u + (size_t)(row / sy) * cw;
+    unsigned char const * v_row = v + (size_t)(row / sy) * cw;
+    for (int col = 0; col < w; ++col, pix += 3)
+    {
+      pix[0] = y_row[col];
+      pix[1] = u_row[col / sx];
+      pix[2] = v_row[col / sx];
+    }
+  }
+
+  return true;
+}
+
+bool
+Y4MWriter::open(std::string const & path, Y4MFormat const & fmt_)
+{
+  close();
+
+  fmt = fmt_;
+  if (path == "-")
+    file = stdout;
+  else
+  {
+    file = std::fopen(path.c_str(), "wb");
+    owns_file = true;
+  }
+
+  if (!file)
+  {
+    std::cerr << "Could not open " << path << " for writing" << std::endl;
+    return false;
+  }
+
+  std::ostringstream header;
+  header << "YUV4MPEG2 W" << fmt.w << " H" << fmt.h << " F" << fmt.rate << " I" << fmt.interlace << " A" << fmt.aspect
+         << " C" << fmt.chroma_tag << '\n';
+  std::string h = header.str();
+
+  return std::fwrite(h.data(), 1, h.size(), file) == h.size();
+}
+
+bool
+Y4MWriter::close()
+{
+  bool ok = true;
+  if (file)
+  {
+    ok = (std::fflush(file) == 0 && !std::ferror(file));
+    if (owns_file)
+      ok = (std::fclose(file) == 0) && ok;
+  }
+
+  file = NULL;
+  owns_file = false;
+  return ok;
+}
+
+bool
+Y4MWriter::writeFrame(Image const & yuv)
+{
+  int w = fmt.w, h = fmt.h, nc = fmt.numChannels();
+  if (!file || yuv.width() != w || yuv.height() != h || yuv.numChannels() != nc)
+    return false;
+
+  planes.resize(fmt.frameSize());
+  unsigned char * luma = &planes[0];
+  for (int row = 0; row < h; ++row)
+  {
+    unsigned char const * pix = yuv.scanline(row);
+    for (int col = 0; col < w; ++col, pix += nc)
+      luma[(size_t)row * w + col] = pix[0];
+  }
+
+  if (nc == 3)
+  {
+    // Average each chroma sample over the pixels it covers
+    int cw = fmt.chromaWidth(), ch = fmt.chromaHeight();
+    int sx = (cw < w ? 2 : 1), sy = (ch < h ? 2 : 1);
+    unsigned char * u = luma + (size_t)w * h;
+    unsigned char * v = u + (size_t)cw * ch;
+    for (int crow = 0; crow < ch; ++crow)
+      for (int ccol = 0; ccol < cw; ++ccol)
+      {
+        int su = 0, sv = 0, n = 0;
+        for (int row = crow * sy; row < std::min((crow + 1) * sy, h); ++row)
+          for (int col = ccol * sx; col < std::min((ccol + 1) * sx, w); ++col, ++n)
+          {
+            unsigned char const * pix = yuv.pixel(row, col);
+            su += pix[1];
+            sv += pix[2];
+          }
+
+        u[(size_t)crow * cw + ccol] = (unsigned char)((su + n / 2) / n);
+        v[(size_t)crow * cw + ccol] = (unsigned char)((sv + n / 2) / n);
+      }
+  }
+
+  return std::fwrite("FRAME\n", 1, 6, file) == 6 && std::fwrite(&planes[0], 1, planes.size(), file) == planes.size();
+}
@@ -0,0 +1,126 @@
+#ifndef __Y4M_hpp__
+#define __Y4M_hpp__
+
+#include "Image.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/** Chroma subsampling of a YUV4MPEG2 stream, of which 8-bit 4:2:0, 4:2:2, 4:4:4 and luma-only streams are supported. */
+enum Y4MChroma
+{
+  Y4M_MONO,
+  Y4M_420,
+  Y4M_422,
+  Y4M_444
+};
+
+/** Format of a YUV4MPEG2 stream, as given by its header. */
+struct Y4MFormat
+{
+  int w, h;
+  Y4MChroma chroma;
+  std::string chroma_tag;  ///< The C parameter of the header, e.g. "420jpeg", which also encodes chroma siting
+  std::string rate;        ///< The F parameter of the header, e.g. "25:1"
+  std::string interlace;   ///< The I parameter of the header
+  std::string aspect;      ///< The A parameter of the header
+
+  /** Default constructor: 4:2:0 at 25 fps with square pixels. */
+  Y4MFormat() : w(0), h(0), chroma(Y4M_420), chroma_tag("420jpeg"), rate("25:1"), interlace("p"), aspect("1:1") {}
+
+  /** Get the width of a chroma plane. */
+  int chromaWidth() const { return (chroma == Y4M_420 || chroma == Y4M_422) ? (w + 1) / 2 : w; }
+
+  /** Get the height of a chroma plane. */
+  int chromaHeight() const { return chroma == Y4M_420 ? (h + 1) / 2 : h; }
+
+  /** Get the number of bytes of pixel data in a frame. */
+  size_t frameSize() const
+  {
+    return (size_t)w * h + (chroma == Y4M_MONO ? 0 : 2 * (size_t)chromaWidth() * chromaHeight());
+  }
+
+  /** Get the number of channels of the frames read from and written to streams of this format. */
+  int numChannels() const { return chroma == Y4M_MONO ? 1 : 3; }
+
+}; // struct Y4MFormat
+
+/**
+ * Reads frames from a YUV4MPEG2 stream, one at a time. Frames are returned as images whose channels are Y, U and V (or just
+ * Y for luma-only streams), with subsampled chroma replicated up to full resolution. Since the warp and the blend of a morph
+ * are linear, and YUV is an affine function of RGB, frames can be morphed in this form directly.
+ */
+class Y4MReader
+{
+  private:
+    std::FILE * file;
+    bool owns_file;
+    Y4MFormat fmt;
+    std::vector<unsigned char> planes;  ///< Raw pixel data of the last frame read
+
+    /** Read a line of at most \a max_len characters, without the line break. */
+    bool readLine(std::string & line, size_t max_len);
+
+  public:
+    /** Default constructor. */
+    Y4MReader() : file(NULL), owns_file(false) {}
+
+    /** Destructor. */
+    ~Y4MReader() { close(); }
+
+    /** Open a stream and read its header. A path of "-" reads standard input. */
+    bool open(std::string const & path);
+
+    /** Close the stream. */
+    void close();
+
+    /** Get the format of the stream. */
+    Y4MFormat const & format() const { return fmt; }
+
+    /**
+     * Count the frames remaining in the stream by skipping over their pixel data, and rewind to the current frame. Returns -1 if
+     * the stream cannot seek, e.g. if it is a pipe.
+     */
+    long countFrames();
+
+    /** Read the next frame into \a yuv. Returns false at the end of the stream or on error. */
+    bool readFrame(Image & yuv);
+
+  private:
+    Y4MReader(Y4MReader const &);
+    Y4MReader & operator=(Y4MReader const &);
+
+}; // class Y4MReader
+
+/** Writes frames to a YUV4MPEG2 stream, taking images laid out as those returned by Y4MReader. */
+class Y4MWriter
+{
+  private:
+    std::FILE * file;
+    bool owns_file;
+    Y4MFormat fmt;
+    std::vector<unsigned char> planes;  ///< Raw pixel data of the frame being written
+
+  public:
+    /** Default constructor. */
+    Y4MWriter() : file(NULL), owns_file(false) {}
+
+    /** Destructor. */
+    ~Y4MWriter() { close(); }
+
+    /** Create a stream of the given format and write its header. A path of "-" writes to standard output. */
+    bool open(std::string const & path, Y4MFormat const & fmt_);
+
+    /** Flush and close the stream. Returns false if any data could not be written. */
+    bool close();
+
+    /** Write a frame, averaging chroma down to the subsampling of the stream. */
+    bool writeFrame(Image const & yuv);
+
+  private:
+    Y4MWriter(Y4MWriter const &);
+    Y4MWriter & operator=(Y4MWriter const &);
+
+}; // class Y4MWriter
+
+#endif // __Y4M_hpp__
@@ -1,11 +1,28 @@
 #include "Algebra3.hpp"
+#include "DeepZoom.hpp"
 #include "Image.hpp"
 #include "LineSegment.hpp"
+#include "MeshWarp.hpp"
+#include "MipPyramid.hpp"
+#include "MorphMask.hpp"
+#include "Parallel.hpp"
+#include "RigKernel.hpp"
+#include "SegmentIO.hpp"
+#include "SegmentSimplifier.hpp"
+#include "SegmentTree.hpp"
+#include "SubframeWarp.hpp"
+#include "WarpField.hpp"
+#include "WarpKernel.hpp"
+#include "WeightTable.hpp"
+#include "Y4M.hpp"
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include <algorithm>
 using namespace std;
@@ -37,6 +54,47 @@ resulting distort works. Good luck!
 *****************************************************************************/
 
 
+/** The (up to) 4 pixels surrounding a real-valued image location, and their bilinear interpolation weights. */
+struct BilinearFootprint
+{
+  unsigned char const * pix[4];  ///< Top-left, top-right, bottom-left and bottom-right pixels
+  double wt[4];                  ///< Weights of the pixels, summing to 1
+};
+
+/**
+ * Get the bilinear footprint of location (x, y) in an image, with pixels centered at integer coordinates. Coordinates outside
+ * the image are clamped to its boundaries.
+ */
+BilinearFootprint
+bilinearFootprint(Image const & image, double x, double y)
+{
+  int w = image.width();
+  int h = image.height();
+
+  // clamp wayward coordinates to the feasible range
+  x = max(0.0, min(x, w - 1.0));
+  y = max(0.0, min(y, h - 1.0));
+
+  int col0 = (int)x;
+  int col1 = min(col0 + 1, w - 1);
+  int row0 = (int)y;
+  int row1 = min(row0 + 1, h - 1);
+  double fx = x - col0;
+  double fy = y - row0;
+
+  BilinearFootprint fp;
+  fp.pix[0] = image.pixel(row0, col0);
+  fp.pix[1] = image.pixel(row0, col1);
+  fp.pix[2] = image.pixel(row1, col0);
+  fp.pix[3] = image.pixel(row1, col1);
+  fp.wt[0] = (1 - fx) * (1 - fy);
+  fp.wt[1] = fx * (1 - fy);
+  fp.wt[2] = (1 - fx) * fy;
+  fp.wt[3] = fx * fy;
+
+  return fp;
+}
+
 /**
  * Use bilinear interpolation to get the color at an image position \a loc with real-valued coordinates, by interpolating from
  * the 4 surrounding pixels, and return the result in \a sampled_color. In the diagram below, P denotes image pixel positions
@@ -50,7 +108,7 @@ resulting distort works. Good luck!
  *   range.
  * - Make sure each output value is clamped to [0...255] to avoid overflow. Remember to clamp BEFORE type-casting to unsigned
  *   char.
- * - Remember that the image may not have 4 channels. In this case missing channels should be set to 0 in \a sampled_color.
+ * - The image may have any number of channels: exactly image.numChannels() values are written to \a sampled_color.
  *
  *
  *   P ------- P ------- P
@@ -64,316 +122,3403 @@ resulting distort works. Good luck!
  *   P ------- P ------- P
  */
 void
-sampleBilinear(Image const & image, Vec2 const & loc, unsigned char sampled_color[4])
-{  
-  int w = image.width();
-  int h = image.height();
-  int n = image.numChannels();
- 
-  // raw cordinates
-  int col0 = floor(loc.x());
-  int col1 = col0 + 1;
-  int row0 = floor(loc.y());
-  int row1 = row0 + 1;
-
-  // sanitized to get pixels form image
-  int pc0 = max(0, min(col0, w-1));
-  int pc1 = min(pc0 + 1, w-1);
-  int pr0 = max(0, min(row0, h-1));
-  int pr1 = min(pr0 + 1, h-1);
-  
-  // pixel values at the sanitized points
-  const unsigned char * pix00 = image.pixel(pr0, pc0);
-  const unsigned char * pix01 = image.pixel(pr0, pc1);
-  const unsigned char * pix10 = image.pixel(pr1, pc0);
-  const unsigned char * pix11 = image.pixel(pr1, pc1);
-  
+sampleBilinearChannels(Image const & image, Vec2 const & loc, unsigned char * sampled_color)
+{
+  BilinearFootprint fp = bilinearFootprint(image, loc.x(), loc.y());
+
   // https://en.wikipedia.org/wiki/Bilinear_interpolation
   double res;
-  for (int channel = 0; channel < n; ++channel)
+  for (int channel = 0; channel < image.numChannels(); ++channel)
   {
-    res = 0;
-
-    res += ((double)pix00[channel]) * (col1 - loc.x()) * (row1 - loc.y());
-    res += ((double)pix01[channel]) * (col1 - loc.x()) * (loc.y() - row0);
-    res += ((double)pix10[channel]) * (loc.x() - col0) * (row1 - loc.y());
-    res += ((double)pix11[channel]) * (loc.x() - col0) * (loc.y() - row0);
+    res = fp.wt[0] * fp.pix[0][channel] + fp.wt[1] * fp.pix[1][channel]
+        + fp.wt[2] * fp.pix[2][channel] + fp.wt[3] * fp.pix[3][channel];
 
     sampled_color[channel] = min(255, max(0, (int)floor(res)));
   }
+}
+
+/**
+ * Use bilinear interpolation to get the color at an image position \a loc with real-valued coordinates. Missing channels of
+ * images with fewer than 4 channels are set to 0 in \a sampled_color. See sampleBilinearChannels for details.
+ */
+void
+sampleBilinear(Image const & image, Vec2 const & loc, unsigned char sampled_color[4])
+{
+  sampleBilinearChannels(image, loc, sampled_color);
 
   // if numchannels < 4, others set 4 
-  for (int i = n; i < 4; ++i)
+  for (int i = image.numChannels(); i < 4; ++i)
     sampled_color[i] = 0;
 }
 
+/** How to filter a source image when resampling it through a warp. */
+enum SampleFilter
+{
+  FILTER_BILINEAR,   ///< Bilinear interpolation of the 4 nearest pixels, regardless of the local warp scale
+  FILTER_TRILINEAR,  ///< Bilinear interpolation on the two mip levels bracketing the local warp scale, blended linearly
+  FILTER_EWA         ///< Elliptical weighted average of the local warp footprint, on the mip level matching its minor axis
+};
+
+/** Add \a weight times the bilinearly interpolated channels of an image at location (x, y) to \a acc. */
+void
+accumulateBilinear(Image const & image, double x, double y, double weight, double * acc)
+{
+  BilinearFootprint fp = bilinearFootprint(image, x, y);
+  for (int channel = 0; channel < image.numChannels(); ++channel)
+    acc[channel] += weight * (fp.wt[0] * fp.pix[0][channel] + fp.wt[1] * fp.pix[1][channel]
+                            + fp.wt[2] * fp.pix[2][channel] + fp.wt[3] * fp.pix[3][channel]);
+}
+
+/** Map a coordinate on level 0 of a mip pyramid to the corresponding coordinate on level \a level. */
+inline double
+mipCoordinate(double x, int level)
+{
+  return std::ldexp(x + 0.5, -level) - 0.5;
+}
+
+/** Clamp accumulated channel values to [0...255] and store them in \a sampled_color. */
+void
+storeChannels(double const * acc, int n, unsigned char * sampled_color)
+{
+  for (int channel = 0; channel < n; ++channel)
+    sampled_color[channel] = min(255, max(0, (int)floor(acc[channel])));
+}
+
 /**
- * Distorts an image according to the algorithm described in Feature-Based Image Metamorphosis. Linearly interpolates the
- * segments from seg1_start to seg1_end.
+ * Sample a mip pyramid at level-0 location \a loc with trilinear filtering. \a dx and \a dy are the derivatives of the source
+ * location with respect to the output column and row: the level is chosen so that one output pixel spans about one texel.
+ * \a acc is scratch space for one value per channel.
  */
-Image
-distortImage(Image const & image,
-             std::vector<LineSegment> const & seg_start,
-             std::vector<LineSegment> const & seg_end,
-             double t,
-             double a, double b, double p)
+void
+sampleTrilinear(MipPyramid const & pyramid, Vec2 const & loc, Vec2 const & dx, Vec2 const & dy, double * acc,
+                unsigned char * sampled_color)
 {
-  assert(seg_start.size() == seg_end.size());
+  int n = pyramid.level(0).numChannels();
+  std::fill(acc, acc + n, 0.0);
 
-  std::cout << "Distorting image..." << std::endl;
+  double scale2 = max(dx.length2(), dy.length2());
+  double lod = (scale2 > 1 ? 0.5 * std::log2(scale2) : 0.0);
+  lod = min(lod, (double)(pyramid.numLevels() - 1));
 
-  int w = image.width();
-  int h = image.height();
-  int n = image.numChannels();
-  
-  Image result(w, h, n);
-  Vec2 interpolated, dis, dissum, curr;
-  LineSegment start_ln, end_ln;
+  int level0 = (int)lod;
+  double f = lod - level0;
 
-  unsigned char sample[4];
-  unsigned char* pix;
-  double u, v, wt, wtsum;
+  accumulateBilinear(pyramid.level(level0), mipCoordinate(loc.x(), level0), mipCoordinate(loc.y(), level0), 1 - f, acc);
+  if (f > 0)
+  {
+    int level1 = level0 + 1;
+    accumulateBilinear(pyramid.level(level1), mipCoordinate(loc.x(), level1), mipCoordinate(loc.y(), level1), f, acc);
+  }
 
-  for (int row = 0; row < h; ++row)
+  storeChannels(acc, n, sampled_color);
+}
+
+/**
+ * Sample a mip pyramid at level-0 location \a loc with an elliptical weighted average (Heckbert's EWA) filter. \a dx and
+ * \a dy are the derivatives of the source location with respect to the output column and row, which map the unit circle
+ * around the output pixel to an ellipse in the source. The ellipse is filtered with a Gaussian on the mip level where its
+ * minor axis spans about one texel, with its eccentricity limited to \a max_anisotropy to bound the cost. \a acc is scratch
+ * space for one value per channel.
+ */
+void
+sampleEWA(MipPyramid const & pyramid, Vec2 const & loc, Vec2 const & dx, Vec2 const & dy, double max_anisotropy,
+          double * acc, unsigned char * sampled_color)
+{
+  Image const & base = pyramid.level(0);
+  int n = base.numChannels();
+  std::fill(acc, acc + n, 0.0);
+
+  // Singular values of the Jacobian [dx dy] are the semi-axes of the footprint ellipse
+  double p = dx.length2(), q = dx * dy, r = dy.length2();
+  double mean = 0.5 * (p + r), dev = std::sqrt(0.25 * (p - r) * (p - r) + q * q);
+  double major = std::sqrt(mean + dev), minor = std::sqrt(max(mean - dev, 0.0));
+  minor = max(minor, major / max_anisotropy);
+
+  int level = (minor > 1 ? (int)std::log2(minor) : 0);
+  level = min(level, pyramid.numLevels() - 1);
+  if (major <= 1 || level == pyramid.numLevels() - 1)
   {
-    for (int col = 0; col < w; ++col)
-    {
-      wtsum = 0;
-      dissum = Vec2(0, 0);
-      curr = Vec2(col, row);
+    // Magnified, or the footprint covers the whole image: fall back to trilinear filtering
+    sampleTrilinear(pyramid, loc, dx, dy, acc, sampled_color);
+    return;
+  }
 
-      for (unsigned int i = 0; i < seg_start.size(); ++i)
-      { 
-        // src line
-        start_ln = seg_start[i];
-        // final line
-        end_ln = start_ln.lerp(seg_end[i], t);
-
-        u = end_ln.lineParameter(curr);
-        v = end_ln.signedLineDistance(curr);
-
-        // point interpolated wrt to the src line
-        interpolated = start_ln.start() + u * (start_ln.direction())
-                     + v * (start_ln.perp() / start_ln.length());
-
-        // displacement vector from the line
-        dis = (interpolated - curr);
-        // weight of this displacement
-        wt = pow(pow(start_ln.length(), p)/(a + start_ln.segmentDistance(curr, u, v)), b);
-        dissum += dis * wt;
-        wtsum += wt;
-      }
+  Image const & img = pyramid.level(level);
+  double s = std::ldexp(1.0, -level);
+  double ux = dx.x() * s, vx = dx.y() * s, uy = dy.x() * s, vy = dy.y() * s;
+  double cx = mipCoordinate(loc.x(), level), cy = mipCoordinate(loc.y(), level);
+
+  // Implicit ellipse A u^2 + B u v + C v^2 <= F, widened by one texel for reconstruction
+  double A = vx * vx + vy * vy + 1;
+  double B = -2 * (ux * vx + uy * vy);
+  double C = ux * ux + uy * uy + 1;
+  double F = A * C - 0.25 * B * B;
+  A /= F; B /= F; C /= F;
 
-      // weighted average
-      interpolated = curr + (dissum/wtsum);
-      sampleBilinear(image, interpolated, sample);
+  double det = 4 * A * C - B * B;
+  int u0 = (int)std::ceil(cx - 2 * std::sqrt(C / det)), u1 = (int)std::floor(cx + 2 * std::sqrt(C / det));
+  int v0 = (int)std::ceil(cy - 2 * std::sqrt(A / det)), v1 = (int)std::floor(cy + 2 * std::sqrt(A / det));
+
+  double wtsum = 0;
+  for (int v = v0; v <= v1; ++v)
+  {
+    unsigned char const * line = img.scanline(max(0, min(v, img.height() - 1)));
+    double dv = v - cy;
+    for (int u = u0; u <= u1; ++u)
+    {
+      double du = u - cx;
+      double d2 = A * du * du + B * du * dv + C * dv * dv;
+      if (d2 >= 1)
+        continue;
 
-      // fill in the interpolated color
-      pix = result.pixel(row, col);
+      double wt = std::exp(-2 * d2);
+      unsigned char const * pix = line + max(0, min(u, img.width() - 1)) * n;
       for (int channel = 0; channel < n; ++channel)
-        pix[channel] = sample[channel];
+        acc[channel] += wt * pix[channel];
+
+      wtsum += wt;
     }
   }
 
-  return result;
+  if (wtsum <= 0)
+  {
+    sampleTrilinear(pyramid, loc, dx, dy, acc, sampled_color);
+    return;
+  }
+
+  for (int channel = 0; channel < n; ++channel)
+    acc[channel] /= wtsum;
+
+  storeChannels(acc, n, sampled_color);
 }
 
-/* Linearly blends corresponding pixels of two images to produce the resulting image. */
-Image
-blendImages(Image const & img1, Image const & img2, double t)
+/**
+ * Get an upper bound on the length of the displacement induced by the segment pairs (seg_start[i], seg_end[i]) anywhere in
+ * the box [lo, hi] of warp coordinates. The displacement due to each pair is an affine function of the point, so its length
+ * peaks at a corner of the box, as do the line coordinates the pair's weight depends on. The weight of each pair is thus
+ * bounded above and below over the box, which bounds the weighted average of the displacements by
+ * sum(max weight * max length) / sum(min weight). Being a convex combination, it is also bounded by the largest length. Point
+ * pairs displace every point by the same offset, with a weight bounded by the nearest and farthest points of the box.
+ */
+double
+displacementBound(std::vector<LineSegment> const & seg_start, std::vector<LineSegment> const & seg_end, Vec2 const & lo,
+                  Vec2 const & hi, WarpParams const & params)
 {
-  assert(img1.hasSameDimsAs(img2));
+  Vec2 corners[4] = { lo, Vec2(hi.x(), lo.y()), Vec2(lo.x(), hi.y()), hi };
 
-  std::cout << "Blending images..." << std::endl;
+  // Get the points of the box nearest to and farthest from a point
+  auto nearestInBox = [&](Vec2 const & s) { return Vec2(max(lo.x(), min(s.x(), hi.x())), max(lo.y(), min(s.y(), hi.y()))); };
+  auto farthestInBox = [&](Vec2 const & s)
+  {
+    return Vec2(fabs(s.x() - lo.x()) > fabs(s.x() - hi.x()) ? lo.x() : hi.x(),
+                fabs(s.y() - lo.y()) > fabs(s.y() - hi.y()) ? lo.y() : hi.y());
+  };
 
-  int w = img1.width();
-  int h = img1.height();
-  int n = img1.numChannels();
-  unsigned char *res_pix;
-  const unsigned char *pix_1, *pix_2;
+  double max_len = 0, wt_len_sum = 0, min_wt_sum = 0;
+  for (size_t i = 0; i < seg_start.size(); ++i)
+  {
+    LineSegment const & start_ln = seg_start[i];
+    LineSegment const & end_ln = seg_end[i];
 
-  Image result(w, h, n);
+    if (start_ln.isPoint())
+    {
+      Vec2 at = end_ln.start();
+      double len = (start_ln.start() - at).length();
+      double wt_near = pow(1 / (params.a + (at - nearestInBox(at)).length()), params.b);
+      double wt_far = pow(1 / (params.a + (at - farthestInBox(at)).length()), params.b);
 
-  for (int row = 0; row < h; ++row)
-  {
-    for (int col = 0; col < w; ++col)
-    { 
-      res_pix = result.pixel(row, col);
-      pix_1 = img1.pixel(row, col);
-      pix_2 = img2.pixel(row, col);
+      max_len = max(max_len, len);
+      wt_len_sum += wt_near * len;
+      min_wt_sum += wt_far;
+      continue;
+    }
 
-      for (int channel = 0; channel < n; ++channel)
-      { 
-        // weighted average of the value of the pixel
-        double z = ((double)pix_1[channel] * t)
-                 + ((double)pix_2[channel] * (1-t));
-        res_pix[channel] = floor(z);
-      }
+    double len = 0, min_v = 0, max_v = 0;
+    for (int j = 0; j < 4; ++j)
+    {
+      double u = end_ln.lineParameter(corners[j]);
+      double v = end_ln.signedLineDistance(corners[j]);
+      Vec2 dis = start_ln.start() + u * start_ln.direction() + v * (start_ln.perp() / start_ln.length()) - corners[j];
+      len = max(len, dis.length());
+      min_v = (j == 0 ? v : min(min_v, v));
+      max_v = (j == 0 ? v : max(max_v, v));
     }
+
+    // The distance used for the weight is either |v|, truncated as in LineSegment::segmentDistance(), or the distance from
+    // the start of the segment, depending on where the point projects
+    double min_abs_v = (min_v <= 0 && max_v >= 0) ? 0 : min(fabs(min_v), fabs(max_v));
+    double max_abs_v = max(fabs(min_v), fabs(max_v));
+    Vec2 s = start_ln.start();
+    double min_dist = min(floor(min_abs_v), (s - nearestInBox(s)).length());
+    double max_dist = max(floor(max_abs_v), (s - farthestInBox(s)).length());
+
+    double len_p = pow(start_ln.length(), params.p);
+    double wt_near = pow(len_p / (params.a + min_dist), params.b);
+    double wt_far = pow(len_p / (params.a + max_dist), params.b);
+
+    max_len = max(max_len, len);
+    wt_len_sum += max(wt_near, wt_far) * len;
+    min_wt_sum += min(wt_near, wt_far);
   }
 
-  return result;
+  return min_wt_sum > 0 ? min(max_len, wt_len_sum / min_wt_sum) : max_len;
 }
 
-/* Morph img1 into img2. */
-Image
-morphImages(Image const & img1,
-            Image const & img2,
-            std::vector<LineSegment> const & seg1,
-            std::vector<LineSegment> const & seg2,
-            double t,
-            double a, double b, double p)
+/**
+ * Everything the warp of the algorithm described in Feature-Based Image Metamorphosis needs of the segment pairs at one time,
+ * independently of the pixels it is evaluated at: the interpolated segments, and depending on the parameters, the tree of
+ * segment groups, the terms a generated kernel reads, the per-pair terms of the generic loop, or the mesh of the mesh engine.
+ * It is prepared once and then shared, from any thread, by all the rectangles of a field computed piecewise, e.g. tile by
+ * tile.
+ */
+class PreparedWarp
 {
-  assert(img1.hasSameDimsAs(img2));
+  private:
+    PreparedWarp(PreparedWarp const &);              // not copyable
+    PreparedWarp & operator=(PreparedWarp const &);  // not copyable
+
+  public:
+    std::vector<LineSegment> seg_start;     ///< Segments in the image being distorted
+    std::vector<LineSegment> interpolated;  ///< Segments at the time of the warp, if the generic loop or the bound needs them
+    WarpParams params;
+    SegmentTree * tree;                     ///< Aggregated segment groups, with an opening criterion
+    RigKernel const * kernel;               ///< Kernel generated for the layout of the segments, if any
+    std::vector<double> kernel_terms;
+    std::vector<SegmentPairTerms> pairs;    ///< Terms of the segment pairs that do not depend on the pixel
+    std::vector<PointPairTerms> points;     ///< Terms of the point pairs
+    MeshWarp * mesh;                        ///< Mesh of the mesh engine
+
+    /**
+     * Prepare the warp from seg_start to seg_end at time \a t, given in warp coordinates. The mesh engine triangulates a box
+     * enclosing [lo, hi], the extent of the whole field in warp coordinates, so that the rectangles of a tiled field agree at
+     * their borders.
+     */
+    PreparedWarp(std::vector<LineSegment> const & seg_start_, std::vector<LineSegment> const & seg_end, double t,
+                 WarpParams const & params_, Vec2 const & lo, Vec2 const & hi)
+    : seg_start(seg_start_), params(params_), tree(NULL), kernel(NULL), mesh(NULL)
+    {
+      assert(seg_start.size() == seg_end.size());
 
-  // First distort img1 from 0 to t
-  // using seg1 as the initial segments and seg2 as the final ones.
-  Image distorted1 = distortImage(img1, seg1, seg2, t, a, b, p);
+      if (params.engine == ENGINE_MESH)
+      {
+        mesh = new MeshWarp(seg_start, seg_end, t, lo, hi);
+        return;
+      }
 
-  // Then distort img2 from 1 to (1 - t)
-  // using seg2 as the initial segments and seg1 as the final ones.
-  Image distorted2 = distortImage(img2, seg2, seg1, 1-t, a, b, p);
+      // With an opening criterion, distant groups of segments are aggregated
+      if (params.theta > 0)
+        tree = new SegmentTree(seg_start, seg_end, t, params);
 
-  // Now blend the results by linearly interpolating ("lerping")
-  Image blended = blendImages(distorted1, distorted2, 1-t);
+      if (!tree || params.identity_tolerance > 0)
+      {
+        interpolated.resize(seg_start.size());
+        for (size_t i = 0; i < seg_start.size(); ++i)
+          interpolated[i] = seg_start[i].lerp(seg_end[i], t);
+      }
 
-  // return Image();
-  return blended;
-}
+      // A kernel generated for this layout of segments replaces the generic loop
+      if (!tree && params.kernel && params.kernel->matches(seg_start))
+      {
+        kernel = params.kernel;
+        kernel->prepare(seg_start, interpolated, params, kernel_terms);
+      }
 
-///////////////////////////////////////////////////////////////////////////////
-//
-//  Driver functions follow. These should not be modified.
-//
-///////////////////////////////////////////////////////////////////////////////
+      // The terms of each pair that do not depend on the pixel are evaluated once, not once per pixel
+      if (!tree && !kernel)
+      {
+        pairs.reserve(seg_start.size());
+        for (size_t i = 0; i < seg_start.size(); ++i)
+        {
+          if (seg_start[i].isPoint())
+            points.push_back(PointPairTerms(seg_start[i], interpolated[i]));
+          else
+            pairs.push_back(SegmentPairTerms(seg_start[i], interpolated[i], params));
+        }
+      }
+    }
+
+    /** Destructor. */
+    ~PreparedWarp()
+    {
+      delete tree;
+      delete mesh;
+    }
+
+}; // class PreparedWarp
 
 /**
- * Read segments defining the map between two images from a text file. Each line of the file consists of a single pair of
- * segments. A segment consists of two 2D points (x, y) defining its start and end. The two segments in a pair identify matching
- * features in the two images.
+ * Compute the warp field of the algorithm described in Feature-Based Image Metamorphosis in the rectangle
+ * [col0, col1) x [row0, row1) of \a field, from a prepared warp whose segments are given in the warp coordinates of the field.
+ * Stores for each pixel the displacement to the location it should be sampled from in the image corresponding to the start
+ * segments. If the warp parameters have an identity tolerance, the rectangle is processed in blocks, and blocks whose
+ * displacement is bounded below the tolerance (see displacementBound) are set to zero displacement without evaluating any
+ * segment. With the mesh engine, the field is instead rasterized from the prepared mesh. Without a tree, a kernel generated for
+ * the layout of the segments, if the parameters have one, evaluates them in place of the generic loop.
  */
-bool
-loadSegments(std::string const & path, std::vector<LineSegment> & seg1, std::vector<LineSegment> & seg2)
+void
+computeWarpField(WarpField & field, int col0, int row0, int col1, int row1, PreparedWarp const & warp)
 {
-  std::ifstream in(path.c_str());
-  if (!in)
+  if (warp.mesh)
   {
-    std::cerr << "Could not open correspondence file " << path << std::endl;
-    return false;
+    warp.mesh->rasterize(field, col0, row0, col1, row1);
+    return;
   }
 
-  seg1.clear();
-  seg2.clear();
+  WarpParams const & params = warp.params;
+  std::vector<LineSegment> const & seg_start = warp.seg_start;
+  std::vector<LineSegment> const & interpolated = warp.interpolated;
+  SegmentTree const * tree = warp.tree;
+  RigKernel const * kernel = warp.kernel;
+  std::vector<SegmentPairTerms> const & pairs = warp.pairs;
+  std::vector<PointPairTerms> const & points = warp.points;
+  bool skip_identity = (params.identity_tolerance > 0);
 
-  double asx, asy, aex, aey, bsx, bsy, bex, bey;
-  long num_segs = 0;
+  std::vector<double> kernel_xs;
+  Vec2 dissum, curr;
+  double wtsum;
 
-  std::string line;
-  bool first_line = true;
-  while ((first_line || (long)seg1.size() < num_segs) && std::getline(in, line))
+  int const block_size = 16;
+  int block_w = (skip_identity ? block_size : max(col1 - col0, 1));
+  int block_h = (skip_identity ? block_size : max(row1 - row0, 1));
+  for (int brow0 = row0; brow0 < row1; brow0 += block_h)
   {
-    std::istringstream line_in(line);
-    if (first_line)
+    for (int bcol0 = col0; bcol0 < col1; bcol0 += block_w)
     {
-      if (!(line_in >> num_segs))
+      int brow1 = min(brow0 + block_h, row1), bcol1 = min(bcol0 + block_w, col1);
+
+      if (skip_identity)
       {
-        std::cerr << "Could not read number of segments";
-        return false;
+        Vec2 a = field.gridLocation(brow0, bcol0), b = field.gridLocation(brow1 - 1, bcol1 - 1);
+        Vec2 lo(min(a.x(), b.x()), min(a.y(), b.y())), hi(max(a.x(), b.x()), max(a.y(), b.y()));
+        if (displacementBound(seg_start, interpolated, lo, hi, params) < params.identity_tolerance)
+        {
+          for (int row = brow0; row < brow1; ++row)
+            for (int col = bcol0; col < bcol1; ++col)
+              field.setDisplacement(row, col, Vec2(0, 0));
+
+          continue;
+        }
       }
 
-      first_line = false;
-    }
-    else
-    {
-      if (!(line_in >> asx >> asy >> aex >> aey >> bsx >> bsy >> bex >> bey))
+      for (int row = brow0; row < brow1; ++row)
       {
-        std::cerr << "Could not read segment pair " << seg1.size();
-        return false;
-      }
+        if (kernel)
+        {
+          kernel_xs.resize(bcol1 - bcol0);
+          for (int col = bcol0; col < bcol1; ++col)
+            kernel_xs[col - bcol0] = field.gridLocation(row, col).x();
+
+          kernel->warpRow(warp.kernel_terms.data(), kernel_xs.data(), field.gridLocation(row, bcol0).y(), bcol1 - bcol0,
+                          field.data() + ((size_t)row * field.width() + bcol0) * 2);
+          continue;
+        }
+
+        int col = bcol0;
 
-      seg1.push_back(LineSegment(Vec2(asx, asy), Vec2(aex, aey)));
-      seg2.push_back(LineSegment(Vec2(bsx, bsy), Vec2(bex, bey)));
+        // Without a tree, evaluate the segments on packets of consecutive pixels at once
+        int const packet = Lanes4d::WIDTH;
+        for ( ; !tree && col + packet <= bcol1; col += packet)
+        {
+          Vec2 locs[packet];
+          for (int i = 0; i < packet; ++i)
+            locs[i] = field.gridLocation(row, col + i);
+
+          Vec2x4d curr_packet = Vec2x4d::gather(locs);
+          Vec2x4d dissum_packet(Vec2(0, 0));
+          Lanes4d wtsum_packet(0.0);
+          for (size_t i = 0; i < pairs.size(); ++i)
+            accumulateSegmentPair(pairs[i], curr_packet, params, dissum_packet, wtsum_packet);
+
+          for (size_t i = 0; i < points.size(); ++i)
+            accumulatePointPair(points[i], curr_packet, params, dissum_packet, wtsum_packet);
+
+          for (int i = 0; i < packet; ++i)
+            field.setDisplacement(row, col + i, dissum_packet.lane(i) / wtsum_packet[i]);
+        }
+
+        for ( ; col < bcol1; ++col)
+        {
+          wtsum = 0;
+          dissum = Vec2(0, 0);
+          curr = field.gridLocation(row, col);
+
+          if (tree)
+            tree->accumulate(curr, dissum, wtsum);
+          else
+          {
+            // src line and final line of each segment
+            for (size_t i = 0; i < pairs.size(); ++i)
+              accumulateSegmentPair(pairs[i], curr, params, dissum, wtsum);
+
+            for (size_t i = 0; i < points.size(); ++i)
+              accumulatePointPair(points[i], curr, params, dissum, wtsum);
+          }
+
+          // weighted average
+          field.setDisplacement(row, col, dissum/wtsum);
+        }
+      }
     }
   }
+}
+
+/**
+ * Compute the warp field of the algorithm described in Feature-Based Image Metamorphosis in the rectangle
+ * [col0, col1) x [row0, row1) of \a field, linearly interpolating the segments, which are given in the warp coordinates of the
+ * field, from seg_start to seg_end. The warp is prepared for just this rectangle (see PreparedWarp), with the mesh of the mesh
+ * engine spanning the whole field; fields computed piecewise should prepare it once instead.
+ */
+void
+computeWarpField(WarpField & field, int col0, int row0, int col1, int row1,
+                 std::vector<LineSegment> const & seg_start,
+                 std::vector<LineSegment> const & seg_end,
+                 double t,
+                 WarpParams const & params)
+{
+  PreparedWarp warp(seg_start, seg_end, t, params, field.gridLocation(0, 0),
+                    field.gridLocation(field.height() - 1, field.width() - 1));
+  computeWarpField(field, col0, row0, col1, row1, warp);
+}
 
-  assert(seg1.size() == seg2.size());
+/** Compute the warp field of the algorithm described in Feature-Based Image Metamorphosis on a \a w x \a h grid. */
+WarpField
+computeWarpField(int w, int h,
+                 std::vector<LineSegment> const & seg_start,
+                 std::vector<LineSegment> const & seg_end,
+                 double t,
+                 WarpParams const & params)
+{
+  WarpField field(w, h);
+  computeWarpField(field, 0, 0, w, h, seg_start, seg_end, t, params);
 
-  return (long)seg1.size() == num_segs;
+  return field;
 }
 
-bool
-morphDriver(std::string const & img1_path, std::string const & img2_path, std::string const & seg_path, double t,
-            std::string const & out_path, double a, double b, double p)
+/**
+ * Compute the warp field of the algorithm described in Feature-Based Image Metamorphosis on a \a w x \a h output grid, which
+ * \a grid maps into the warp coordinates the segments are given in. \a source maps warp coordinates to the pixel coordinates
+ * of the image to be sampled. The cost is proportional to the number of output pixels.
+ */
+WarpField
+computeWarpField(int w, int h,
+                 GridTransform const & grid,
+                 GridTransform const & source,
+                 std::vector<LineSegment> const & seg_start,
+                 std::vector<LineSegment> const & seg_end,
+                 double t,
+                 WarpParams const & params)
 {
-  // Load images, forcing both to 4-channel RGBA for compatibility
-  Image img1, img2;
-  if (!img1.load(img1_path, 4) || !img2.load(img2_path, 4))
-    return false;
+  WarpField field(w, h);
+  field.setGridTransform(grid);
+  field.setSourceTransform(source);
+  computeWarpField(field, 0, 0, w, h, seg_start, seg_end, t, params);
+
+  return field;
+}
 
-  if (!img1.hasSameDimsAs(img2))
+/**
+ * Sample the source location of pixel (row, col) of a warp field from a mip pyramid, with the given filter. \a acc is scratch
+ * space for one value per channel.
+ */
+void
+sampleWarped(MipPyramid const & pyramid, WarpField const & field, int row, int col, SampleFilter filter, double * acc,
+             unsigned char * sampled_color)
+{
+  Vec2 loc = field.sourceLocation(row, col);
+  if (filter == FILTER_BILINEAR)
   {
-    std::cerr << "Both input images must be the same dimensions" << std::endl;
-    return false;
+    sampleBilinearChannels(pyramid.level(0), loc, sampled_color);
+    return;
   }
 
-  std::cout << "Loaded two " << img1.width() << 'x' << img1.height() << ' ' << img1.numChannels() << "-channel images"
-            << std::endl;
-
-  // Load segments
-  std::vector<LineSegment> seg1, seg2;
-  if (!loadSegments(seg_path, seg1, seg2))
-    return false;
+  Vec2 dx, dy;
+  field.jacobian(row, col, dx, dy);
 
-  std::cout << "Read " << seg1.size() << " segments" << std::endl;
+  if (filter == FILTER_TRILINEAR)
+    sampleTrilinear(pyramid, loc, dx, dy, acc, sampled_color);
+  else
+    sampleEWA(pyramid, loc, dx, dy, 8.0, acc, sampled_color);
+}
 
-  Image morphed = morphImages(img1, img2, seg1, seg2, t, a, b, p);
-  if (!morphed.save(out_path))
-    return false;
+/**
+ * Get the filter to actually resample through a field with. Bilinear filtering is promoted to trilinear where the field's
+ * output grid is coarser than the source image, so that reduced-size output is prefiltered instead of aliased.
+ */
+SampleFilter
+effectiveFilter(WarpField const & field, SampleFilter filter)
+{
+  Vec2 scale = field.gridTransform().then(field.sourceTransform()).scale;
+  if (filter == FILTER_BILINEAR && max(fabs(scale.x()), fabs(scale.y())) > 1)
+    return FILTER_TRILINEAR;
 
-  return true;
+  return filter;
 }
 
-int
-main(int argc, char * argv[])
+/**
+ * Resample the base images of several mip pyramids through one warp field, so the cost of computing the field is paid once
+ * for all of them. The results have the dimensions of the field. The images may have any number of channels, but must all
+ * have the dimensions expected by the field's source transform. Rows of all images are resampled in parallel.
+ */
+std::vector<Image>
+resamplePyramids(std::vector<MipPyramid const *> const & pyramids, WarpField const & field, SampleFilter filter)
 {
-  if (argc != 6 && argc != 9)
-  {
-    std::cout << "Usage: " << argv[0] << " image1 image2 segments_file time[0..1] output.png [a  b  p]" << std::endl;
-    return -1;
-  }
+  int w = field.width();
+  int h = field.height();
+  filter = effectiveFilter(field, filter);
+  bool identity = field.gridTransform().then(field.sourceTransform()).isIdentity();
 
-  std::string img1_path  =  argv[1];
-  std::string img2_path  =  argv[2];
-  std::string seg_path   =  argv[3];
-  double t               =  std::atof(argv[4]);
-  std::string out_path   =  argv[5];
+  std::vector<Image> results(pyramids.size());
+  for (size_t i = 0; i < pyramids.size(); ++i)
+    results[i].resize(w, h, pyramids[i]->level(0).numChannels());
 
-  // sanity checks
-  if (t < 0.0 || t > 1.0)
+  parallelFor(0, (int)pyramids.size() * h, [&](int job)
   {
-    std::cout << "Time t out of range: clamping to [0..1]" << std::endl;
-    if (t > 1.0)
-      t = 1.0;
-    else
-      t = 0.0;
-  }
+    MipPyramid const & pyramid = *pyramids[job / h];
+    Image & result = results[job / h];
+    int row = job % h;
+
+    // Undisplaced pixels of a field mapping output pixels onto source pixels sample exactly one pixel, so just copy it
+    Image const & base = pyramid.level(0);
+    int nc = result.numChannels();
+    float const * disp = field.data() + (size_t)row * w * 2;
+    bool copy_undisplaced = (filter == FILTER_BILINEAR && identity && base.width() == w && base.height() == h);
+
+    std::vector<double> acc(nc);
+    for (int col = 0; col < w; ++col, disp += 2)
+    {
+      if (copy_undisplaced && disp[0] == 0 && disp[1] == 0)
+        std::memcpy(result.pixel(row, col), base.pixel(row, col), nc);
+      else
+        sampleWarped(pyramid, field, row, col, filter, &acc[0], result.pixel(row, col));
+    }
+  });
+
+  return results;
+}
 
-  double a = 0.5;
-  double b = 1;
-  double p = 0.2;
-  if (argc == 9)
+/**
+ * Resample several images through one warp field, like resamplePyramids. Mip pyramids of the images are built first if the
+ * filter needs them.
+ */
+std::vector<Image>
+resampleImages(std::vector<Image const *> const & images, WarpField const & field, SampleFilter filter = FILTER_BILINEAR)
+{
+  bool mipmapped = (effectiveFilter(field, filter) != FILTER_BILINEAR);
+
+  std::vector<MipPyramid> pyramids(images.size());
+  parallelFor(0, (int)images.size(), [&](int i)
   {
-    a = std::atof(argv[6]);
-    b = std::atof(argv[7]);
-    p = std::atof(argv[8]);
-  }
+    pyramids[i] = MipPyramid(*images[i], mipmapped ? -1 : 0);
+  });
 
-  std::cout << "Morphing " << img1_path << " into " << img2_path << " at time t = " << t << ", generating " << out_path
-            << std::endl;
-  std::cout << "Using parameters { a : " << a << ", b : " << b << ", p : " << p << " }" << std::endl;
+  std::vector<MipPyramid const *> pyramid_ptrs(pyramids.size());
+  for (size_t i = 0; i < pyramids.size(); ++i)
+    pyramid_ptrs[i] = &pyramids[i];
 
-  morphDriver(img1_path, img2_path, seg_path, t, out_path, a, b, p);
+  return resamplePyramids(pyramid_ptrs, field, filter);
+}
 
-  return 0;
+/** Resample an image through a warp field. The result has the dimensions of the field. */
+Image
+resampleImage(Image const & image, WarpField const & field, SampleFilter filter = FILTER_BILINEAR)
+{
+  return resampleImages(std::vector<Image const *>(1, &image), field, filter)[0];
+}
+
+/** Map segments through a transform, e.g. from the pixel coordinates of one image to those of another. */
+std::vector<LineSegment>
+transformSegments(std::vector<LineSegment> const & segs, GridTransform const & xform)
+{
+  std::vector<LineSegment> result(segs.size());
+  for (size_t i = 0; i < segs.size(); ++i)
+    result[i] = LineSegment(xform.apply(segs[i].start()), xform.apply(segs[i].end()));
+
+  return result;
+}
+
+/**
+ * Distorts an image according to the algorithm described in Feature-Based Image Metamorphosis, directly onto a \a w x \a h
+ * output grid covering the same extent as the image. Linearly interpolates the segments, which are given in the pixel
+ * coordinates of the image, from seg1_start to seg1_end. The warp is only evaluated at output pixels, and the image is
+ * prefiltered if the output is smaller than it.
+ */
+Image
+distortImage(Image const & image,
+             int w, int h,
+             std::vector<LineSegment> const & seg_start,
+             std::vector<LineSegment> const & seg_end,
+             double t,
+             WarpParams const & params,
+             SampleFilter filter = FILTER_BILINEAR)
+{
+  std::cout << "Distorting image..." << std::endl;
+
+  GridTransform grid = GridTransform::betweenGrids(w, h, image.width(), image.height());
+  WarpField field = computeWarpField(w, h, grid, GridTransform(), seg_start, seg_end, t, params);
+  return resampleImage(image, field, filter);
 }
 
+/**
+ * Distorts an image according to the algorithm described in Feature-Based Image Metamorphosis. Linearly interpolates the
+ * segments from seg1_start to seg1_end.
+ */
+Image
+distortImage(Image const & image,
+             std::vector<LineSegment> const & seg_start,
+             std::vector<LineSegment> const & seg_end,
+             double t,
+             WarpParams const & params,
+             SampleFilter filter = FILTER_BILINEAR)
+{
+  return distortImage(image, image.width(), image.height(), seg_start, seg_end, t, params, filter);
+}
+
+/* Linearly blends corresponding pixels of two images to produce the resulting image. */
+Image
+blendImages(Image const & img1, Image const & img2, double t)
+{
+  assert(img1.hasSameDimsAs(img2));
+
+  std::cout << "Blending images..." << std::endl;
+
+  int w = img1.width();
+  int h = img1.height();
+  int n = img1.numChannels();
+  unsigned char *res_pix;
+  const unsigned char *pix_1, *pix_2;
+
+  Image result(w, h, n);
+
+  for (int row = 0; row < h; ++row)
+  {
+    for (int col = 0; col < w; ++col)
+    { 
+      res_pix = result.pixel(row, col);
+      pix_1 = img1.pixel(row, col);
+      pix_2 = img2.pixel(row, col);
+
+      for (int channel = 0; channel < n; ++channel)
+      { 
+        // weighted average of the value of the pixel
+        double z = ((double)pix_1[channel] * t)
+                 + ((double)pix_2[channel] * (1-t));
+        res_pix[channel] = floor(z);
+      }
+    }
+  }
+
+  return result;
+}
+
+/** The pixel grids involved in morphing two images onto an output grid. */
+struct MorphGrids
+{
+  int w, h;               ///< Dimensions of the output
+  GridTransform grid;     ///< Map from output pixel coordinates to warp coordinates, which are the pixel coordinates of img1
+  GridTransform source2;  ///< Map from warp coordinates to the pixel coordinates of img2
+};
+
+/**
+ * Get the grids for morphing img1 into img2 onto an \a out_w x \a out_h output, which defaults to the dimensions of img1 if
+ * either is zero. All grids cover the same extent.
+ */
+MorphGrids
+morphGrids(Image const & img1, Image const & img2, int out_w, int out_h)
+{
+  MorphGrids grids;
+  grids.w = (out_w > 0 && out_h > 0 ? out_w : img1.width());
+  grids.h = (out_w > 0 && out_h > 0 ? out_h : img1.height());
+  grids.grid = GridTransform::betweenGrids(grids.w, grids.h, img1.width(), img1.height());
+  grids.source2 = GridTransform::betweenGrids(img1.width(), img1.height(), img2.width(), img2.height());
+
+  return grids;
+}
+
+/**
+ * A lazy graph of image operations: warps, resamplings of images through them, blends, colour transforms, resizes and crops.
+ * Adding a node only records the operation; evaluate() or render() then computes a node in one pass over tiles of its result,
+ * in parallel. Each tile computes just its part of the warp fields the node depends on, resamples the images through them and
+ * applies the blends and colour transforms to tile-sized buffers, which stay in cache, so no full-size intermediate image is
+ * stored and further operations cost no extra passes over memory. Resizes and crops only change which pixels the operations
+ * below them are evaluated at, so they are folded into the grids of the warps: warps are evaluated directly at the pixels of
+ * the result, and images are prefiltered where it is coarser than them (see effectiveFilter()). Every pixel is computed
+ * exactly as by the eager functions, computeWarpField(), resamplePyramids() and blendImages(), on the full output grid.
+ */
+class ImageGraph
+{
+  private:
+    /** Kinds of operations. */
+    enum NodeKind
+    {
+      NODE_WARP,    ///< A warp field
+      NODE_SAMPLE,  ///< An image resampled through a warp field
+      NODE_BLEND,   ///< A linear blend of two images
+      NODE_COLOUR,  ///< A lookup table applied to each channel of an image
+      NODE_REGRID   ///< A resize or crop of an image
+    };
+
+    /** An operation and its parameters. */
+    struct Node
+    {
+      NodeKind kind;
+      int w, h;                                     ///< Dimensions of the result
+      int nc;                                       ///< Number of channels of the result, 0 for a warp field
+      int input1, input2;                           ///< Nodes the operation reads, or -1
+      std::vector<LineSegment> seg_start, seg_end;  ///< Segments of a warp
+      double t;                                     ///< Time of a warp, or weight of the first image of a blend
+      WarpParams params;                            ///< Parameters of a warp
+      GridTransform source;                         ///< Map from the warp coordinates of a warp to source pixels
+      GridTransform grid;                           ///< Map from the pixels of a resize or crop to those of its input
+      Image const * image;                          ///< Image resampled, if not given as a mip pyramid
+      MipPyramid const * pyramid;                   ///< Mip pyramid resampled
+      SampleFilter filter;                          ///< Filter resampling with
+      std::vector<unsigned char> lut;               ///< 256 entries per channel of a colour transform
+
+      /** Construct a node of the given kind, with its dimensions, number of channels and inputs. */
+      Node(NodeKind kind_, int w_, int h_, int nc_, int input1_ = -1, int input2_ = -1)
+      : kind(kind_), w(w_), h(h_), nc(nc_), input1(input1_), input2(input2_), t(0), image(NULL), pyramid(NULL),
+        filter(FILTER_BILINEAR)
+      {}
+    };
+
+    /**
+     * An operation lowered onto the pixels of the result being computed, with the resizes and crops above it folded in.
+     * Lowered nodes are ordered so that each comes after those it reads.
+     */
+    struct Step
+    {
+      int node;                            ///< Node lowered
+      GridTransform grid;                  ///< Map from pixels of the result to those of the node
+      int input1, input2;                  ///< Steps read, or -1
+      int apron;                           ///< Pixels a warp field extends beyond each tile, for the footprints of samples
+      SampleFilter filter;                 ///< Filter of a sample, promoted where the result is coarser than the image
+      bool copy_undisplaced;               ///< Can a sample copy the pixels a field leaves in place?
+      MipPyramid const * pyramid;          ///< Mip pyramid a sample reads
+      std::shared_ptr<PreparedWarp> warp;  ///< Warp prepared once for all tiles
+    };
+
+    std::vector<Node> nodes;
+
+    /** Add a node and get its index. */
+    int add(Node const & node)
+    {
+      nodes.push_back(node);
+      return (int)nodes.size() - 1;
+    }
+
+    /**
+     * Lower a node onto a \a w x \a h result, whose pixels \a grid maps to those of the node, appending the steps it needs to
+     * \a steps. Nodes reached along several paths with the same grid are only lowered once. Returns the index of its step.
+     */
+    int lower(int index, GridTransform const & grid, int w, int h, std::vector<Step> & steps) const
+    {
+      Node const & node = nodes[(size_t)index];
+      if (node.kind == NODE_REGRID)
+        return lower(node.input1, grid.then(node.grid), w, h, steps);
+
+      for (size_t i = 0; i < steps.size(); ++i)
+        if (steps[i].node == index && steps[i].grid.scale == grid.scale && steps[i].grid.offset == grid.offset)
+          return (int)i;
+
+      Step step;
+      step.node = index;
+      step.grid = grid;
+      step.input1 = (node.input1 >= 0 ? lower(node.input1, grid, w, h, steps) : -1);
+      step.input2 = (node.input2 >= 0 ? lower(node.input2, grid, w, h, steps) : -1);
+      step.apron = 0;
+      step.filter = FILTER_BILINEAR;
+      step.copy_undisplaced = false;
+      step.pyramid = node.pyramid;
+
+      if (node.kind == NODE_WARP)
+      {
+        // Prepared once for the whole result, with the extent of a full field for the mesh engine
+        step.warp = std::make_shared<PreparedWarp>(node.seg_start, node.seg_end, node.t, node.params, grid.apply(Vec2(0, 0)),
+                                                   grid.apply(Vec2(w - 1, h - 1)));
+      }
+      else if (node.kind == NODE_SAMPLE)
+      {
+        WarpField probe;
+        probe.setGridTransform(grid);
+        probe.setSourceTransform(nodes[(size_t)node.input1].source);
+        step.filter = effectiveFilter(probe, node.filter);
+
+        Image const & base = (node.pyramid ? node.pyramid->level(0) : *node.image);
+        step.copy_undisplaced = (step.filter == FILTER_BILINEAR && grid.then(probe.sourceTransform()).isIdentity()
+                              && base.width() == w && base.height() == h);
+
+        // Footprints of filtered samples are estimated from the displacements of neighboring pixels
+        if (step.filter != FILTER_BILINEAR)
+          steps[(size_t)step.input1].apron = 1;
+      }
+
+      steps.push_back(step);
+      return (int)steps.size() - 1;
+    }
+
+  public:
+    /**
+     * Add a warp on a \a w x \a h grid, whose pixel coordinates are the warp coordinates the segments are given in, from
+     * \a seg_start to \a seg_end at time \a t (see computeWarpField()). \a source maps warp coordinates to the pixel coordinates
+     * of the images resampled through it.
+     */
+    int warp(int w, int h, std::vector<LineSegment> const & seg_start, std::vector<LineSegment> const & seg_end, double t,
+             WarpParams const & params, GridTransform const & source = GridTransform())
+    {
+      assert(seg_start.size() == seg_end.size());
+
+      Node node(NODE_WARP, w, h, 0);
+      node.seg_start = seg_start;
+      node.seg_end = seg_end;
+      node.t = t;
+      node.params = params;
+      node.source = source;
+      return add(node);
+    }
+
+    /**
+     * Add the resampling of the base of a mip pyramid through a warp, with the dimensions of the warp and the channels of the
+     * pyramid. The pyramid must have all the levels the filter needs, and outlive the evaluations of the graph.
+     */
+    int sample(int warp, MipPyramid const & pyramid, SampleFilter filter)
+    {
+      assert(nodes[(size_t)warp].kind == NODE_WARP);
+
+      Node node(NODE_SAMPLE, nodes[(size_t)warp].w, nodes[(size_t)warp].h, pyramid.level(0).numChannels(), warp);
+      node.pyramid = &pyramid;
+      node.filter = filter;
+      return add(node);
+    }
+
+    /**
+     * Add the resampling of an image through a warp, like the resampling of a mip pyramid. The levels the filter needs are
+     * built when the graph is evaluated. The image must outlive the evaluations of the graph.
+     */
+    int sample(int warp, Image const & image, SampleFilter filter)
+    {
+      assert(nodes[(size_t)warp].kind == NODE_WARP);
+
+      Node node(NODE_SAMPLE, nodes[(size_t)warp].w, nodes[(size_t)warp].h, image.numChannels(), warp);
+      node.image = &image;
+      node.filter = filter;
+      return add(node);
+    }
+
+    /** Add the blend of two images of the same dimensions and channels, with weight \a t of the first, as in blendImages(). */
+    int blend(int a, int b, double t)
+    {
+      Node const & na = nodes[(size_t)a];
+      assert(na.nc > 0 && na.w == nodes[(size_t)b].w && na.h == nodes[(size_t)b].h && na.nc == nodes[(size_t)b].nc);
+
+      Node node(NODE_BLEND, na.w, na.h, na.nc, a, b);
+      node.t = t;
+      return add(node);
+    }
+
+    /**
+     * Add a colour transform of an image, mapping each value of channel c through entries [256 c, 256 (c + 1)) of \a lut, or
+     * every channel through the same 256 entries.
+     */
+    int colour(int input, std::vector<unsigned char> const & lut)
+    {
+      Node const & in = nodes[(size_t)input];
+      assert(in.nc > 0 && (lut.size() == 256 || lut.size() == 256 * (size_t)in.nc));
+
+      Node node(NODE_COLOUR, in.w, in.h, in.nc, input);
+      node.lut.resize(256 * (size_t)in.nc);
+      for (size_t i = 0; i < node.lut.size(); ++i)
+        node.lut[i] = lut[i % lut.size()];
+
+      return add(node);
+    }
+
+    /**
+     * Add the gamma correction of an image, mapping every value v to 255 (v / 255)^(1 / gamma), except those of alpha, the last
+     * channel of images with 2 or 4 channels.
+     */
+    int gamma(int input, double gamma)
+    {
+      int nc = numChannels(input);
+      std::vector<unsigned char> lut(256 * (size_t)nc);
+      for (int c = 0; c < nc; ++c)
+        for (int v = 0; v < 256; ++v)
+        {
+          bool alpha = (c == nc - 1 && (nc == 2 || nc == 4));
+          double corrected = std::min(std::floor(255 * std::pow(v / 255.0, 1 / gamma) + 0.5), 255.0);
+          lut[256 * (size_t)c + v] = (unsigned char)(alpha ? v : corrected);
+        }
+
+      return colour(input, lut);
+    }
+
+    /** Add a resize of an image to \a w x \a h pixels covering the same extent. */
+    int resize(int input, int w, int h)
+    {
+      Node const & in = nodes[(size_t)input];
+      assert(in.nc > 0 && w > 0 && h > 0);
+
+      Node node(NODE_REGRID, w, h, in.nc, input);
+      node.grid = GridTransform::betweenGrids(w, h, in.w, in.h);
+      return add(node);
+    }
+
+    /** Add the crop of an image to the \a w x \a h pixels from column \a x and row \a y on, which must lie within it. */
+    int crop(int input, int x, int y, int w, int h)
+    {
+      Node const & in = nodes[(size_t)input];
+      assert(in.nc > 0 && x >= 0 && y >= 0 && w > 0 && h > 0 && x + w <= in.w && y + h <= in.h);
+
+      Node node(NODE_REGRID, w, h, in.nc, input);
+      node.grid = GridTransform(Vec2(1, 1), Vec2(x, y));
+      return add(node);
+    }
+
+    /** Get the width of the result of a node. */
+    int width(int node) const { return nodes[(size_t)node].w; }
+
+    /** Get the height of the result of a node. */
+    int height(int node) const { return nodes[(size_t)node].h; }
+
+    /** Get the number of channels of the result of a node. */
+    int numChannels(int node) const { return nodes[(size_t)node].nc; }
+
+    /**
+     * Compute the image of a node tile by tile, in parallel, passing each \a tile_size x \a tile_size tile to
+     * emit(col, row, tile) with its column and row in the grid of tiles as soon as it is done, from whichever thread computed
+     * it.
+     */
+    template <typename Emit>
+    void render(int node, int tile_size, Emit const & emit) const
+    {
+      int w = width(node), h = height(node), nc = numChannels(node);
+      assert(nc > 0);
+
+      std::vector<Step> steps;
+      int root = lower(node, GridTransform(), w, h, steps);
+
+      // Build the mip levels of images, as far as any of their samples need them
+      std::vector<MipPyramid> pyramids(nodes.size());
+      for (size_t i = 0; i < steps.size(); ++i)
+      {
+        Node const & n = nodes[(size_t)steps[i].node];
+        if (n.kind != NODE_SAMPLE || n.pyramid)
+          continue;
+
+        MipPyramid & pyramid = pyramids[(size_t)steps[i].node];
+        if (pyramid.numLevels() == 0)
+        {
+          bool mipmapped = false;
+          for (size_t j = 0; j < steps.size(); ++j)
+            mipmapped = mipmapped || (steps[j].node == steps[i].node && steps[j].filter != FILTER_BILINEAR);
+
+          pyramid = MipPyramid(*n.image, mipmapped ? -1 : 0);
+        }
+
+        steps[i].pyramid = &pyramid;
+      }
+
+      int tiles_x = (w + tile_size - 1) / tile_size;
+      int tiles_y = (h + tile_size - 1) / tile_size;
+      parallelFor(0, tiles_x * tiles_y, [&](int tile)
+      {
+        int col0 = (tile % tiles_x) * tile_size, row0 = (tile / tiles_x) * tile_size;
+        int tw = std::min(tile_size, w - col0), th = std::min(tile_size, h - row0);
+
+        // The warp fields and images of the steps over this tile
+        std::vector<WarpField> fields(steps.size());
+        std::vector< std::vector<unsigned char> > tiles(steps.size());
+        for (size_t i = 0; i < steps.size(); ++i)
+        {
+          Step const & step = steps[i];
+          Node const & n = nodes[(size_t)step.node];
+          if (n.kind == NODE_WARP)
+          {
+            // Fields are windows of a field on the grid of the result, with an apron clamped to the result
+            int c0 = std::max(col0 - step.apron, 0), r0 = std::max(row0 - step.apron, 0);
+            int c1 = std::min(col0 + tw + step.apron, w), r1 = std::min(row0 + th + step.apron, h);
+            WarpField & field = fields[i];
+            field = WarpField(c1 - c0, r1 - r0);
+            field.setGridTransform(step.grid);
+            field.setSourceTransform(n.source);
+            field.setOrigin(c0, r0);
+            computeWarpField(field, 0, 0, c1 - c0, r1 - r0, *step.warp);
+
+            continue;
+          }
+
+          std::vector<unsigned char> & pix = tiles[i];
+          pix.resize((size_t)tw * th * n.nc);
+          if (n.kind == NODE_SAMPLE)
+          {
+            WarpField const & field = fields[(size_t)step.input1];
+            Image const & base = step.pyramid->level(0);
+            int dc = col0 - field.originCol(), dr = row0 - field.originRow();
+            std::vector<double> acc((size_t)n.nc);
+            unsigned char * dst = &pix[0];
+            for (int row = 0; row < th; ++row)
+            {
+              float const * disp = field.data() + ((size_t)(row + dr) * field.width() + dc) * 2;
+              for (int col = 0; col < tw; ++col, disp += 2, dst += n.nc)
+              {
+                // Undisplaced pixels of a field mapping pixels of the result onto source pixels sample exactly one pixel
+                if (step.copy_undisplaced && disp[0] == 0 && disp[1] == 0)
+                  std::memcpy(dst, base.pixel(row0 + row, col0 + col), (size_t)n.nc);
+                else
+                  sampleWarped(*step.pyramid, field, row + dr, col + dc, step.filter, &acc[0], dst);
+              }
+            }
+          }
+          else if (n.kind == NODE_BLEND)
+          {
+            unsigned char const * a = &tiles[(size_t)step.input1][0];
+            unsigned char const * b = &tiles[(size_t)step.input2][0];
+            for (size_t k = 0; k < pix.size(); ++k)
+              pix[k] = floor(((double)a[k] * n.t) + ((double)b[k] * (1 - n.t)));
+          }
+          else
+          {
+            unsigned char const * in = &tiles[(size_t)step.input1][0];
+            for (size_t k = 0; k < pix.size(); ++k)
+              pix[k] = n.lut[256 * (k % (size_t)n.nc) + in[k]];
+          }
+        }
+
+        Image result(tw, th, nc);
+        std::memcpy(result.data(), &tiles[(size_t)root][0], tiles[(size_t)root].size());
+        emit(tile % tiles_x, tile / tiles_x, result);
+      });
+    }
+
+    /** Compute the image of a node, as in render(). */
+    Image evaluate(int node, int tile_size = 32) const
+    {
+      int w = width(node), h = height(node), nc = numChannels(node);
+
+      std::cout << "Rendering " << w << "x" << h << " image in one pass over "
+                << ((w + tile_size - 1) / tile_size) * ((h + tile_size - 1) / tile_size) << " tiles..." << std::endl;
+
+      Image result(w, h, nc);
+      render(node, tile_size, [&](int col, int row, Image const & tile)
+      {
+        for (int r = 0; r < tile.height(); ++r)
+          std::memcpy(result.pixel(row * tile_size + r, col * tile_size), tile.scanline(r), (size_t)tile.width() * nc);
+      });
+
+      return result;
+    }
+
+}; // class ImageGraph
+
+/** Adjustments of the result of a morph, applied in the same pass as the morph itself. */
+struct OutputAdjust
+{
+  double gamma;                         ///< Gamma correction, see ImageGraph::gamma(); 1 for none
+  int crop_x, crop_y, crop_w, crop_h;  ///< Region of the output to keep; all of it if crop_w is 0
+
+  /** Default constructor, with no adjustments. */
+  OutputAdjust() : gamma(1), crop_x(0), crop_y(0), crop_w(0), crop_h(0) {}
+
+  /** Check if there are any adjustments. */
+  bool empty() const { return gamma == 1 && crop_w == 0; }
+
+  /** Check if the crop region lies within a \a w x \a h output. */
+  bool fitsIn(int w, int h) const
+  {
+    return crop_w == 0 || (crop_x >= 0 && crop_y >= 0 && crop_x + crop_w <= w && crop_y + crop_h <= h);
+  }
+
+}; // struct OutputAdjust
+
+/** Add the nodes of a morph as in morphImages() to \a graph, and get the node of its result. */
+int
+addMorph(ImageGraph & graph,
+         Image const & img1,
+         Image const & img2,
+         std::vector<LineSegment> const & seg1,
+         std::vector<LineSegment> const & seg2,
+         double t,
+         WarpParams const & params,
+         SampleFilter filter,
+         int out_w, int out_h,
+         OutputAdjust const & adjust)
+{
+  MorphGrids grids = morphGrids(img1, img2, out_w, out_h);
+  assert(adjust.fitsIn(grids.w, grids.h));
+
+  // Bring seg2 into the warp coordinates, i.e. onto the pixel grid of img1
+  std::vector<LineSegment> seg2_warp = transformSegments(seg2, grids.source2.inverse());
+
+  // Distort img1 from 0 to t, using seg1 as the initial segments and seg2 as the final ones, and img2 from 1 to (1 - t),
+  // using seg2 as the initial segments and seg1 as the final ones, on the pixel grid of img1
+  int w1 = img1.width(), h1 = img1.height();
+  int distorted1 = graph.sample(graph.warp(w1, h1, seg1, seg2_warp, t, params), img1, filter);
+  int distorted2 = graph.sample(graph.warp(w1, h1, seg2_warp, seg1, 1-t, params, grids.source2), img2, filter);
+
+  // Now blend the results by linearly interpolating ("lerping"), on the output grid
+  int result = graph.blend(distorted1, distorted2, 1-t);
+  if (grids.w != w1 || grids.h != h1)
+    result = graph.resize(result, grids.w, grids.h);
+
+  if (adjust.gamma != 1)
+    result = graph.gamma(result, adjust.gamma);
+
+  if (adjust.crop_w > 0)
+    result = graph.crop(result, adjust.crop_x, adjust.crop_y, adjust.crop_w, adjust.crop_h);
+
+  return result;
+}
+
+/**
+ * Morph img1 into img2. seg1 and seg2 are in the pixel coordinates of img1 and img2 respectively, and the images may have
+ * different dimensions. The result is \a out_w x \a out_h, or has the dimensions of img1 if either is zero. The warp is
+ * evaluated directly on the output grid, so its cost scales with the output size, and both images are resampled straight
+ * onto it, prefiltered where the output is smaller than them. The output is then adjusted as \a adjust specifies, whose crop
+ * must fit in it. Warps, resampling, blending and adjustments are fused into one pass over tiles of the output (see
+ * ImageGraph).
+ */
+Image
+morphImages(Image const & img1,
+            Image const & img2,
+            std::vector<LineSegment> const & seg1,
+            std::vector<LineSegment> const & seg2,
+            double t,
+            WarpParams const & params,
+            SampleFilter filter = FILTER_BILINEAR,
+            int out_w = 0, int out_h = 0,
+            OutputAdjust const & adjust = OutputAdjust())
+{
+  ImageGraph graph;
+  int result = addMorph(graph, img1, img2, seg1, seg2, t, params, filter, out_w, out_h, adjust);
+  return graph.evaluate(result);
+}
+
+/** Morph two images, given as mip pyramids, whose warp fields at time \a t have already been computed. */
+Image
+morphWithFields(MipPyramid const & pyr1, MipPyramid const & pyr2, WarpField const & field1, WarpField const & field2,
+                double t, SampleFilter filter)
+{
+  Image distorted1 = resamplePyramids(std::vector<MipPyramid const *>(1, &pyr1), field1, filter)[0];
+  Image distorted2 = resamplePyramids(std::vector<MipPyramid const *>(1, &pyr2), field2, filter)[0];
+
+  return blendImages(distorted1, distorted2, 1-t);
+}
+
+/**
+ * Morph img1 into img2 like morphImages, and carry auxiliary layers (masks, mattes, colour variants) through the same
+ * geometry. Each warp field is computed once, and all images aligned with it are then resampled through it in parallel.
+ * layers1[i] is aligned with img1 and layers2[i] with img2. Either may be NULL, in which case the result is the other layer
+ * distorted to time t; else both are distorted and blended like the main images. Layers may have any number of channels but
+ * must have the dimensions of the image they are aligned with. As in morphImages, img1 and img2 may have different
+ * dimensions, and the results are \a out_w x \a out_h, or have the dimensions of img1 if either is zero. Returns the morphed
+ * image followed by the morphed layers.
+ */
+std::vector<Image>
+morphImagesWithLayers(Image const & img1,
+                      Image const & img2,
+                      std::vector<Image const *> const & layers1,
+                      std::vector<Image const *> const & layers2,
+                      std::vector<LineSegment> const & seg1,
+                      std::vector<LineSegment> const & seg2,
+                      double t,
+                      WarpParams const & params,
+                      SampleFilter filter = FILTER_BILINEAR,
+                      int out_w = 0, int out_h = 0)
+{
+  assert(layers1.size() == layers2.size());
+
+  std::vector<Image const *> batch1(1, &img1), batch2(1, &img2);
+  for (size_t i = 0; i < layers1.size(); ++i)
+  {
+    assert(layers1[i] || layers2[i]);
+    if (layers1[i]) batch1.push_back(layers1[i]);
+    if (layers2[i]) batch2.push_back(layers2[i]);
+  }
+
+  std::cout << "Distorting " << batch1.size() + batch2.size() << " images through two warp fields..." << std::endl;
+
+  MorphGrids grids = morphGrids(img1, img2, out_w, out_h);
+  std::vector<LineSegment> seg2_warp = transformSegments(seg2, grids.source2.inverse());
+
+  WarpField field1 = computeWarpField(grids.w, grids.h, grids.grid, GridTransform(), seg1, seg2_warp, t, params);
+  std::vector<Image> distorted1 = resampleImages(batch1, field1, filter);
+
+  WarpField field2 = computeWarpField(grids.w, grids.h, grids.grid, grids.source2, seg2_warp, seg1, 1-t, params);
+  std::vector<Image> distorted2 = resampleImages(batch2, field2, filter);
+
+  std::vector<Image> results;
+  results.push_back(blendImages(distorted1[0], distorted2[0], 1-t));
+
+  size_t next1 = 1, next2 = 1;
+  for (size_t i = 0; i < layers1.size(); ++i)
+  {
+    if (layers1[i] && layers2[i])
+      results.push_back(blendImages(distorted1[next1++], distorted2[next2++], 1-t));
+    else if (layers1[i])
+      results.push_back(distorted1[next1++]);
+    else
+      results.push_back(distorted2[next2++]);
+  }
+
+  return results;
+}
+
+/**
+ * Average several images, given as mip pyramids, with barycentric \a weights: warp each image to the weighted average of the
+ * segments of all images, and blend the results with the same weights. segs[i] are the segments of image i in its pixel
+ * coordinates, and all sets must correspond segment by segment. The images may have different dimensions but must have the
+ * same number of channels. The result is \a w x \a h. Warping and blending are fused: each \a tile_size x \a tile_size tile of
+ * the output is warped from every image and accumulated directly, so no warped image is ever stored, and every source pixel
+ * is resampled only once. Tiles are rendered in parallel, and each is passed to emit(col, row, tile) with its column and row in
+ * the grid of tiles as soon as it is done, from whichever thread rendered it.
+ */
+template <typename Emit>
+void
+averageTiles(std::vector<MipPyramid const *> const & pyramids,
+             std::vector< std::vector<LineSegment> > const & segs,
+             std::vector<double> const & weights,
+             WarpParams const & params,
+             SampleFilter filter,
+             int w, int h, int tile_size,
+             Emit const & emit)
+{
+  size_t num_images = pyramids.size();
+  assert(num_images > 0 && segs.size() == num_images && weights.size() == num_images);
+
+  Image const & img0 = pyramids[0]->level(0);
+  int nc = img0.numChannels();
+
+  // Warp coordinates are the pixel coordinates of the first image
+  GridTransform grid = GridTransform::betweenGrids(w, h, img0.width(), img0.height());
+  std::vector<GridTransform> sources(num_images);
+  std::vector< std::vector<LineSegment> > segs_warp(num_images);
+  std::vector<SampleFilter> filters(num_images);
+  double weight_sum = 0;
+  for (size_t i = 0; i < num_images; ++i)
+  {
+    assert(pyramids[i]->level(0).numChannels() == nc && segs[i].size() == segs[0].size());
+
+    Image const & img = pyramids[i]->level(0);
+    sources[i] = GridTransform::betweenGrids(img0.width(), img0.height(), img.width(), img.height());
+    segs_warp[i] = transformSegments(segs[i], sources[i].inverse());
+    weight_sum += weights[i];
+
+    WarpField probe;
+    probe.setGridTransform(grid);
+    probe.setSourceTransform(sources[i]);
+    filters[i] = effectiveFilter(probe, filter);
+  }
+
+  // The weighted average segments, which every image is warped to
+  std::vector<LineSegment> average(segs[0].size());
+  for (size_t j = 0; j < average.size(); ++j)
+  {
+    Vec2 start(0, 0), end(0, 0);
+    for (size_t i = 0; i < num_images; ++i)
+    {
+      start += (weights[i] / weight_sum) * segs_warp[i][j].start();
+      end += (weights[i] / weight_sum) * segs_warp[i][j].end();
+    }
+
+    average[j] = LineSegment(start, end);
+  }
+
+  // The warp of each image is prepared once for all tiles
+  std::vector< std::shared_ptr<PreparedWarp> > warps(num_images);
+  for (size_t i = 0; i < num_images; ++i)
+    if (weights[i] != 0)
+      warps[i] = std::make_shared<PreparedWarp>(segs_warp[i], average, 1, params, grid.apply(Vec2(0, 0)),
+                                                grid.apply(Vec2(w - 1, h - 1)));
+
+  int tiles_x = (w + tile_size - 1) / tile_size;
+  int tiles_y = (h + tile_size - 1) / tile_size;
+  parallelFor(0, tiles_x * tiles_y, [&](int tile)
+  {
+    int col0 = (tile % tiles_x) * tile_size, row0 = (tile / tiles_x) * tile_size;
+    int tw = std::min(tile_size, w - col0), th = std::min(tile_size, h - row0);
+
+    // A warp field covering just this tile, and the weighted sum of the warped images over it
+    WarpField field(tw, th);
+    field.setGridTransform(GridTransform(Vec2(1, 1), Vec2(col0, row0)).then(grid));
+    std::vector<double> sum((size_t)tw * th * nc, 0.0);
+    std::vector<double> acc(nc);
+    std::vector<unsigned char> color(nc);
+
+    for (size_t i = 0; i < num_images; ++i)
+    {
+      double wt = weights[i] / weight_sum;
+      if (wt == 0)
+        continue;
+
+      field.setSourceTransform(sources[i]);
+      computeWarpField(field, 0, 0, tw, th, *warps[i]);
+
+      double * s = &sum[0];
+      for (int row = 0; row < th; ++row)
+        for (int col = 0; col < tw; ++col, s += nc)
+        {
+          sampleWarped(*pyramids[i], field, row, col, filters[i], &acc[0], &color[0]);
+          for (int c = 0; c < nc; ++c)
+            s[c] += wt * color[c];
+        }
+    }
+
+    Image result(tw, th, nc);
+    unsigned char * pix = result.data();
+    for (size_t i = 0; i < sum.size(); ++i)
+      pix[i] = (unsigned char)std::min(std::max(std::floor(sum[i] + 0.5), 0.0), 255.0);
+
+    emit(tile % tiles_x, tile / tiles_x, result);
+  });
+}
+
+/**
+ * Average several images, given as mip pyramids, as in averageTiles(). The result is \a out_w x \a out_h, or has the
+ * dimensions of the first image if either is zero.
+ */
+Image
+averageImages(std::vector<MipPyramid const *> const & pyramids,
+              std::vector< std::vector<LineSegment> > const & segs,
+              std::vector<double> const & weights,
+              WarpParams const & params,
+              SampleFilter filter = FILTER_BILINEAR,
+              int out_w = 0, int out_h = 0)
+{
+  Image const & img0 = pyramids[0]->level(0);
+  int w = (out_w > 0 && out_h > 0 ? out_w : img0.width());
+  int h = (out_w > 0 && out_h > 0 ? out_h : img0.height());
+  int nc = img0.numChannels();
+
+  std::cout << "Averaging " << pyramids.size() << " images..." << std::endl;
+
+  Image result(w, h, nc);
+  int const tile_size = 32;
+  averageTiles(pyramids, segs, weights, params, filter, w, h, tile_size, [&](int col, int row, Image const & tile)
+  {
+    for (int r = 0; r < tile.height(); ++r)
+      std::memcpy(result.pixel(row * tile_size + r, col * tile_size), tile.scanline(r), (size_t)tile.width() * nc);
+  });
+
+  return result;
+}
+
+/**
+ * Get the number of mip levels to build for resampling an image onto a \a w x \a h output covering the same extent: all of
+ * them if the filter, possibly promoted to prefilter reduced-size output, uses them, else just the base level.
+ */
+int
+mipLevelsFor(Image const & img, int w, int h, SampleFilter filter)
+{
+  WarpField probe;
+  probe.setGridTransform(GridTransform::betweenGrids(w, h, img.width(), img.height()));
+  return effectiveFilter(probe, filter) == FILTER_BILINEAR ? 0 : -1;
+}
+
+/** Motion blur of the frames of a sequence. */
+struct MotionBlur
+{
+  int samples;     ///< Number of sub-frames averaged into each frame, or 1 for no blur
+  double shutter;  ///< Fraction of the time between frames over which each frame is exposed
+
+  /** Default constructor: no blur. */
+  MotionBlur() : samples(1), shutter(0.5) {}
+
+  /**
+   * Get the times of the sub-frames of a frame at time \a t, with \a dt between frames: evenly spread over the exposure centered
+   * on \a t, and clamped to [0, 1].
+   */
+  std::vector<double> subframeTimes(double t, double dt) const
+  {
+    std::vector<double> times(samples);
+    for (int k = 0; k < samples; ++k)
+      times[k] = std::min(std::max(t + ((k + 0.5) / samples - 0.5) * shutter * dt, 0.0), 1.0);
+
+    return times;
+  }
+};
+
+/**
+ * Morph two images, given as mip pyramids, averaging the frames at several times into one, i.e. with motion blur. seg1 and
+ * seg2 are the segments of the images in warp coordinates, and segs_at[k] where they are at times[k]. Each output pixel is
+ * visited once: its displacements at all times are computed together, sharing each segment's data across times (see
+ * SubframeWarp), and the blended samples of all times are accumulated in place. Tiles are rendered in parallel.
+ */
+Image
+morphSubframes(MipPyramid const & pyr1, MipPyramid const & pyr2, MorphGrids const & grids,
+               std::vector<LineSegment> const & seg1, std::vector<LineSegment> const & seg2,
+               std::vector<double> const & times, std::vector< std::vector<LineSegment> > const & segs_at,
+               WarpParams const & params, SampleFilter filter)
+{
+  assert(!times.empty() && times.size() == segs_at.size());
+
+  int num_times = (int)times.size();
+  int w = grids.w;
+  int h = grids.h;
+  int nc = pyr1.level(0).numChannels();
+  SubframeWarp warp1(seg1, segs_at, params);
+  SubframeWarp warp2(seg2, segs_at, params);
+
+  WarpField probe1, probe2;
+  probe1.setGridTransform(grids.grid);
+  probe2.setGridTransform(grids.grid);
+  probe2.setSourceTransform(grids.source2);
+  SampleFilter filter1 = effectiveFilter(probe1, filter);
+  SampleFilter filter2 = effectiveFilter(probe2, filter);
+
+  Image result(w, h, nc);
+  int const tile_size = 32;
+  int tiles_x = (w + tile_size - 1) / tile_size;
+  int tiles_y = (h + tile_size - 1) / tile_size;
+  parallelFor(0, tiles_x * tiles_y, [&](int tile)
+  {
+    int col0 = (tile % tiles_x) * tile_size, row0 = (tile / tiles_x) * tile_size;
+    int tw = std::min(tile_size, w - col0), th = std::min(tile_size, h - row0);
+
+    // Warp fields of both images at every time, covering just this tile
+    GridTransform tile_grid = GridTransform(Vec2(1, 1), Vec2(col0, row0)).then(grids.grid);
+    std::vector<WarpField> fields1(num_times, WarpField(tw, th)), fields2(num_times, WarpField(tw, th));
+    for (int k = 0; k < num_times; ++k)
+    {
+      fields1[k].setGridTransform(tile_grid);
+      fields2[k].setGridTransform(tile_grid);
+      fields2[k].setSourceTransform(grids.source2);
+    }
+
+    std::vector<Vec2> disp(num_times), dissum(num_times);
+    std::vector<double> wtsum(num_times);
+    for (int row = 0; row < th; ++row)
+      for (int col = 0; col < tw; ++col)
+      {
+        Vec2 curr = fields1[0].gridLocation(row, col);
+        warp1.displacements(curr, &disp[0], &dissum[0], &wtsum[0]);
+        for (int k = 0; k < num_times; ++k)
+          fields1[k].setDisplacement(row, col, disp[k]);
+
+        warp2.displacements(curr, &disp[0], &dissum[0], &wtsum[0]);
+        for (int k = 0; k < num_times; ++k)
+          fields2[k].setDisplacement(row, col, disp[k]);
+      }
+
+    std::vector<double> acc(nc), sum(nc);
+    std::vector<unsigned char> color1(nc), color2(nc);
+    for (int row = 0; row < th; ++row)
+    {
+      unsigned char * pix = result.pixel(row0 + row, col0);
+      for (int col = 0; col < tw; ++col, pix += nc)
+      {
+        std::fill(sum.begin(), sum.end(), 0.0);
+        for (int k = 0; k < num_times; ++k)
+        {
+          sampleWarped(pyr1, fields1[k], row, col, filter1, &acc[0], &color1[0]);
+          sampleWarped(pyr2, fields2[k], row, col, filter2, &acc[0], &color2[0]);
+          for (int c = 0; c < nc; ++c)
+            sum[c] += (1 - times[k]) * color1[c] + times[k] * color2[c];
+        }
+
+        // Round down like the unblurred blend, so blurred frames match the brightness of the others
+        for (int c = 0; c < nc; ++c)
+          pix[c] = (unsigned char)std::min(std::max(std::floor(sum[c] / num_times), 0.0), 255.0);
+      }
+    }
+  });
+
+  return result;
+}
+
+/**
+ * Average several images as in averageTiles(), writing the \a w x \a h result straight to a Deep Zoom pyramid at \a out_path
+ * as its tiles are rendered, so the full-resolution image is never held in memory.
+ */
+bool
+averageToDeepZoom(std::vector<MipPyramid const *> const & pyramids,
+                  std::vector< std::vector<LineSegment> > const & segs,
+                  std::vector<double> const & weights,
+                  WarpParams const & params,
+                  SampleFilter filter,
+                  int w, int h,
+                  std::string const & out_path)
+{
+  DeepZoomWriter writer;
+  if (!writer.open(out_path, w, h, pyramids[0]->level(0).numChannels()))
+    return false;
+
+  std::cout << "Rendering a " << w << 'x' << h << " deep zoom pyramid to " << out_path << "..." << std::endl;
+  averageTiles(pyramids, segs, weights, params, filter, w, h, writer.tileSize(), [&](int col, int row, Image const & tile)
+  {
+    writer.putTile(col, row, tile);
+  });
+
+  return writer.close();
+}
+
+/**
+ * Morph img1 into img2 as in morphImages(), writing the result straight to a Deep Zoom pyramid at \a out_path as its tiles are
+ * rendered. The tiles come from the same graph as morphImages() renders, so the base level matches its output exactly.
+ */
+bool
+morphToDeepZoom(Image const & img1,
+                Image const & img2,
+                std::vector<LineSegment> const & seg1,
+                std::vector<LineSegment> const & seg2,
+                double t,
+                WarpParams const & params,
+                SampleFilter filter,
+                int out_w, int out_h,
+                std::string const & out_path)
+{
+  ImageGraph graph;
+  int result = addMorph(graph, img1, img2, seg1, seg2, t, params, filter, out_w, out_h, OutputAdjust());
+
+  DeepZoomWriter writer;
+  int w = graph.width(result), h = graph.height(result);
+  if (!writer.open(out_path, w, h, graph.numChannels(result)))
+    return false;
+
+  std::cout << "Rendering a " << w << 'x' << h << " deep zoom pyramid to " << out_path << "..." << std::endl;
+  graph.render(result, writer.tileSize(), [&](int col, int row, Image const & tile)
+  {
+    writer.putTile(col, row, tile);
+  });
+
+  return writer.close();
+}
+
+/**
+ * Morph img1 into img2 as in morphImages(), but with motion blur over an exposure of \a dt around time \a t, while the segments
+ * move linearly from seg1 to seg2.
+ */
+Image
+morphImagesBlurred(Image const & img1,
+                   Image const & img2,
+                   std::vector<LineSegment> const & seg1,
+                   std::vector<LineSegment> const & seg2,
+                   double t, double dt, MotionBlur const & blur,
+                   WarpParams const & params,
+                   SampleFilter filter = FILTER_BILINEAR,
+                   int out_w = 0, int out_h = 0)
+{
+  MorphGrids grids = morphGrids(img1, img2, out_w, out_h);
+  std::vector<LineSegment> seg2_warp = transformSegments(seg2, grids.source2.inverse());
+  MipPyramid pyr1(img1, mipLevelsFor(img1, grids.w, grids.h, filter));
+  MipPyramid pyr2(img2, mipLevelsFor(img2, grids.w, grids.h, filter));
+
+  std::vector<double> times = blur.subframeTimes(t, dt);
+  std::vector< std::vector<LineSegment> > segs_at(times.size(), std::vector<LineSegment>(seg1.size()));
+  for (size_t k = 0; k < times.size(); ++k)
+    for (size_t i = 0; i < seg1.size(); ++i)
+      segs_at[k][i] = seg1[i].lerp(seg2_warp[i], times[k]);
+
+  return morphSubframes(pyr1, pyr2, grids, seg1, seg2_warp, times, segs_at, params, filter);
+}
+
+/** What a masked morph shows outside the mask. */
+enum MaskOutside
+{
+  OUTSIDE_BLEND,   ///< A cross-dissolve of the unwarped images
+  OUTSIDE_FIRST,   ///< The first image
+  OUTSIDE_SECOND   ///< The second image
+};
+
+/**
+ * Morph img1 into img2 as in morphImages(), but only within a region of the output given by \a mask, which must have the
+ * output's dimensions. The displacements of both warps are scaled by the mask's coverage, so the warp fades out over the
+ * mask's feather band, and the blend weight fades from t to what \a outside specifies. Warps are only computed in tiles that
+ * the mask covers at all, in parallel, so their cost scales with the area of the mask rather than that of the output; the
+ * rest is copied or blended.
+ */
+Image
+morphImagesMasked(Image const & img1,
+                  Image const & img2,
+                  std::vector<LineSegment> const & seg1,
+                  std::vector<LineSegment> const & seg2,
+                  double t,
+                  WarpParams const & params,
+                  MorphMask const & mask,
+                  MaskOutside outside = OUTSIDE_BLEND,
+                  SampleFilter filter = FILTER_BILINEAR,
+                  int out_w = 0, int out_h = 0)
+{
+  MorphGrids grids = morphGrids(img1, img2, out_w, out_h);
+  assert(mask.width() == grids.w && mask.height() == grids.h);
+
+  std::vector<LineSegment> seg2_warp = transformSegments(seg2, grids.source2.inverse());
+
+  int w = grids.w;
+  int h = grids.h;
+  WarpField field1(w, h), field2(w, h);
+  field1.setGridTransform(grids.grid);
+  field2.setGridTransform(grids.grid);
+  field2.setSourceTransform(grids.source2);
+
+  int const tile_size = 32;
+  std::vector<int> covered;
+  int tiles_x = (w + tile_size - 1) / tile_size;
+  int tiles_y = (h + tile_size - 1) / tile_size;
+  for (int tile = 0; tile < tiles_x * tiles_y; ++tile)
+  {
+    int col0 = (tile % tiles_x) * tile_size, row0 = (tile / tiles_x) * tile_size;
+    if (mask.anyCovered(col0, row0, min(col0 + tile_size, w), min(row0 + tile_size, h)))
+      covered.push_back(tile);
+  }
+
+  std::cout << "Distorting " << covered.size() << " of " << tiles_x * tiles_y << " tiles inside the mask..." << std::endl;
+  Vec2 lo = field1.gridLocation(0, 0), hi = field1.gridLocation(h - 1, w - 1);
+  PreparedWarp warp1(seg1, seg2_warp, t, params, lo, hi);
+  PreparedWarp warp2(seg2_warp, seg1, 1-t, params, lo, hi);
+  parallelFor(0, (int)covered.size(), [&](int i)
+  {
+    int col0 = (covered[i] % tiles_x) * tile_size, row0 = (covered[i] / tiles_x) * tile_size;
+    int col1 = min(col0 + tile_size, w), row1 = min(row0 + tile_size, h);
+    computeWarpField(field1, col0, row0, col1, row1, warp1);
+    computeWarpField(field2, col0, row0, col1, row1, warp2);
+
+    for (int row = row0; row < row1; ++row)
+      for (int col = col0; col < col1; ++col)
+      {
+        double alpha = mask.at(row, col);
+        if (alpha < 1)
+        {
+          field1.setDisplacement(row, col, alpha * field1.displacement(row, col));
+          field2.setDisplacement(row, col, alpha * field2.displacement(row, col));
+        }
+      }
+  });
+
+  MipPyramid pyr1(img1, mipLevelsFor(img1, w, h, filter));
+  MipPyramid pyr2(img2, mipLevelsFor(img2, w, h, filter));
+  SampleFilter filter1 = effectiveFilter(field1, filter);
+  SampleFilter filter2 = effectiveFilter(field2, filter);
+  double t_outside = (outside == OUTSIDE_FIRST ? 0 : outside == OUTSIDE_SECOND ? 1 : t);
+
+  std::cout << "Blending images..." << std::endl;
+  int nc = img1.numChannels();
+  Image result(w, h, nc);
+  parallelFor(0, h, [&](int row)
+  {
+    std::vector<double> acc(nc);
+    std::vector<unsigned char> color1(nc), color2(nc);
+    unsigned char * pix = result.scanline(row);
+    for (int col = 0; col < w; ++col, pix += nc)
+    {
+      double alpha = mask.at(row, col);
+      double t_pix = alpha * t + (1 - alpha) * t_outside;
+      if (t_pix < 1)
+        sampleWarped(pyr1, field1, row, col, filter1, &acc[0], &color1[0]);
+
+      if (t_pix > 0)
+        sampleWarped(pyr2, field2, row, col, filter2, &acc[0], &color2[0]);
+
+      for (int c = 0; c < nc; ++c)
+      {
+        double z = (t_pix < 1 ? color1[c] * (1 - t_pix) : 0) + (t_pix > 0 ? color2[c] * t_pix : 0);
+        pix[c] = (unsigned char)floor(z);
+      }
+    }
+  });
+
+  return result;
+}
+
+/** The warp fields of both images at one frame of a sequence. */
+struct FrameFields
+{
+  WarpField field1, field2;
+  std::shared_ptr<PreparedWarp> warp1, warp2;  ///< Warps of the frame, prepared once for all of its tiles
+};
+
+/**
+ * The motion of segments through a transition of a chain of morphs, along uniform Catmull-Rom splines through their positions
+ * in the images of the chain. The spline passes through the segments of both images of the transition, and its tangents there
+ * come from the segments in the images before and after.
+ */
+struct SegmentTrack
+{
+  std::vector<LineSegment> keys[4];  ///< Segments before, at the start of, at the end of and after the transition
+
+  /** Get the segments at time \a t in [0, 1] through the transition. */
+  std::vector<LineSegment> at(double t) const
+  {
+    double t2 = t * t, t3 = t2 * t;
+    double c0 = 0.5 * (-t3 + 2 * t2 - t);
+    double c1 = 0.5 * (3 * t3 - 5 * t2 + 2);
+    double c2 = 0.5 * (-3 * t3 + 4 * t2 + t);
+    double c3 = 0.5 * (t3 - t2);
+
+    std::vector<LineSegment> segs(keys[1].size());
+    for (size_t i = 0; i < segs.size(); ++i)
+      segs[i] = LineSegment(c0 * keys[0][i].start() + c1 * keys[1][i].start() + c2 * keys[2][i].start()
+                          + c3 * keys[3][i].start(),
+                            c0 * keys[0][i].end() + c1 * keys[1][i].end() + c2 * keys[2][i].end() + c3 * keys[3][i].end());
+
+    return segs;
+  }
+};
+
+/** Everything needed to render the frames of a morph sequence. */
+struct MorphSequence
+{
+  MipPyramid const * pyr1;  ///< Pyramids of both images, built once for the whole sequence
+  MipPyramid const * pyr2;
+  SampleFilter filter;
+  std::vector<LineSegment> const * seg1;
+  std::vector<LineSegment> const * seg2;  ///< Segments of img2, in warp coordinates
+  SegmentTrack const * track;             ///< Spline motion of the segments in warp coordinates, or NULL to move them linearly
+  MorphGrids grids;         ///< Grids of the output frames and both images
+  WarpParams params;
+  MotionBlur blur;
+  int num_frames;
+  double tolerance;         ///< Largest allowed deviation (in pixels) of an interpolated warp field from the exact one
+  int tile_size;            ///< Side of the square tiles whose fields are refined independently
+  std::string out_path;
+  int first_frame;          ///< Number of the first frame in the names of the saved frames
+  bool render_first;        ///< Render the first frame, which may already have been rendered as the end of another sequence
+  long num_exact_tiles;     ///< Number of (frame, tile) pairs whose warp fields were computed exactly
+  int num_failed;           ///< Number of frames that could not be saved
+
+  /** Get the time of a frame. */
+  double frameTime(int frame) const { return num_frames > 1 ? frame / (double)(num_frames - 1) : 0.0; }
+
+  /** Get the time between frames. */
+  double frameInterval() const { return num_frames > 1 ? 1.0 / (num_frames - 1) : 0.0; }
+
+  /** Create zero warp fields for a frame. */
+  FrameFields newFrameFields() const
+  {
+    FrameFields fields;
+    fields.field1 = WarpField(grids.w, grids.h);
+    fields.field1.setGridTransform(grids.grid);
+    fields.field2 = WarpField(grids.w, grids.h);
+    fields.field2.setGridTransform(grids.grid);
+    fields.field2.setSourceTransform(grids.source2);
+    return fields;
+  }
+};
+
+/**
+ * Get the path of a frame of a sequence, by inserting the zero-padded frame number before the extension of \a out_path, e.g.
+ * "out.png" becomes "out0007.png".
+ */
+std::string
+framePath(std::string const & out_path, int frame)
+{
+  std::string::size_type dot = out_path.find_last_of('.');
+  std::string::size_type slash = out_path.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = out_path.length();
+
+  std::ostringstream path;
+  path << out_path.substr(0, dot);
+  path.width(4);
+  path.fill('0');
+  path << frame << out_path.substr(dot);
+
+  return path.str();
+}
+
+/** Prepare the warps of both images at a frame of a sequence, for computing the tiles of its fields exactly. */
+void
+prepareFrame(MorphSequence const & seq, FrameFields & fields, int frame)
+{
+  double t = seq.frameTime(frame);
+  Vec2 lo = fields.field1.gridLocation(0, 0);
+  Vec2 hi = fields.field1.gridLocation(fields.field1.height() - 1, fields.field1.width() - 1);
+  if (seq.track)
+  {
+    // Warp both images all the way to where the segments are at this time
+    std::vector<LineSegment> segs = seq.track->at(t);
+    fields.warp1 = std::make_shared<PreparedWarp>(*seq.seg1, segs, 1, seq.params, lo, hi);
+    fields.warp2 = std::make_shared<PreparedWarp>(*seq.seg2, segs, 1, seq.params, lo, hi);
+  }
+  else
+  {
+    fields.warp1 = std::make_shared<PreparedWarp>(*seq.seg1, *seq.seg2, t, seq.params, lo, hi);
+    fields.warp2 = std::make_shared<PreparedWarp>(*seq.seg2, *seq.seg1, 1-t, seq.params, lo, hi);
+  }
+}
+
+/**
+ * Compute the exact warp fields of both images in a tile of a frame of a sequence, whose warps are prepared. Different tiles of
+ * the same fields may be computed in parallel.
+ */
+void
+computeExactTile(FrameFields & fields, int col0, int row0, int col1, int row1)
+{
+  computeWarpField(fields.field1, col0, row0, col1, row1, *fields.warp1);
+  computeWarpField(fields.field2, col0, row0, col1, row1, *fields.warp2);
+}
+
+/** Compute the exact warp fields of both images at a frame of a sequence, tile by tile in parallel. */
+FrameFields
+computeExactFrame(MorphSequence & seq, int frame)
+{
+  int w = seq.grids.w;
+  int h = seq.grids.h;
+  int tiles_x = (w + seq.tile_size - 1) / seq.tile_size;
+  int tiles_y = (h + seq.tile_size - 1) / seq.tile_size;
+
+  FrameFields fields = seq.newFrameFields();
+  prepareFrame(seq, fields, frame);
+  parallelFor(0, tiles_x * tiles_y, [&](int tile)
+  {
+    int col0 = (tile % tiles_x) * seq.tile_size, row0 = (tile / tiles_x) * seq.tile_size;
+    computeExactTile(fields, col0, row0, std::min(col0 + seq.tile_size, w), std::min(row0 + seq.tile_size, h));
+  });
+
+  seq.num_exact_tiles += (long)tiles_x * tiles_y;
+  return fields;
+}
+
+/**
+ * Fill in a tile of the frames strictly between frames f0 and f1 of a window of frames starting at frame \a base, whose tiles
+ * at f0 and f1 are already known. The tile is computed exactly at the midpoint frame and compared against the interpolation of
+ * f0 and f1: if they deviate by more than the tolerance, both halves are refined recursively, else the remaining frames are
+ * interpolated. Different tiles may be refined in parallel. Returns the number of frames whose tile was computed exactly.
+ */
+long
+refineTile(MorphSequence const & seq, std::vector<FrameFields> & window, int base, int f0, int f1,
+           int col0, int row0, int col1, int row1)
+{
+  if (f1 - f0 <= 1)
+    return 0;
+
+  int mid = (f0 + f1) / 2;
+  FrameFields const & k0 = window[f0 - base];
+  FrameFields const & k1 = window[f1 - base];
+  FrameFields & km = window[mid - base];
+  computeExactTile(km, col0, row0, col1, row1);
+
+  double alpha = (mid - f0) / (double)(f1 - f0);
+  double error = std::max(km.field1.maxLerpDifference(k0.field1, k1.field1, alpha, col0, row0, col1, row1),
+                          km.field2.maxLerpDifference(k0.field2, k1.field2, alpha, col0, row0, col1, row1));
+
+  if (error > seq.tolerance)
+    return 1 + refineTile(seq, window, base, f0, mid, col0, row0, col1, row1)
+             + refineTile(seq, window, base, mid, f1, col0, row0, col1, row1);
+  else
+  {
+    for (int frame = f0 + 1; frame < f1; ++frame)
+    {
+      if (frame == mid)
+        continue;
+
+      FrameFields const & lo = window[(frame < mid ? f0 : mid) - base];
+      FrameFields const & hi = window[(frame < mid ? mid : f1) - base];
+      double beta = (frame < mid ? (frame - f0) / (double)(mid - f0) : (frame - mid) / (double)(f1 - mid));
+      window[frame - base].field1.setLerp(lo.field1, hi.field1, beta, col0, row0, col1, row1);
+      window[frame - base].field2.setLerp(lo.field2, hi.field2, beta, col0, row0, col1, row1);
+    }
+
+    return 1;
+  }
+}
+
+/** Render and save a frame of a sequence with motion blur, computing the warps of all its sub-frames exactly. */
+void
+renderBlurredFrame(MorphSequence & seq, int frame)
+{
+  std::string path = framePath(seq.out_path, seq.first_frame + frame);
+  std::cout << "Rendering frame " << seq.first_frame + frame << " (t = " << seq.frameTime(frame) << ", " << seq.blur.samples
+            << " sub-frames) to " << path << std::endl;
+
+  std::vector<double> times = seq.blur.subframeTimes(seq.frameTime(frame), seq.frameInterval());
+  std::vector< std::vector<LineSegment> > segs_at(times.size());
+  for (size_t k = 0; k < times.size(); ++k)
+  {
+    if (seq.track)
+      segs_at[k] = seq.track->at(times[k]);
+    else
+    {
+      segs_at[k].resize(seq.seg1->size());
+      for (size_t i = 0; i < seq.seg1->size(); ++i)
+        segs_at[k][i] = (*seq.seg1)[i].lerp((*seq.seg2)[i], times[k]);
+    }
+  }
+
+  Image morphed = morphSubframes(*seq.pyr1, *seq.pyr2, seq.grids, *seq.seg1, *seq.seg2, times, segs_at, seq.params,
+                                 seq.filter);
+  if (!morphed.save(path))
+    seq.num_failed++;
+}
+
+/** Render and save a frame of a sequence from its warp fields. */
+void
+renderFrame(MorphSequence & seq, int frame, FrameFields const & fields)
+{
+  std::string path = framePath(seq.out_path, seq.first_frame + frame);
+  std::cout << "Rendering frame " << seq.first_frame + frame << " (t = " << seq.frameTime(frame) << ") to " << path
+            << std::endl;
+
+  Image morphed = morphWithFields(*seq.pyr1, *seq.pyr2, fields.field1, fields.field2, seq.frameTime(frame), seq.filter);
+  if (!morphed.save(path))
+    seq.num_failed++;
+}
+
+/** Set up a sequence morphing between two images with given pyramids, rendering its frames to framePath(out_path, i). */
+MorphSequence
+newSequence(MipPyramid const & pyr1, MipPyramid const & pyr2, int num_frames, double tolerance, std::string const & out_path,
+            WarpParams const & params, MotionBlur const & blur, SampleFilter filter, int out_w, int out_h)
+{
+  MorphSequence seq;
+  seq.grids = morphGrids(pyr1.level(0), pyr2.level(0), out_w, out_h);
+  seq.pyr1 = &pyr1;
+  seq.pyr2 = &pyr2;
+  seq.filter = filter;
+  seq.seg1 = NULL;
+  seq.seg2 = NULL;
+  seq.track = NULL;
+  seq.params = params;
+  seq.blur = blur;
+  seq.num_frames = num_frames;
+  seq.tolerance = tolerance;
+  seq.tile_size = 32;
+  seq.out_path = out_path;
+  seq.first_frame = 0;
+  seq.render_first = true;
+  seq.num_exact_tiles = 0;
+  seq.num_failed = 0;
+
+  return seq;
+}
+
+/** Get the number of (frame, tile) pairs in a sequence. */
+long
+numTiles(MorphSequence const & seq)
+{
+  long tiles_per_frame = (long)((seq.grids.w + seq.tile_size - 1) / seq.tile_size)
+                       * ((seq.grids.h + seq.tile_size - 1) / seq.tile_size);
+  return tiles_per_frame * seq.num_frames;
+}
+
+/**
+ * Render the frames of a sequence. Exact warp fields are only computed at keyframes, which are at most \a keyframe_spacing
+ * frames apart. In between, each tile of the fields is interpolated from the neighbouring keyframes, and gets more keyframes
+ * wherever the interpolation deviates from the exact fields by more than the sequence's tolerance.
+ */
+void
+renderSequence(MorphSequence & seq, int keyframe_spacing)
+{
+  assert(seq.num_frames > 0 && keyframe_spacing > 0);
+
+  int w = seq.grids.w;
+  int h = seq.grids.h;
+  int num_frames = seq.num_frames;
+  int tiles_x = (w + seq.tile_size - 1) / seq.tile_size;
+  int tiles_y = (h + seq.tile_size - 1) / seq.tile_size;
+
+  // Blurred frames are rendered straight from their sub-frames, whose warps cannot be shared with other frames
+  if (seq.blur.samples > 1)
+  {
+    for (int frame = (seq.render_first ? 0 : 1); frame < num_frames; ++frame)
+      renderBlurredFrame(seq, frame);
+
+    seq.num_exact_tiles = numTiles(seq);
+    return;
+  }
+
+  // The window holds the fields of all frames from one top-level keyframe to the next
+  std::vector<FrameFields> window(1);
+  window[0] = computeExactFrame(seq, 0);
+  if (seq.render_first)
+    renderFrame(seq, 0, window[0]);
+
+  int base = 0;
+  while (base < num_frames - 1)
+  {
+    int next = std::min(base + keyframe_spacing, num_frames - 1);
+
+    window.resize(next - base + 1);
+    for (int frame = base + 1; frame < next; ++frame)
+    {
+      window[frame - base] = seq.newFrameFields();
+      prepareFrame(seq, window[frame - base], frame);
+    }
+    window.back() = computeExactFrame(seq, next);
+
+    // Tiles are refined independently, so they are refined in parallel, each counting its exactly computed frames
+    std::vector<long> num_exact(tiles_x * tiles_y);
+    parallelFor(0, tiles_x * tiles_y, [&](int tile)
+    {
+      int col0 = (tile % tiles_x) * seq.tile_size, row0 = (tile / tiles_x) * seq.tile_size;
+      num_exact[tile] = refineTile(seq, window, base, base, next, col0, row0,
+                                   std::min(col0 + seq.tile_size, w), std::min(row0 + seq.tile_size, h));
+    });
+
+    for (size_t i = 0; i < num_exact.size(); ++i)
+      seq.num_exact_tiles += num_exact[i];
+
+    for (int frame = base + 1; frame <= next; ++frame)
+      renderFrame(seq, frame, window[frame - base]);
+
+    std::swap(window.front(), window.back());
+    window.resize(1);
+    base = next;
+  }
+}
+
+/**
+ * Render a sequence of \a num_frames frames morphing img1 into img2, with t running uniformly from 0 to 1, and save them to
+ * framePath(out_path, i). As in morphImages, the images may have different dimensions, and the frames are \a out_w x
+ * \a out_h, or have the dimensions of img1 if either is zero. Warp fields are computed exactly at keyframes at most
+ * \a keyframe_spacing frames apart and interpolated in between to within \a tolerance pixels, see renderSequence().
+ * Returns the fraction of the fields that was computed exactly, or a negative value if some frame could not be saved.
+ */
+double
+morphSequence(Image const & img1,
+              Image const & img2,
+              std::vector<LineSegment> const & seg1,
+              std::vector<LineSegment> const & seg2,
+              int num_frames, int keyframe_spacing, double tolerance,
+              std::string const & out_path,
+              WarpParams const & params,
+              SampleFilter filter = FILTER_BILINEAR,
+              int out_w = 0, int out_h = 0,
+              MotionBlur const & blur = MotionBlur())
+{
+  MorphGrids grids = morphGrids(img1, img2, out_w, out_h);
+  MipPyramid pyr1(img1, mipLevelsFor(img1, grids.w, grids.h, filter));
+  MipPyramid pyr2(img2, mipLevelsFor(img2, grids.w, grids.h, filter));
+
+  MorphSequence seq = newSequence(pyr1, pyr2, num_frames, tolerance, out_path, params, blur, filter, out_w, out_h);
+  std::vector<LineSegment> seg2_warp = transformSegments(seg2, seq.grids.source2.inverse());
+  seq.seg1 = &seg1;
+  seq.seg2 = &seg2_warp;
+
+  renderSequence(seq, keyframe_spacing);
+
+  return seq.num_failed > 0 ? -1 : seq.num_exact_tiles / (double)numTiles(seq);
+}
+
+/**
+ * Check if the segments of a chain of morphs form tracks, i.e. every transition has the same number of segments, and the
+ * segments ending one transition are within \a max_offset pixels of those starting the next one. \a segs1[i] and \a segs2[i]
+ * are the segments of transition i in its first and second image respectively.
+ */
+bool
+formTracks(std::vector< std::vector<LineSegment> > const & segs1, std::vector< std::vector<LineSegment> > const & segs2,
+           double max_offset)
+{
+  for (size_t i = 1; i < segs1.size(); ++i)
+  {
+    if (segs1[i].size() != segs1[0].size())
+      return false;
+
+    for (size_t j = 0; j < segs1[i].size(); ++j)
+      if ((segs1[i][j].start() - segs2[i - 1][j].start()).length() > max_offset
+       || (segs1[i][j].end() - segs2[i - 1][j].end()).length() > max_offset)
+        return false;
+  }
+
+  return true;
+}
+
+/**
+ * Render a chain of morphs through the images at \a image_paths, in order, with \a num_frames frames per transition, and
+ * save them to framePath(out_path, i). Consecutive transitions share their end and start frame, so the chain has
+ * (num_frames - 1) per transition plus one frame in all. \a segs1[i] and \a segs2[i] are the segments between images i
+ * and i + 1, in the pixel coordinates of each. Every image is decoded once, and kept with its pyramid for both transitions
+ * it is part of. The output frames are \a out_w x \a out_h, or have the dimensions of the first image if either is zero.
+ * If \a spline is true and the segments form tracks through the chain (see formTracks()), they move along splines through
+ * the images rather than linearly in each transition, so that their motion is smooth across images. Returns the fraction
+ * of the warp fields that was computed exactly, or a negative value on failure.
+ */
+double
+morphChain(std::vector<std::string> const & image_paths,
+           std::vector< std::vector<LineSegment> > const & segs1,
+           std::vector< std::vector<LineSegment> > const & segs2,
+           int num_frames, int keyframe_spacing, double tolerance,
+           std::string const & out_path,
+           WarpParams const & params,
+           SampleFilter filter = FILTER_BILINEAR,
+           int out_w = 0, int out_h = 0,
+           bool spline = false,
+           MotionBlur const & blur = MotionBlur())
+{
+  int num_images = (int)image_paths.size();
+  assert(num_images >= 2 && (int)segs1.size() == num_images - 1 && segs2.size() == segs1.size());
+  assert(num_frames >= 2);
+
+  // Image dimensions are needed up front to bring neighbouring segments onto the grid of each transition
+  std::vector<int> widths(num_images), heights(num_images);
+  for (int i = 0; i < num_images; ++i)
+  {
+    int nc;
+    if (!Image::readInfo(image_paths[i], widths[i], heights[i], nc))
+      return -1;
+  }
+
+  if (out_w <= 0 || out_h <= 0)
+  {
+    out_w = widths[0];
+    out_h = heights[0];
+  }
+
+  if (spline && !formTracks(segs1, segs2, 1.0))
+  {
+    std::cout << "Segments of consecutive transitions do not line up: moving them linearly in each transition" << std::endl;
+    spline = false;
+  }
+
+  // Only the two images of the current transition are held, each in the slot given by the parity of its index
+  Image images[2];
+  MipPyramid pyramids[2];
+  for (int i = 0; i < 2; ++i)
+  {
+    if (!images[i].load(image_paths[i], 4))
+      return -1;
+
+    pyramids[i] = MipPyramid(images[i], mipLevelsFor(images[i], out_w, out_h, filter));
+  }
+
+  long num_exact_tiles = 0, num_tiles = 0;
+  for (int k = 0; k < num_images - 1; ++k)
+  {
+    if (k > 0)
+    {
+      int slot = (k + 1) % 2;
+      if (!images[slot].load(image_paths[k + 1], 4))
+        return -1;
+
+      pyramids[slot] = MipPyramid(images[slot], mipLevelsFor(images[slot], out_w, out_h, filter));
+    }
+
+    std::cout << "Transition " << k + 1 << " of " << num_images - 1 << ": morphing " << image_paths[k] << " into "
+              << image_paths[k + 1] << std::endl;
+
+    MorphSequence seq = newSequence(pyramids[k % 2], pyramids[(k + 1) % 2], num_frames, tolerance, out_path, params, blur,
+                                    filter, out_w, out_h);
+    seq.first_frame = k * (num_frames - 1);
+    seq.render_first = (k == 0);
+
+    std::vector<LineSegment> seg2_warp = transformSegments(segs2[k], seq.grids.source2.inverse());
+    seq.seg1 = &segs1[k];
+    seq.seg2 = &seg2_warp;
+
+    SegmentTrack track;
+    if (spline)
+    {
+      // Keys in the pixel coordinates of the images before, at both ends of and after the transition, clamped to the chain
+      int prev = std::max(k - 1, 0), next = std::min(k + 2, num_images - 1);
+      track.keys[0] = transformSegments(segs1[prev],
+                                        GridTransform::betweenGrids(widths[prev], heights[prev], widths[k], heights[k]));
+      track.keys[1] = segs1[k];
+      track.keys[2] = seg2_warp;
+      track.keys[3] = transformSegments(segs2[next - 1],
+                                        GridTransform::betweenGrids(widths[next], heights[next], widths[k], heights[k]));
+      seq.track = &track;
+    }
+
+    renderSequence(seq, keyframe_spacing);
+    if (seq.num_failed > 0)
+      return -1;
+
+    num_exact_tiles += seq.num_exact_tiles;
+    num_tiles += numTiles(seq);
+  }
+
+  return num_exact_tiles / (double)num_tiles;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//  Driver functions follow. These should not be modified.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/** What to do with the segments after loading them. */
+struct SegmentPrep
+{
+  bool simplify;                      ///< Simplify the segments before morphing
+  SegmentSimplifier::Options options; ///< How to simplify them
+  std::string save_path;              ///< Where to save the segments that are used, or empty
+  bool float64;                       ///< Save binary segment files in double precision
+  int proxy;                          ///< Load the images at 1/proxy scale (1, 2, 4 or 8), scaling the segments to match
+
+  /** Default constructor: use the images and segments as they are. */
+  SegmentPrep() : simplify(false), float64(false), proxy(1) {}
+};
+
+/**
+ * Simplify segments per \a prep, reporting the reduction, and save them if requested. seg1 and seg2 are in the pixel
+ * coordinates of img1 and img2 respectively. If \a weights is non-null, the segments have per-pair weights, which the warp
+ * does not use but which are saved with them. Simplification merges and drops pairs, so weighted segments cannot be saved
+ * after it.
+ */
+bool
+prepareSegments(Image const & img1, Image const & img2, WarpParams const & params, SegmentPrep const & prep,
+                std::vector<LineSegment> & seg1, std::vector<LineSegment> & seg2, std::vector<double> const * weights = NULL)
+{
+  if (weights && prep.simplify && !prep.save_path.empty())
+  {
+    std::cerr << "Cannot save simplified segments with per-segment weights to " << prep.save_path
+              << ": simplification does not keep the weights" << std::endl;
+    return false;
+  }
+
+  if (prep.simplify && !seg1.empty())
+  {
+    // Compare fields on the pixel grid of img1, where the warp is computed
+    GridTransform source2 = GridTransform::betweenGrids(img1.width(), img1.height(), img2.width(), img2.height());
+    SegmentSimplifier simplifier(seg1, transformSegments(seg2, source2.inverse()), img1.width(), img1.height(), params,
+                                 prep.options);
+    int num_merged = simplifier.mergeCollinear();
+    int num_pruned = simplifier.prune();
+
+    std::cout << "Simplified " << seg1.size() << " segments to " << simplifier.segments1().size() << " (" << num_merged
+              << " collinear merges, " << num_pruned << " pruned), changing the warp by at most " << simplifier.maxChange()
+              << " pixels" << std::endl;
+
+    seg1 = simplifier.segments1();
+    seg2 = transformSegments(simplifier.segments2(), source2);
+  }
+
+  if (!prep.save_path.empty())
+  {
+    SegmentFormat format = segmentFormatForPath(prep.save_path);
+    if (format == SEGMENTS_BINARY32 && prep.float64)
+      format = SEGMENTS_BINARY64;
+
+    if (!saveSegments(prep.save_path, seg1, seg2, format, weights))
+      return false;
+
+    std::cout << "Saved " << seg1.size() << " segments to " << prep.save_path << std::endl;
+  }
+
+  return true;
+}
+
+/** Load both input images and the segments between them, reporting what was read, and prepare the segments per \a prep. */
+bool
+loadInputs(std::string const & img1_path, std::string const & img2_path, std::string const & seg_path,
+           WarpParams const & params, SegmentPrep const & prep, Image & img1, Image & img2,
+           std::vector<LineSegment> & seg1, std::vector<LineSegment> & seg2)
+{
+  // Proxies are scaled from the full-size images the segments are drawn on
+  int full_w1, full_h1, full_w2, full_h2, nc;
+  if (prep.proxy > 1)
+  {
+    if (!Image::readInfo(img1_path, full_w1, full_h1, nc) || !Image::readInfo(img2_path, full_w2, full_h2, nc))
+      return false;
+
+    std::cout << "Loading 1/" << prep.proxy << " scale proxies of the images" << std::endl;
+  }
+
+  // Load images, forcing both to 4-channel RGBA for compatibility
+  if (!img1.load(img1_path, 4, prep.proxy) || !img2.load(img2_path, 4, prep.proxy))
+    return false;
+
+  if (img1.hasSameDimsAs(img2))
+    std::cout << "Loaded two " << img1.width() << 'x' << img1.height() << ' ' << img1.numChannels() << "-channel images"
+              << std::endl;
+  else
+    std::cout << "Loaded " << img1.width() << 'x' << img1.height() << " and " << img2.width() << 'x' << img2.height() << ' '
+              << img1.numChannels() << "-channel images; " << img2_path << " will be resampled onto the grid of "
+              << img1_path << std::endl;
+
+  // Load segments
+  std::vector<double> weights;
+  if (!loadSegments(seg_path, seg1, seg2, &weights))
+    return false;
+
+  std::cout << "Read " << seg1.size() << " segments" << std::endl;
+  bool weighted = (std::count(weights.begin(), weights.end(), 1.0) != (long)weights.size());
+  if (weighted)
+    std::cout << "Per-segment weights in " << seg_path << " are not used by the warp"
+              << (prep.save_path.empty() ? " and will be ignored" : ", only saved with the segments") << std::endl;
+
+  if (prep.proxy > 1)
+  {
+    GridTransform to_proxy1 = GridTransform::betweenGrids(full_w1, full_h1, img1.width(), img1.height());
+    GridTransform to_proxy2 = GridTransform::betweenGrids(full_w2, full_h2, img2.width(), img2.height());
+    for (size_t i = 0; i < seg1.size(); ++i)
+    {
+      seg1[i] = LineSegment(to_proxy1.apply(seg1[i].start()), to_proxy1.apply(seg1[i].end()));
+      seg2[i] = LineSegment(to_proxy2.apply(seg2[i].start()), to_proxy2.apply(seg2[i].end()));
+    }
+  }
+
+  return prepareSegments(img1, img2, params, prep, seg1, seg2, weighted ? &weights : NULL);
+}
+
+/** An auxiliary layer to carry through the geometry of a morph. */
+struct LayerJob
+{
+  std::string path1;     ///< Layer aligned with image1, or empty
+  std::string path2;     ///< Layer aligned with image2, or empty
+  std::string out_path;  ///< Where to save the morphed layer
+};
+
+/** A mask restricting a single morph to a region of the output. */
+struct MaskJob
+{
+  std::string image_path;    ///< Mask image covering the extent of image1, or empty
+  std::string polygon_path;  ///< Polygon in the pixel coordinates of image1, or empty
+  double feather;            ///< Width of the band the morph fades out over, in output pixels
+  MaskOutside outside;       ///< What to show outside the mask
+
+  /** Default constructor: no mask. */
+  MaskJob() : feather(16), outside(OUTSIDE_BLEND) {}
+
+  /** Check if there is a mask. */
+  bool empty() const { return image_path.empty() && polygon_path.empty(); }
+};
+
+/** Build the mask of a morph on its output grid. */
+bool
+loadMask(MaskJob const & job, Image const & img1, Image const & img2, int out_w, int out_h, MorphMask & mask)
+{
+  MorphGrids grids = morphGrids(img1, img2, out_w, out_h);
+  if (!job.image_path.empty())
+  {
+    Image mask_image;
+    if (!mask_image.load(job.image_path))
+      return false;
+
+    mask.setImage(mask_image, grids.w, grids.h, job.feather);
+  }
+  else
+  {
+    std::vector<Vec2> vertices;
+    if (!MorphMask::loadPolygon(job.polygon_path, vertices))
+      return false;
+
+    mask.setPolygon(vertices, grids.grid, grids.w, grids.h, job.feather);
+  }
+
+  return true;
+}
+
+/** Load the auxiliary layers of a morph, preserving their channel counts, and check them against the main images. */
+bool
+loadLayers(std::vector<LayerJob> const & jobs, Image const & img1, Image const & img2, std::vector<Image> & storage,
+           std::vector<Image const *> & layers1, std::vector<Image const *> & layers2)
+{
+  storage.resize(2 * jobs.size());
+  layers1.assign(jobs.size(), NULL);
+  layers2.assign(jobs.size(), NULL);
+
+  for (size_t i = 0; i < jobs.size(); ++i)
+  {
+    std::string const * paths[2] = { &jobs[i].path1, &jobs[i].path2 };
+    std::vector<Image const *> * sides[2] = { &layers1, &layers2 };
+    Image const * aligned[2] = { &img1, &img2 };
+    for (int side = 0; side < 2; ++side)
+    {
+      if (paths[side]->empty())
+        continue;
+
+      Image & layer = storage[2 * i + side];
+      if (!layer.load(*paths[side]))
+        return false;
+
+      if (layer.width() != aligned[side]->width() || layer.height() != aligned[side]->height())
+      {
+        std::cerr << "Layer " << *paths[side] << " must have the dimensions of the input image it is aligned with"
+                  << std::endl;
+        return false;
+      }
+
+      (*sides[side])[i] = &layer;
+    }
+
+    if (layers1[i] && layers2[i] && layers1[i]->numChannels() != layers2[i]->numChannels())
+    {
+      std::cerr << "Layers " << jobs[i].path1 << " and " << jobs[i].path2 << " must have the same number of channels"
+                << std::endl;
+      return false;
+    }
+  }
+
+  if (!jobs.empty())
+    std::cout << "Loaded " << jobs.size() << " auxiliary layers" << std::endl;
+
+  return true;
+}
+
+bool
+morphDriver(std::string const & img1_path, std::string const & img2_path, std::string const & seg_path, double t,
+            std::string const & out_path, std::vector<LayerJob> const & layer_jobs, MaskJob const & mask_job,
+            WarpParams const & params, SegmentPrep const & prep, SampleFilter filter, int out_w, int out_h,
+            OutputAdjust const & adjust)
+{
+  Image img1, img2;
+  std::vector<LineSegment> seg1, seg2;
+  if (!loadInputs(img1_path, img2_path, seg_path, params, prep, img1, img2, seg1, seg2))
+    return false;
+
+  if (!mask_job.empty())
+  {
+    MorphMask mask;
+    if (!loadMask(mask_job, img1, img2, out_w, out_h, mask))
+      return false;
+
+    Image morphed = morphImagesMasked(img1, img2, seg1, seg2, t, params, mask, mask_job.outside, filter, out_w, out_h);
+    return morphed.save(out_path);
+  }
+
+  if (DeepZoomWriter::isDeepZoomPath(out_path))
+    return morphToDeepZoom(img1, img2, seg1, seg2, t, params, filter, out_w, out_h, out_path);
+
+  if (layer_jobs.empty())
+  {
+    MorphGrids grids = morphGrids(img1, img2, out_w, out_h);
+    if (!adjust.fitsIn(grids.w, grids.h))
+    {
+      std::cerr << "Crop " << adjust.crop_w << "x" << adjust.crop_h << "+" << adjust.crop_x << "+" << adjust.crop_y
+                << " does not fit in the " << grids.w << "x" << grids.h << " output" << std::endl;
+      return false;
+    }
+
+    Image morphed = morphImages(img1, img2, seg1, seg2, t, params, filter, out_w, out_h, adjust);
+    if (!morphed.save(out_path))
+      return false;
+
+    return true;
+  }
+
+  std::vector<Image> storage;
+  std::vector<Image const *> layers1, layers2;
+  if (!loadLayers(layer_jobs, img1, img2, storage, layers1, layers2))
+    return false;
+
+  std::vector<Image> morphed = morphImagesWithLayers(img1, img2, layers1, layers2, seg1, seg2, t, params,
+                                                     filter, out_w, out_h);
+
+  bool ok = morphed[0].save(out_path);
+  for (size_t i = 0; i < layer_jobs.size(); ++i)
+    ok = morphed[i + 1].save(layer_jobs[i].out_path) && ok;
+
+  return ok;
+}
+
+bool
+sequenceDriver(std::string const & img1_path, std::string const & img2_path, std::string const & seg_path, int num_frames,
+               int keyframe_spacing, double tolerance, std::string const & out_path, WarpParams const & params,
+               SegmentPrep const & prep, SampleFilter filter, int out_w, int out_h, MotionBlur const & blur)
+{
+  Image img1, img2;
+  std::vector<LineSegment> seg1, seg2;
+  if (!loadInputs(img1_path, img2_path, seg_path, params, prep, img1, img2, seg1, seg2))
+    return false;
+
+  double exact = morphSequence(img1, img2, seg1, seg2, num_frames, keyframe_spacing, tolerance, out_path, params,
+                               filter, out_w, out_h, blur);
+  if (exact < 0)
+    return false;
+
+  std::cout << "Rendered " << num_frames << " frames, computing " << 100 * exact << "% of the warp fields exactly"
+            << std::endl;
+
+  return true;
+}
+
+bool
+chainDriver(std::vector<std::string> const & inputs, int num_frames, int keyframe_spacing, double tolerance,
+            std::string const & out_path, WarpParams const & params, SampleFilter filter, int out_w, int out_h, bool spline,
+            MotionBlur const & blur)
+{
+  // Inputs alternate between images and the segments between them
+  std::vector<std::string> image_paths;
+  std::vector< std::vector<LineSegment> > segs1(inputs.size() / 2), segs2(inputs.size() / 2);
+  for (size_t i = 0; i < inputs.size(); ++i)
+  {
+    if (i % 2 == 0)
+    {
+      image_paths.push_back(inputs[i]);
+      continue;
+    }
+
+    if (!loadSegments(inputs[i], segs1[i / 2], segs2[i / 2]))
+      return false;
+
+    std::cout << "Read " << segs1[i / 2].size() << " segments from " << inputs[i] << std::endl;
+  }
+
+  double exact = morphChain(image_paths, segs1, segs2, num_frames, keyframe_spacing, tolerance, out_path, params, filter,
+                            out_w, out_h, spline, blur);
+  if (exact < 0)
+    return false;
+
+  std::cout << "Rendered " << (int)segs1.size() * (num_frames - 1) + 1 << " frames through " << image_paths.size()
+            << " images, computing " << 100 * exact << "% of the warp fields exactly" << std::endl;
+
+  return true;
+}
+
+bool
+averageDriver(std::vector<std::string> const & inputs, std::vector<double> weights, std::string const & out_path,
+              WarpParams const & params, SampleFilter filter, int out_w, int out_h)
+{
+  // Inputs are the first image, then each other image preceded by the segments between the first image and it
+  if (inputs.size() < 3 || inputs.size() % 2 != 1)
+  {
+    std::cerr << "Expected at least two images, each but the first preceded by a segments file" << std::endl;
+    return false;
+  }
+
+  size_t num_images = inputs.size() / 2 + 1;
+  std::vector<Image> images(num_images);
+  std::vector< std::vector<LineSegment> > segs(num_images);
+  for (size_t i = 0; i < num_images; ++i)
+    if (!images[i].load(inputs[i == 0 ? 0 : 2 * i], 4))
+      return false;
+
+  for (size_t i = 1; i < num_images; ++i)
+  {
+    std::vector<LineSegment> first;
+    if (!loadSegments(inputs[2 * i - 1], first, segs[i]))
+      return false;
+
+    std::cout << "Read " << segs[i].size() << " segments from " << inputs[2 * i - 1] << std::endl;
+    if (i == 1)
+      segs[0] = first;
+    else if (first.size() != segs[0].size())
+    {
+      std::cerr << "Expected " << segs[0].size() << " segments in " << inputs[2 * i - 1] << " to match those in " << inputs[1]
+                << std::endl;
+      return false;
+    }
+  }
+
+  if (weights.empty())
+    weights.assign(num_images, 1.0);
+
+  double weight_sum = 0;
+  for (size_t i = 0; i < num_images; ++i)
+  {
+    if (weights[i] < 0)
+    {
+      std::cerr << "Weights of averaged images must not be negative" << std::endl;
+      return false;
+    }
+
+    weight_sum += weights[i];
+  }
+
+  if (weight_sum <= 0)
+  {
+    std::cerr << "Weights of averaged images must not all be zero" << std::endl;
+    return false;
+  }
+
+  int w = (out_w > 0 && out_h > 0 ? out_w : images[0].width());
+  int h = (out_w > 0 && out_h > 0 ? out_h : images[0].height());
+  std::vector<MipPyramid> pyramids(num_images);
+  std::vector<MipPyramid const *> pyramid_ptrs(num_images);
+  for (size_t i = 0; i < num_images; ++i)
+  {
+    pyramids[i] = MipPyramid(images[i], mipLevelsFor(images[i], w, h, filter));
+    pyramid_ptrs[i] = &pyramids[i];
+  }
+
+  if (DeepZoomWriter::isDeepZoomPath(out_path))
+    return averageToDeepZoom(pyramid_ptrs, segs, weights, params, filter, w, h, out_path);
+
+  Image averaged = averageImages(pyramid_ptrs, segs, weights, params, filter, out_w, out_h);
+  return averaged.save(out_path);
+}
+
+/** A frame of a video morph, passed between the stages of the pipeline. */
+struct VideoFrame
+{
+  int index;
+  double t;
+  Image frame1, frame2;                      ///< Frames of both clips, as YUV
+  std::vector<LineSegment> seg1, seg2;       ///< Segments of the frame in the pixel coordinates of each clip
+  Image morphed;
+};
+
+bool
+videoDriver(std::string const & clip1_path, std::string const & clip2_path, std::string const & seg_path, int num_frames,
+            std::string const & out_path, WarpParams const & params, SampleFilter filter, int out_w, int out_h,
+            MotionBlur const & blur)
+{
+  Y4MReader reader1, reader2;
+  if (!reader1.open(clip1_path) || !reader2.open(clip2_path))
+    return false;
+
+  Y4MFormat const & fmt1 = reader1.format();
+  Y4MFormat const & fmt2 = reader2.format();
+  if (fmt1.numChannels() != fmt2.numChannels())
+  {
+    std::cerr << "Cannot morph between a luma-only and a color video" << std::endl;
+    return false;
+  }
+
+  // Frame times run from 0 to 1 over the clips, so their length must be known up front
+  long count1 = reader1.countFrames(), count2 = reader2.countFrames();
+  long length = (count1 >= 0 && count2 >= 0 ? std::min(count1, count2) : -1);
+  if (num_frames > 0)
+    length = (length >= 0 ? std::min(length, (long)num_frames) : num_frames);
+
+  if (length < 0)
+  {
+    std::cerr << "Cannot tell the length of a streamed video: use --frames" << std::endl;
+    return false;
+  }
+
+  std::cout << "Morphing " << length << " frames of " << fmt1.w << 'x' << fmt1.h << " and " << fmt2.w << 'x' << fmt2.h
+            << " video" << std::endl;
+
+  SegmentReader segments;
+  if (!segments.open(seg_path))
+    return false;
+
+  Y4MFormat out_fmt = fmt1;
+  if (out_w > 0 && out_h > 0)
+  {
+    out_fmt.w = out_w;
+    out_fmt.h = out_h;
+  }
+
+  Y4MWriter writer;
+  if (!writer.open(out_path, out_fmt))
+    return false;
+
+  // Decode, render and encode run concurrently, with a couple of frames in flight between them
+  typedef std::shared_ptr<VideoFrame> FramePtr;
+  BoundedQueue<FramePtr> decoded(2), rendered(2);
+  std::atomic<bool> failed(false);
+  int num_written = 0;
+
+  std::thread decoder([&]()
+  {
+    std::vector<LineSegment> seg1, seg2;
+    bool more_segments = true;
+    for (int i = 0; i < length && !failed; ++i)
+    {
+      FramePtr frame = std::make_shared<VideoFrame>();
+      frame->index = i;
+      frame->t = (length > 1 ? i / (double)(length - 1) : 0.0);
+      if (!reader1.readFrame(frame->frame1) || !reader2.readFrame(frame->frame2))
+      {
+        std::cerr << "Could not read frame " << i << " of the input videos" << std::endl;
+        failed = true;
+        break;
+      }
+
+      // A stream shorter than the clips holds its last set of segments
+      if (more_segments && !segments.next(seg1, seg2))
+      {
+        more_segments = false;
+        if (segments.numRead() == 0)
+        {
+          std::cerr << "No segments in " << seg_path << std::endl;
+          failed = true;
+          break;
+        }
+
+        if (i > 0)
+          std::cout << "Holding the last of " << segments.numRead() << " segment sets from frame " << i << " on" << std::endl;
+      }
+
+      frame->seg1 = seg1;
+      frame->seg2 = seg2;
+      if (!decoded.push(frame))
+        break;
+    }
+
+    decoded.close();
+  });
+
+  std::thread encoder([&]()
+  {
+    FramePtr frame;
+    while (rendered.pop(frame))
+    {
+      // Keep draining after a failure so the renderer never blocks
+      if (failed)
+        continue;
+
+      if (!writer.writeFrame(frame->morphed))
+      {
+        std::cerr << "Could not write frame " << frame->index << " to " << out_path << std::endl;
+        failed = true;
+        continue;
+      }
+
+      ++num_written;
+    }
+  });
+
+  FramePtr frame;
+  while (decoded.pop(frame))
+  {
+    if (!failed)
+    {
+      std::cout << "Morphing frame " << frame->index << " (t = " << frame->t << ")" << std::endl;
+      if (blur.samples > 1)
+        frame->morphed = morphImagesBlurred(frame->frame1, frame->frame2, frame->seg1, frame->seg2, frame->t,
+                                            length > 1 ? 1.0 / (length - 1) : 0.0, blur, params, filter, out_fmt.w,
+                                            out_fmt.h);
+      else
+        frame->morphed = morphImages(frame->frame1, frame->frame2, frame->seg1, frame->seg2, frame->t, params, filter,
+                                     out_fmt.w, out_fmt.h);
+
+      // Release the inputs before the frame waits to be encoded
+      frame->frame1 = Image();
+      frame->frame2 = Image();
+    }
+
+    rendered.push(frame);
+    frame.reset();
+  }
+
+  rendered.close();
+  decoder.join();
+  encoder.join();
+
+  bool ok = writer.close() && !failed;
+  std::cout << "Wrote " << num_written << " frames to " << out_path << std::endl;
+
+  return ok;
+}
+
+/**
+ * Generate a field warp kernel for the layout of the segments in \a seg_path and the warp parameters \a params (see RigKernel).
+ * If \a out_path ends in .cpp, just the source is written; otherwise the source is written to out_path with .cpp appended, and
+ * compiled into a shared object at out_path.
+ */
+bool
+generateKernel(std::string const & seg_path, std::string const & out_path, WarpParams const & params)
+{
+  std::vector<LineSegment> seg1, seg2;
+  if (!loadSegments(seg_path, seg1, seg2))
+    return false;
+
+  std::string const ext = ".cpp";
+  bool source_only = (out_path.size() >= ext.size() && out_path.compare(out_path.size() - ext.size(), ext.size(), ext) == 0);
+  std::string src_path = (source_only ? out_path : out_path + ext);
+
+  std::cout << "Generating a kernel for the layout of " << seg1.size() << " segments in " << seg_path << " with parameters"
+            << " { a : " << params.a << ", b : " << params.b << ", p : " << params.p << " }" << std::endl;
+  if (!RigKernel::generate(src_path, seg1, params))
+    return false;
+
+  if (source_only)
+    return true;
+
+  if (!RigKernel::compile(src_path, out_path))
+    return false;
+
+  std::cout << "Wrote kernel " << out_path << std::endl;
+  return true;
+}
+
+/** Convert a segments file to the format implied by the extension of \a out_path. */
+bool
+convertSegments(std::string const & in_path, std::string const & out_path, bool float64)
+{
+  std::vector<LineSegment> seg1, seg2;
+  std::vector<double> weights;
+  if (!loadSegments(in_path, seg1, seg2, &weights))
+    return false;
+
+  SegmentFormat format = segmentFormatForPath(out_path);
+  if (format == SEGMENTS_BINARY32 && float64)
+    format = SEGMENTS_BINARY64;
+
+  if (!saveSegments(out_path, seg1, seg2, format, &weights))
+    return false;
+
+  std::cout << "Converted " << seg1.size() << " segments from " << in_path << " to " << out_path << std::endl;
+  return true;
+}
+
+/** Check if a string holds a number and nothing else. */
+bool
+isNumber(std::string const & s)
+{
+  char * end = NULL;
+  std::strtod(s.c_str(), &end);
+  return !s.empty() && end == s.c_str() + s.size();
+}
+
+void
+printUsage(char const * cmd)
+{
+  std::cout << "Usage: " << cmd << " image1 image2 segments_file time[0..1] output.png [a  b  p]\n"
+            << "       " << cmd << " --frames N [--keyframe-spacing K] [--tolerance px] image1 image2 segments_file"
+            << " output.png [a  b  p]\n"
+            << "       " << cmd << " --chain --frames N [--spline] image1 segments_file_1_2 image2 [segments_file_2_3"
+            << " image3 ...] output.png [a  b  p]\n"
+            << "       " << cmd << " --average [--weights w1,w2,...] image1 segments_file_1_2 image2 [segments_file_1_3"
+            << " image3 ...] output.png [a  b  p]\n"
+            << "       " << cmd << " --video [--frames N] video1.y4m video2.y4m segments_stream output.y4m [a  b  p]\n"
+            << "       " << cmd << " --convert-segments in out [--float64]\n"
+            << "       " << cmd << " --generate-kernel segments_file kernel.so [a  b  p]\n"
+            << "\n"
+            << "  A single morph or average saved to a path ending in .dzi is written tile by tile as a Deep Zoom pyramid,"
+            << " without\n"
+            << "  holding the full image: the descriptor goes to that path and the tiles to the directory next to it"
+            << " named *_files.\n"
+            << "\n"
+            << "  Each line of a segments file holds a segment in image1 and image2 as x1 y1 x2 y2 x1' y1' x2' y2', or a point"
+            << " feature\n"
+            << "  such as a landmark as x y x' y', which only translates its surroundings and costs a fraction of a"
+            << " segment.\n"
+            << "\n"
+            << "  --frames N            render N frames with t running from 0 to 1, numbered into output.png\n"
+            << "  --keyframe-spacing K  compute exact warp fields at most K frames apart (default 16)\n"
+            << "  --tolerance px        interpolate warp fields between keyframes while within px pixels of the exact"
+            << " ones (default 0.25; 0 renders every frame exactly)\n"
+            << "  --chain               morph through a chain of images, given with the segments between each consecutive"
+            << " pair, with N\n"
+            << "                        frames per transition\n"
+            << "  --spline              move segments along splines through the chain instead of linearly in each"
+            << " transition, if the\n"
+            << "                        segments ending each transition match those starting the next\n"
+            << "  --average             average images, each given with the segments between image1 and it, by warping"
+            << " them all to\n"
+            << "                        their weighted average segments and blending them in one pass\n"
+            << "  --weights w1,w2,...   barycentric weights of the averaged images (default: equal)\n"
+            << "  --video               morph between two YUV4MPEG2 videos, frame i at t = i / (N - 1), with the segments of"
+            << " each frame\n"
+            << "                        read in turn from a stream of concatenated segment files (the last set is held"
+            << " if it runs\n"
+            << "                        out); N is the length of the shorter video, or the --frames limit. '-' reads or"
+            << " writes a pipe\n"
+            << "  --motion-blur S       blur each frame of a sequence or video over its exposure by averaging S"
+            << " sub-frames, whose\n"
+            << "                        warps are computed together in one pass over the pixels; cannot be combined"
+            << " with --theta,\n"
+            << "                        --identity or --engine mesh\n"
+            << "  --shutter f           exposure of each frame, as a fraction of the time between frames (default 0.5)\n"
+            << "  --theta T             aggregate groups of segments whose size is below T times their distance"
+            << " (Barnes-Hut);\n"
+            << "                        0 (default) evaluates every segment exactly, around 0.5 is a good trade-off\n"
+            << "  --identity px         copy blocks of pixels whose displacement is provably below px pixels instead of"
+            << " warping them,\n"
+            << "                        e.g. 0.5; 0 (default) warps every pixel\n"
+            << "  --engine E            how to compute the warp: field (default), the field warp weighting every segment"
+            << " at every\n"
+            << "                        pixel, or mesh, a much cheaper piecewise-affine warp over a triangulation of the"
+            << " segment\n"
+            << "                        endpoints, for previews; the mesh ignores a, b, p, --theta, --identity and"
+            << " --weight-table,\n"
+            << "                        and cannot be used with --motion-blur\n"
+            << "  --weight-table        look up the distance falloff of segment weights in a table built once per run"
+            << " instead of\n"
+            << "                        computing it exactly; faster for b != 1, to within the relative error it\n"
+            << "                        reports\n"
+            << "  --simplify px         merge collinear runs of segments and drop segments the warp barely depends on,"
+            << " as long as\n"
+            << "                        no displacement changes by more than px pixels\n"
+            << "  --proxy S             load the images at 1/S scale (2, 4 or 8), scaling the segments to match, for"
+            << " quick previews;\n"
+            << "                        JPEGs are decoded at the reduced size directly\n"
+            << "  --save-segments file  save the segments used for the morph, e.g. after simplification, for reuse\n"
+            << "  --convert-segments in out\n"
+            << "                        convert a segments file between the text format and the binary format, which"
+            << " is used for\n"
+            << "                        files ending in .segb\n"
+            << "  --generate-kernel segments_file kernel.so\n"
+            << "                        generate a field warp kernel specialized to the layout of the segments (their"
+            << " number, and\n"
+            << "                        which are points) and to a, b and p, and compile it with $CXX or c++; only the"
+            << " source is\n"
+            << "                        written if the output ends in .cpp\n"
+            << "  --kernel kernel.so    evaluate segments with the layout of a generated kernel through it, e.g. for the"
+            << " frames of a\n"
+            << "                        rig; the results are identical to the generic loop. Cannot be combined with"
+            << " --theta,\n"
+            << "                        --weight-table, --engine mesh or --motion-blur\n"
+            << "  --float64             store coordinates in binary segment files in double rather than single"
+            << " precision\n"
+            << "  --filter F            source filter: bilinear (default), or trilinear or ewa on mip pyramids, which"
+            << " avoid aliasing\n"
+            << "                        where the warp shrinks the source\n"
+            << "  --size WxH            render the output at W x H pixels instead of the size of image1, evaluating the"
+            << " warp\n"
+            << "                        only at output pixels\n"
+            << "  --gamma g             gamma-correct the output, mapping each colour value v to 255 (v / 255)^(1 / g)\n"
+            << "  --crop WxH+X+Y        keep only the W x H pixels of the output from column X and row Y on; like --size"
+            << " and --gamma,\n"
+            << "                        this is fused into the pass computing the morph, and only the kept pixels are"
+            << " warped\n"
+            << "  --layer L1 L2 out     morph auxiliary layers L1 and L2 (aligned with image1 and image2, any number of"
+            << " channels)\n"
+            << "                        through the same warp as the main images and save the result to out\n"
+            << "  --layer1 L1 out       distort an auxiliary layer aligned with image1 through image1's warp\n"
+            << "  --layer2 L2 out       distort an auxiliary layer aligned with image2 through image2's warp\n"
+            << "  --mask M              only morph where mask image M (aligned with image1) is set, warping just the"
+            << " tiles it covers\n"
+            << "  --mask-polygon file   only morph inside a polygon in the pixel coordinates of image1, read from a file"
+            << " holding the\n"
+            << "                        number of vertices followed by the x and y of each vertex\n"
+            << "  --feather px          width of the band outside the mask over which the morph fades out (default 16)\n"
+            << "  --outside O           what to show outside the mask: blend (default, a cross-dissolve), first or second"
+            << std::endl;
+}
+
+int
+main(int argc, char * argv[])
+{
+  // Separate options from positional arguments
+  std::vector<std::string> args;
+  int num_frames = 0;
+  int keyframe_spacing = 16;
+  double tolerance = 0.25;
+  std::vector<LayerJob> layer_jobs;
+  MaskJob mask_job;
+  SampleFilter filter = FILTER_BILINEAR;
+  WarpEngine engine = ENGINE_FIELD;
+  int out_w = 0, out_h = 0;
+  OutputAdjust adjust;
+  double theta = 0, identity_tolerance = 0;
+  bool use_weight_table = false;
+  SegmentPrep prep;
+  std::string convert_in, convert_out;
+  std::string kernel_segs, kernel_out, kernel_path;
+  bool chain = false, spline = false, average = false, video = false;
+  MotionBlur blur;
+  std::vector<double> weights;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    bool has_value = (i + 1 < argc);
+    if (arg == "--frames" && has_value)
+      num_frames = std::atoi(argv[++i]);
+    else if (arg == "--keyframe-spacing" && has_value)
+      keyframe_spacing = std::atoi(argv[++i]);
+    else if (arg == "--tolerance" && has_value)
+      tolerance = std::atof(argv[++i]);
+    else if (arg == "--theta" && has_value)
+      theta = std::max(0.0, std::atof(argv[++i]));
+    else if (arg == "--identity" && has_value)
+      identity_tolerance = std::max(0.0, std::atof(argv[++i]));
+    else if (arg == "--weight-table")
+      use_weight_table = true;
+    else if (arg == "--simplify" && has_value)
+    {
+      prep.simplify = true;
+      prep.options.tolerance = std::max(0.0, std::atof(argv[++i]));
+    }
+    else if (arg == "--save-segments" && has_value)
+      prep.save_path = argv[++i];
+    else if (arg == "--chain")
+      chain = true;
+    else if (arg == "--spline")
+      spline = true;
+    else if (arg == "--motion-blur" && has_value)
+      blur.samples = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--shutter" && has_value)
+      blur.shutter = std::min(std::max(std::atof(argv[++i]), 0.0), 1.0);
+    else if (arg == "--video")
+      video = true;
+    else if (arg == "--average")
+      average = true;
+    else if (arg == "--weights" && has_value)
+    {
+      std::istringstream weights_in(argv[++i]);
+      double weight;
+      char comma = ',';
+      weights.clear();
+      while (comma == ',' && weights_in >> weight)
+      {
+        weights.push_back(weight);
+        if (!(weights_in >> comma))
+          break;
+      }
+
+      if (!weights_in.eof() || weights.empty())
+      {
+        std::cout << "Invalid weights " << argv[i] << ", expected a comma-separated list" << std::endl;
+        printUsage(argv[0]);
+        return -1;
+      }
+    }
+    else if (arg == "--float64")
+      prep.float64 = true;
+    else if (arg == "--proxy" && has_value)
+      prep.proxy = std::atoi(argv[++i]);
+    else if (arg == "--convert-segments" && i + 2 < argc)
+    {
+      convert_in = argv[i + 1];
+      convert_out = argv[i + 2];
+      i += 2;
+    }
+    else if (arg == "--generate-kernel" && i + 2 < argc)
+    {
+      kernel_segs = argv[i + 1];
+      kernel_out = argv[i + 2];
+      i += 2;
+    }
+    else if (arg == "--kernel" && has_value)
+      kernel_path = argv[++i];
+    else if (arg == "--filter" && has_value)
+    {
+      std::string name = argv[++i];
+      if (name == "bilinear")
+        filter = FILTER_BILINEAR;
+      else if (name == "trilinear")
+        filter = FILTER_TRILINEAR;
+      else if (name == "ewa")
+        filter = FILTER_EWA;
+      else
+      {
+        std::cout << "Unknown filter " << name << std::endl;
+        printUsage(argv[0]);
+        return -1;
+      }
+    }
+    else if (arg == "--engine" && has_value)
+    {
+      std::string name = argv[++i];
+      if (name == "field")
+        engine = ENGINE_FIELD;
+      else if (name == "mesh")
+        engine = ENGINE_MESH;
+      else
+      {
+        std::cout << "Unknown engine " << name << std::endl;
+        printUsage(argv[0]);
+        return -1;
+      }
+    }
+    else if (arg == "--size" && has_value)
+    {
+      char x;
+      std::istringstream size_in(argv[++i]);
+      if (!(size_in >> out_w >> x >> out_h) || x != 'x' || out_w <= 0 || out_h <= 0)
+      {
+        std::cout << "Invalid output size " << argv[i] << ", expected WxH" << std::endl;
+        printUsage(argv[0]);
+        return -1;
+      }
+    }
+    else if (arg == "--gamma" && has_value)
+    {
+      adjust.gamma = std::atof(argv[++i]);
+      if (!(adjust.gamma > 0))
+      {
+        std::cout << "Invalid gamma " << argv[i] << ", expected a positive number" << std::endl;
+        printUsage(argv[0]);
+        return -1;
+      }
+    }
+    else if (arg == "--crop" && has_value)
+    {
+      char x, plus1, plus2;
+      std::istringstream crop_in(argv[++i]);
+      if (!(crop_in >> adjust.crop_w >> x >> adjust.crop_h >> plus1 >> adjust.crop_x >> plus2 >> adjust.crop_y)
+          || x != 'x' || plus1 != '+' || plus2 != '+' || adjust.crop_w <= 0 || adjust.crop_h <= 0 || adjust.crop_x < 0
+          || adjust.crop_y < 0)
+      {
+        std::cout << "Invalid crop " << argv[i] << ", expected WxH+X+Y" << std::endl;
+        printUsage(argv[0]);
+        return -1;
+      }
+    }
+    else if (arg == "--layer" && i + 3 < argc)
+    {
+      LayerJob job = { argv[i + 1], argv[i + 2], argv[i + 3] };
+      layer_jobs.push_back(job);
+      i += 3;
+    }
+    else if ((arg == "--layer1" || arg == "--layer2") && i + 2 < argc)
+    {
+      LayerJob job;
+      (arg == "--layer1" ? job.path1 : job.path2) = argv[i + 1];
+      job.out_path = argv[i + 2];
+      layer_jobs.push_back(job);
+      i += 2;
+    }
+    else if (arg == "--mask" && has_value)
+      mask_job.image_path = argv[++i];
+    else if (arg == "--mask-polygon" && has_value)
+      mask_job.polygon_path = argv[++i];
+    else if (arg == "--feather" && has_value)
+      mask_job.feather = std::max(0.0, std::atof(argv[++i]));
+    else if (arg == "--outside" && has_value)
+    {
+      std::string name = argv[++i];
+      if (name == "blend")
+        mask_job.outside = OUTSIDE_BLEND;
+      else if (name == "first")
+        mask_job.outside = OUTSIDE_FIRST;
+      else if (name == "second")
+        mask_job.outside = OUTSIDE_SECOND;
+      else
+      {
+        std::cout << "Unknown outside mode " << name << std::endl;
+        printUsage(argv[0]);
+        return -1;
+      }
+    }
+    else if (arg.compare(0, 2, "--") == 0)
+    {
+      std::cout << "Unknown or incomplete option " << arg << std::endl;
+      printUsage(argv[0]);
+      return -1;
+    }
+    else
+      args.push_back(arg);
+  }
+
+  if (!convert_in.empty())
+    return convertSegments(convert_in, convert_out, prep.float64) ? 0 : -1;
+
+  if (!kernel_segs.empty())
+  {
+    WarpParams kernel_params;
+    if (args.size() == 3)
+    {
+      kernel_params.a = std::atof(args[0].c_str());
+      kernel_params.b = std::atof(args[1].c_str());
+      kernel_params.p = std::atof(args[2].c_str());
+    }
+    else if (!args.empty())
+    {
+      printUsage(argv[0]);
+      return -1;
+    }
+
+    return generateKernel(kernel_segs, kernel_out, kernel_params) ? 0 : -1;
+  }
+
+  bool sequence = (num_frames > 0 && !video);
+  size_t num_required = (sequence || video) ? 4 : 5;
+  if (chain || average)
+  {
+    // Images interleaved with segment files, then the output, optionally followed by a b p
+    size_t n = args.size();
+    bool has_params = (n >= 3 && isNumber(args[n - 3]) && isNumber(args[n - 2]) && isNumber(args[n - 1]));
+    num_required = n - (has_params ? 3 : 0);
+    if (chain && average)
+    {
+      std::cout << "Chains and averages cannot be combined" << std::endl;
+      return -1;
+    }
+
+    if (args.size() < 4 || sequence != chain)
+    {
+      if (chain && !sequence)
+        std::cout << "Chains must be rendered as sequences: use --frames" << std::endl;
+      else if (average && sequence)
+        std::cout << "Averages are single images: --frames cannot be used" << std::endl;
+
+      printUsage(argv[0]);
+      return -1;
+    }
+
+    // Images are at even positions and segment files at odd ones, so with the output the count is even
+    if (chain && (num_required < 4 || num_required % 2 != 0))
+    {
+      std::cout << "A chain needs at least two images, each but the first preceded by the segments from the previous one,"
+                << " then the output" << std::endl;
+      printUsage(argv[0]);
+      return -1;
+    }
+
+    if (average && (num_required < 4 || num_required % 2 != 0))
+    {
+      std::cout << "An average needs at least two images, each but the first preceded by the segments from the first one,"
+                << " then the output" << std::endl;
+      printUsage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (args.size() != num_required && args.size() != num_required + 3)
+  {
+    printUsage(argv[0]);
+    return -1;
+  }
+
+  std::string img1_path  =  args[0];
+  std::string img2_path  =  args[1];
+  std::string seg_path   =  args[2];
+  double t               =  (sequence || video) ? 0.0 : std::atof(args[3].c_str());
+  std::string out_path   =  args[num_required - 1];
+
+  // Progress goes to the error stream if a video goes to standard output
+  if (video && out_path == "-")
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+  // sanity checks
+  if (t < 0.0 || t > 1.0)
+  {
+    std::cout << "Time t out of range: clamping to [0..1]" << std::endl;
+    if (t > 1.0)
+      t = 1.0;
+    else
+      t = 0.0;
+  }
+
+  if (sequence && !layer_jobs.empty())
+  {
+    std::cout << "Auxiliary layers can only be used when rendering a single frame" << std::endl;
+    return -1;
+  }
+
+  if (!mask_job.empty() && (sequence || video || average || !layer_jobs.empty()))
+  {
+    std::cout << "Masks can only be used when rendering a single frame of two images without auxiliary layers"
+              << std::endl;
+    return -1;
+  }
+
+  if (DeepZoomWriter::isDeepZoomPath(out_path) && (sequence || video || !layer_jobs.empty() || !mask_job.empty()))
+  {
+    std::cout << "Deep zoom pyramids can only be rendered from single morphs or averages, without layers or masks"
+              << std::endl;
+    return -1;
+  }
+
+  if (!adjust.empty() && (sequence || video || average || !layer_jobs.empty() || !mask_job.empty()
+                         || DeepZoomWriter::isDeepZoomPath(out_path)))
+  {
+    std::cout << "--gamma and --crop can only be used when rendering a single morph of two images, without layers, masks"
+              << " or Deep Zoom output" << std::endl;
+    return -1;
+  }
+
+  if (!mask_job.image_path.empty() && !mask_job.polygon_path.empty())
+  {
+    std::cout << "Use either a mask image or a mask polygon, not both" << std::endl;
+    return -1;
+  }
+
+  if (blur.samples > 1 && !sequence && !video)
+  {
+    std::cout << "Motion blur needs a sequence of frames: use --frames or --video" << std::endl;
+    return -1;
+  }
+
+  if (!kernel_path.empty() && (theta > 0 || use_weight_table || engine == ENGINE_MESH || blur.samples > 1))
+  {
+    std::cout << "Generated kernels evaluate every segment exactly: they cannot be combined with --theta, --weight-table,"
+              << " --engine mesh or --motion-blur" << std::endl;
+    return -1;
+  }
+
+  if (blur.samples > 1 && (engine == ENGINE_MESH || theta > 0 || identity_tolerance > 0))
+  {
+    std::cout << "Motion blur evaluates every segment at every pixel with the field engine: it cannot be combined with"
+              << " --theta, --identity or --engine mesh" << std::endl;
+    return -1;
+  }
+
+  if (video && (chain || average || !layer_jobs.empty()))
+  {
+    std::cout << "Videos can only be morphed with one segment stream and no auxiliary layers" << std::endl;
+    return -1;
+  }
+
+  if (prep.proxy != 1 && prep.proxy != 2 && prep.proxy != 4 && prep.proxy != 8)
+  {
+    std::cout << "Proxy scale must be 1, 2, 4 or 8" << std::endl;
+    return -1;
+  }
+
+  if (prep.proxy > 1 && (chain || average || video || !layer_jobs.empty() || !mask_job.polygon_path.empty()
+                         || !prep.save_path.empty()))
+  {
+    std::cout << "Proxies can only be used when morphing two images, without auxiliary layers, mask polygons or saving"
+              << " segments" << std::endl;
+    return -1;
+  }
+
+  if ((chain || average || video) && (prep.simplify || !prep.save_path.empty()))
+  {
+    std::cout << "Segments can only be simplified or saved when morphing two images" << std::endl;
+    return -1;
+  }
+
+  if (average && !layer_jobs.empty())
+  {
+    std::cout << "Auxiliary layers can only be used when morphing two images" << std::endl;
+    return -1;
+  }
+
+  if (average && !weights.empty() && weights.size() != num_required / 2)
+  {
+    std::cout << "Expected " << num_required / 2 << " weights, got " << weights.size() << std::endl;
+    return -1;
+  }
+
+  if (chain && num_frames < 2)
+  {
+    std::cout << "Chains need at least 2 frames per transition" << std::endl;
+    return -1;
+  }
+
+  if (keyframe_spacing < 1)
+  {
+    std::cout << "Keyframe spacing out of range: clamping to 1" << std::endl;
+    keyframe_spacing = 1;
+  }
+
+  WarpParams params;
+  params.theta = theta;
+  params.identity_tolerance = identity_tolerance;
+  params.engine = engine;
+  if (args.size() == num_required + 3)
+  {
+    params.a = std::atof(args[num_required].c_str());
+    params.b = std::atof(args[num_required + 1].c_str());
+    params.p = std::atof(args[num_required + 2].c_str());
+  }
+
+  if (video)
+    std::cout << "Morphing video " << img1_path << " into " << img2_path << ", generating " << out_path << std::endl;
+  else if (average)
+    std::cout << "Averaging " << num_required / 2 << " images, generating " << out_path << std::endl;
+  else if (chain)
+    std::cout << "Morphing through " << num_required / 2 << " images over " << num_frames << " frames per transition,"
+              << " generating " << framePath(out_path, 0) << " onwards" << std::endl;
+  else if (sequence)
+    std::cout << "Morphing " << img1_path << " into " << img2_path << " over " << num_frames << " frames, generating "
+              << framePath(out_path, 0) << " onwards" << std::endl;
+  else
+    std::cout << "Morphing " << img1_path << " into " << img2_path << " at time t = " << t << ", generating " << out_path
+              << std::endl;
+  if (engine == ENGINE_MESH)
+    std::cout << "Using the piecewise-affine mesh engine" << std::endl;
+  else
+    std::cout << "Using parameters { a : " << params.a << ", b : " << params.b << ", p : " << params.p << " }" << std::endl;
+
+  WeightTable * weight_table = NULL;
+  if (use_weight_table && params.b == 1)
+    std::cout << "The weight falloff is a single division for b = 1: computing weights exactly" << std::endl;
+  else if (use_weight_table)
+  {
+    weight_table = new WeightTable(params.a, params.b);
+    params.weight_table = weight_table;
+    std::cout << "Looking up weight falloff in a table of " << weight_table->size() << " entries, max relative error "
+              << weight_table->maxRelativeError() << std::endl;
+  }
+
+  RigKernel * kernel = NULL;
+  if (!kernel_path.empty())
+  {
+    kernel = new RigKernel;
+    if (!kernel->load(kernel_path) || !kernel->checkParams(params))
+    {
+      delete kernel;
+      delete weight_table;
+      return -1;
+    }
+
+    params.kernel = kernel;
+    std::cout << "Evaluating segments through kernel " << kernel_path << std::endl;
+  }
+
+  if (video)
+    videoDriver(img1_path, img2_path, seg_path, num_frames, out_path, params, filter, out_w, out_h, blur);
+  else if (average)
+    averageDriver(std::vector<std::string>(args.begin(), args.begin() + num_required - 1), weights, out_path, params, filter,
+                  out_w, out_h);
+  else if (chain)
+    chainDriver(std::vector<std::string>(args.begin(), args.begin() + num_required - 1), num_frames, keyframe_spacing,
+                tolerance, out_path, params, filter, out_w, out_h, spline, blur);
+  else if (sequence)
+    sequenceDriver(img1_path, img2_path, seg_path, num_frames, keyframe_spacing, tolerance, out_path, params, prep, filter,
+                   out_w, out_h, blur);
+  else
+    morphDriver(img1_path, img2_path, seg_path, t, out_path, layer_jobs, mask_job, params, prep, filter, out_w,
+                out_h, adjust);
+
+  delete kernel;
+  delete weight_table;
+  return 0;
+}
@@ -145,6 +145,14 @@
         near-term back-compatibility use.
 
 
+   Local modifications:
+      stbi_load_reduced: decode JPEGs directly at 1/2, 1/4 or 1/8 scale by
+                         reduced-size IDCTs, for previews and proxies
+      stbi_set_parallel_for: decode the restart intervals of baseline JPEGs
+                         in parallel, on threads supplied by the caller
+      AVX2 kernels:      two-block IDCT and 16-pixel YCbCr->RGBA conversion,
+                         selected at run time (define STBI_NO_AVX2 to disable)
+
    Latest revision history:
       2.10  (2016-01-22) avoid warning introduced in 2.09
       2.09  (2016-01-16) 16-bit TGA; comments in PNM files; STBI_REALLOC_SIZED
@@ -439,6 +447,12 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk  , void
 #ifndef STBI_NO_STDIO
 STBIDEF stbi_uc *stbi_load_from_file  (FILE *f,                  int *x, int *y, int *comp, int req_comp);
 // for stbi_load_from_file, file pointer is left pointing immediately after image
+
+STBIDEF stbi_uc *stbi_load_reduced    (char const *filename,     int *x, int *y, int *comp, int req_comp, int *scale);
+// like stbi_load, but JPEGs are decoded directly at 1/2, 1/4 or 1/8 of their
+// size (rounding up) for *scale = 2, 4 or 8, skipping the high-frequency
+// IDCT work. on return, *scale holds the factor actually applied, which is
+// 1 for formats that are always decoded at full size
 #endif
 
 #ifndef STBI_NO_LINEAR
@@ -501,6 +515,16 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// supply a parallel loop, which must call task(data, i) for every i in
+// [0, count), in any order and on any threads, and return once all calls have
+// finished. when set, the restart intervals of baseline JPEGs decoded from
+// memory or by filename are decoded in parallel; JPEGs without restart
+// markers, progressive JPEGs and callback-based loads are decoded as before.
+// pass NULL to decode everything on the calling thread again
+typedef void (*stbi_parallel_task)(void *data, int index);
+typedef void (*stbi_parallel_for_func)(stbi_parallel_task task, void *data, int count);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func parallel_for);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -723,6 +747,19 @@ static int stbi__sse2_available()
 #endif
 #endif
 
+// AVX2 kernels are compiled with per-function target attributes and chosen at
+// run time, so the library as a whole still only requires SSE2
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && defined(__GNUC__) && (__GNUC__ * 100 + __GNUC_MINOR__) >= 408
+#define STBI_AVX2
+#include <immintrin.h>
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+
+static int stbi__avx2_available()
+{
+   return __builtin_cpu_supports("avx2");
+}
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -749,6 +786,9 @@ typedef struct
    stbi__uint32 img_x, img_y;
    int img_n, img_out_n;
 
+   int reduce_shift;   // requested JPEG decode scale, as a power of 2
+   int reduced_shift;  // scale the decoder actually applied
+
    stbi_io_callbacks io;
    void *io_user_data;
 
@@ -768,6 +808,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
    s->io.read = NULL;
    s->read_from_callbacks = 0;
+   s->reduce_shift = s->reduced_shift = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -777,6 +818,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
 {
    s->io = *c;
    s->io_user_data = user;
+   s->reduce_shift = s->reduced_shift = 0;
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->img_buffer_original = s->buffer_start;
@@ -934,6 +976,13 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
     stbi__vertically_flip_on_load = flag_true_if_should_flip;
 }
 
+static stbi_parallel_for_func stbi__parallel_for = NULL;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func parallel_for)
+{
+   stbi__parallel_for = parallel_for;
+}
+
 static unsigned char *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
    #ifndef STBI_NO_JPEG
@@ -1047,6 +1096,36 @@ STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int
    return result;
 }
 
+STBIDEF stbi_uc *stbi_load_reduced(char const *filename, int *x, int *y, int *comp, int req_comp, int *scale)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   stbi_uc *contents = NULL;
+   long len;
+   stbi__context s;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   // decode from memory if the whole file can be read at once, which lets
+   // restart intervals be found ahead of the decoder and decoded in parallel
+   if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 && len < 0x7fffffff && fseek(f, 0, SEEK_SET) == 0) {
+      contents = (stbi_uc *) stbi__malloc(len);
+      if (contents && fread(contents, 1, len, f) != (size_t) len) {
+         STBI_FREE(contents);
+         contents = NULL;
+         fseek(f, 0, SEEK_SET);
+      }
+   }
+   if (contents)
+      stbi__start_mem(&s,contents,(int) len);
+   else
+      stbi__start_file(&s,f);
+   s.reduce_shift = *scale >= 8 ? 3 : *scale >= 4 ? 2 : *scale >= 2 ? 1 : 0;
+   result = stbi__load_flip(&s,x,y,comp,req_comp);
+   STBI_FREE(contents);
+   fclose(f);
+   *scale = 1 << s.reduced_shift;
+   return result;
+}
+
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    unsigned char *result;
@@ -1509,9 +1588,11 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale_shift;  // blocks are decoded to (8 >> scale_shift)^2 pixels
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+   void (*idct_pair_kernel)(stbi_uc *out0, int out_stride0, short data0[64], stbi_uc *out1, int out_stride1, short data1[64]); // or NULL
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
@@ -2023,6 +2104,60 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced-size IDCTs, for decoding at 1/2, 1/4 and 1/8 scale: as in the IJG
+// library, an n-point IDCT of the top-left n*n coefficients gives the block
+// sampled at the centers of its n*n cells, and the other coefficients are
+// never transformed. basis[x*n+u] = C(u)/2 * cos((2x+1) u pi / 2n)
+static const float stbi__idct_basis2[2*2] = {
+   0.35355339f,  0.35355339f,
+   0.35355339f, -0.35355339f
+};
+static const float stbi__idct_basis4[4*4] = {
+   0.35355339f,  0.46193977f,  0.35355339f,  0.19134172f,
+   0.35355339f,  0.19134172f, -0.35355339f, -0.46193977f,
+   0.35355339f, -0.19134172f, -0.35355339f,  0.46193977f,
+   0.35355339f, -0.46193977f,  0.35355339f, -0.19134172f
+};
+
+stbi_inline static void stbi__idct_reduced(stbi_uc *out, int out_stride, short data[64], int n, const float *basis)
+{
+   int i,j,u;
+   float tmp[4*4];
+   // rows of coefficients, horizontally
+   for (j=0; j < n; ++j)
+      for (i=0; i < n; ++i) {
+         float sum = 0;
+         for (u=0; u < n; ++u)
+            sum += basis[i*n+u] * data[j*8+u];
+         tmp[j*n+i] = sum;
+      }
+   // then vertically, with the level shift and rounding (truncation only
+   // differs from floor below zero, which is clamped anyway)
+   for (j=0; j < n; ++j, out += out_stride)
+      for (i=0; i < n; ++i) {
+         float sum = 128.5f;
+         for (u=0; u < n; ++u)
+            sum += basis[j*n+u] * tmp[u*n+i];
+         out[i] = stbi__clamp((int) sum);
+      }
+}
+
+static void stbi__idct_block_4(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_reduced(out, out_stride, data, 4, stbi__idct_basis4);
+}
+
+static void stbi__idct_block_2(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_reduced(out, out_stride, data, 2, stbi__idct_basis2);
+}
+
+static void stbi__idct_block_1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp((int) (data[0] * 0.125f + 128.5f));
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2204,6 +2339,186 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 version of stbi__idct_simd, transforming two blocks at once, one in each
+// 128-bit lane. every step of the sse2 version stays within its register, so
+// this is the same sequence of operations on both lanes, and bit-identical.
+STBI__AVX2_TARGET
+static void stbi__idct_simd_pair_avx2(stbi_uc *out0, int out_stride0, short data0[64], stbi_uc *out1, int out_stride1, short data1[64])
+{
+   __m256i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m256i tmp;
+
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+   #define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+   #define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+   #define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   // row r of block 0 in the low lane, of block 1 in the high lane
+   #define dct_load(r) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i *) (data0 + (r)*8))), \
+                              _mm_load_si128((const __m128i *) (data1 + (r)*8)), 1)
+
+   // store the rows of one block, packed as in stbi__idct_simd
+   #define dct_store(out, out_stride, p0, p1, p2, p3) \
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e))
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   row0 = dct_load(0);
+   row1 = dct_load(1);
+   row2 = dct_load(2);
+   row3 = dct_load(3);
+   row4 = dct_load(4);
+   row5 = dct_load(5);
+   row6 = dct_load(6);
+   row7 = dct_load(7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transposes, within each lane
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m256i p0 = _mm256_packus_epi16(row0, row1);
+      __m256i p1 = _mm256_packus_epi16(row2, row3);
+      __m256i p2 = _mm256_packus_epi16(row4, row5);
+      __m256i p3 = _mm256_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transposes, within each lane
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      dct_interleave8(p0, p1);
+      dct_interleave8(p2, p3);
+
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      // store
+      dct_store(out0, out_stride0, _mm256_castsi256_si128(p0), _mm256_castsi256_si128(p1),
+                _mm256_castsi256_si128(p2), _mm256_castsi256_si128(p3));
+      dct_store(out1, out_stride1, _mm256_extracti128_si256(p0, 1), _mm256_extracti128_si256(p1, 1),
+                _mm256_extracti128_si256(p2, 1), _mm256_extracti128_si256(p3, 1));
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_load
+#undef dct_store
+}
+
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2446,14 +2761,185 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// parallel decoding of baseline scans with restart markers. the entropy
+// decoder and dc predictions are reset at the start of every restart interval,
+// so once the markers have been found by scanning ahead, the intervals can be
+// decoded independently into their own blocks of the component buffers.
+
+#define STBI__MAX_PARALLEL_TASKS 64
+
+typedef struct
+{
+   STBI_SIMD_ALIGN(short, data[2][64]);
+   stbi_uc *out;   // destination of the block waiting in data[0]
+   int out_stride;
+   int pending;
+} stbi__idct_queue;
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **starts;   // first byte of each interval
+   stbi_uc *scan_end;  // the marker ending the scan
+   int num_units, num_intervals, per_task;
+   int failed[STBI__MAX_PARALLEL_TASKS];
+} stbi__jpeg_intervals;
+
+// transform the block just decoded into q->data[q->pending], pairing it up
+// with the previous one when there is a two-block idct
+static void stbi__idct_queue_put(stbi__jpeg *z, stbi__idct_queue *q, stbi_uc *out, int out_stride)
+{
+   if (!z->idct_pair_kernel) {
+      z->idct_block_kernel(out, out_stride, q->data[0]);
+   } else if (q->pending) {
+      z->idct_pair_kernel(q->out, q->out_stride, q->data[0], out, out_stride, q->data[1]);
+      q->pending = 0;
+   } else {
+      q->out = out;
+      q->out_stride = out_stride;
+      q->pending = 1;
+   }
+}
+
+static void stbi__idct_queue_flush(stbi__jpeg *z, stbi__idct_queue *q)
+{
+   if (q->pending)
+      z->idct_block_kernel(q->out, q->out_stride, q->data[0]);
+   q->pending = 0;
+}
+
+// number of units the restart interval counts: blocks of a non-interleaved
+// scan, or mcus of an interleaved one
+static int stbi__jpeg_scan_units(stbi__jpeg *z)
+{
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      return ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3);
+   }
+   return z->img_mcu_x * z->img_mcu_y;
+}
+
+// decode the blocks of one unit, in the same order as stbi__parse_entropy_coded_data
+static int stbi__jpeg_decode_unit(stbi__jpeg *z, stbi__idct_queue *q, int unit)
+{
+   int bs = 8 >> z->scale_shift;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      int w = (z->img_comp[n].x+7) >> 3;
+      int i = unit % w, j = unit / w;
+      int ha = z->img_comp[n].ha;
+      if (!stbi__jpeg_decode_block(z, q->data[q->pending], z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      stbi__idct_queue_put(z, q, z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2);
+   } else {
+      int i = unit % z->img_mcu_x, j = unit / z->img_mcu_x;
+      int k,x,y;
+      for (k=0; k < z->scan_n; ++k) {
+         int n = z->order[k];
+         for (y=0; y < z->img_comp[n].v; ++y) {
+            for (x=0; x < z->img_comp[n].h; ++x) {
+               int x2 = (i*z->img_comp[n].h + x)*bs;
+               int y2 = (j*z->img_comp[n].v + y)*bs;
+               int ha = z->img_comp[n].ha;
+               if (!stbi__jpeg_decode_block(z, q->data[q->pending], z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+               stbi__idct_queue_put(z, q, z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2);
+            }
+         }
+      }
+   }
+   return 1;
+}
+
+// decode a run of consecutive intervals, with a decoder state of its own
+static void stbi__jpeg_decode_intervals(void *data, int task)
+{
+   stbi__jpeg_intervals *p = (stbi__jpeg_intervals *) data;
+   int first = task * p->per_task;
+   int last = first + p->per_task < p->num_intervals ? first + p->per_task : p->num_intervals;
+   int i, u, ok = 1;
+   stbi__context s;
+   stbi__idct_queue q;
+   stbi__jpeg *z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) { p->failed[task] = 1; return; }
+   *z = *p->z;
+   z->s = &s;
+   q.pending = 0;
+   for (i = first; ok && i < last; ++i) {
+      int first_unit = i * z->restart_interval;
+      int last_unit = first_unit + z->restart_interval < p->num_units ? first_unit + z->restart_interval : p->num_units;
+      stbi__start_mem(&s, p->starts[i], (int) (p->scan_end - p->starts[i]));
+      stbi__jpeg_reset(z);
+      for (u = first_unit; ok && u < last_unit; ++u)
+         ok = stbi__jpeg_decode_unit(z, &q, u);
+   }
+   stbi__idct_queue_flush(z, &q);
+   p->failed[task] = !ok;
+   STBI_FREE(z);
+}
+
+// decode a baseline scan in parallel if it has restart markers. returns 1 on
+// success, leaving the input at the marker after the scan, or -1 if the scan
+// has to be decoded sequentially, e.g. to report an error
+static int stbi__jpeg_decode_parallel(stbi__jpeg *z)
+{
+   stbi__jpeg_intervals p;
+   stbi_uc *c, *end;
+   int found, num_tasks, t;
+
+   if (z->progressive || !z->restart_interval || !stbi__parallel_for || z->s->read_from_callbacks)
+      return -1;
+
+   p.num_units = stbi__jpeg_scan_units(z);
+   p.num_intervals = (p.num_units + z->restart_interval - 1) / z->restart_interval;
+   if (p.num_intervals < 2) return -1;
+   p.starts = (stbi_uc **) stbi__malloc(sizeof(stbi_uc *) * p.num_intervals);
+   if (!p.starts) return -1;
+
+   // find the restart markers, skipping stuffed zero bytes, up to the first
+   // other marker. there must be exactly one between consecutive intervals
+   c = z->s->img_buffer;
+   end = z->s->img_buffer_end;
+   p.starts[0] = c;
+   found = 1;
+   for (;;) {
+      c = (stbi_uc *) memchr(c, 0xff, end - c);
+      if (!c || c+1 >= end) { found = 0; break; }
+      if (c[1] == 0x00) { c += 2; continue; }
+      if (!STBI__RESTART(c[1])) break;
+      if (found == p.num_intervals) { found = 0; break; }
+      c += 2;
+      p.starts[found++] = c;
+   }
+   if (found != p.num_intervals) {
+      STBI_FREE(p.starts);
+      return -1;
+   }
+
+   p.z = z;
+   p.scan_end = c;
+   p.per_task = (p.num_intervals + STBI__MAX_PARALLEL_TASKS - 1) / STBI__MAX_PARALLEL_TASKS;
+   num_tasks = (p.num_intervals + p.per_task - 1) / p.per_task;
+   stbi__parallel_for(stbi__jpeg_decode_intervals, &p, num_tasks);
+   STBI_FREE(p.starts);
+
+   // decoding again sequentially overwrites whatever the tasks wrote
+   for (t=0; t < num_tasks; ++t)
+      if (p.failed[t]) return -1;
+
+   z->s->img_buffer = p.scan_end;
+   z->marker = STBI__MARKER_none;
+   return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
    if (!z->progressive) {
+      if (stbi__jpeg_decode_parallel(z) > 0) return 1;
       if (z->scan_n == 1) {
          int i,j;
          STBI_SIMD_ALIGN(short, data[64]);
          int n = z->order[0];
+         int bs = 8 >> z->scale_shift;
          // non-interleaved data, we just need to process one block at a time,
          // in trivial scanline order
          // number of blocks to do just depends on how many actual "pixels" this
@@ -2464,7 +2950,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2478,6 +2964,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          return 1;
       } else { // interleaved
          int i,j,k,x,y;
+         int bs = 8 >> z->scale_shift;
          STBI_SIMD_ALIGN(short, data[64]);
          for (j=0; j < z->img_mcu_y; ++j) {
             for (i=0; i < z->img_mcu_x; ++i) {
@@ -2488,8 +2975,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x)*bs;
+                        int y2 = (j*z->img_comp[n].v + y)*bs;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
                         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
@@ -2582,6 +3069,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
    if (z->progressive) {
       // dequantize and idct the data
       int i,j,n;
+      int bs = 8 >> z->scale_shift;
       for (n=0; n < z->s->img_n; ++n) {
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
@@ -2589,7 +3077,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
             }
          }
       }
@@ -2752,9 +3240,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // to simplify generation, we'll allocate enough memory to decode
       // the bogus oversized data from using interleaved MCUs and their
       // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
-      // discard the extra data until colorspace conversion
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // discard the extra data until colorspace conversion. blocks decoded
+      // at reduced scale take up (8 >> scale_shift)^2 pixels
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].raw_data = stbi__malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
 
       if (z->img_comp[i].raw_data == NULL) {
@@ -2768,8 +3257,8 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       z->img_comp[i].linebuf = NULL;
       if (z->progressive) {
-         z->img_comp[i].coeff_w = (z->img_comp[i].w2 + 7) >> 3;
-         z->img_comp[i].coeff_h = (z->img_comp[i].h2 + 7) >> 3;
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
          z->img_comp[i].raw_coeff = STBI_MALLOC(z->img_comp[i].coeff_w * z->img_comp[i].coeff_h * 64 * sizeof(short) + 15);
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
       } else {
@@ -3251,10 +3740,79 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// avx2 version of the step == 4 case of stbi__YCbCr_to_RGB_simd, 16 pixels at
+// a time, pixels 0-7 in the low lanes and 8-15 in the high lanes. bit-identical
+// to it; the remaining pixels and other steps are handed to it.
+STBI__AVX2_TARGET
+static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 4) {
+      __m256i c_bias    = _mm256_set1_epi16(128);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // load and widen to short
+         __m256i y_short  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y+i)));
+         __m256i cr_short = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcr+i)));
+         __m256i cb_short = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcb+i)));
+
+         // the same words as the sse2 unpack: (y << 8) + 128, and (c - 128) << 8
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(y_short, 8), y_bias);
+         __m256i crw = _mm256_slli_epi16(_mm256_sub_epi16(cr_short, c_bias), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_sub_epi16(cb_short, c_bias), 8);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte, set up for transpose
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+
+         // transpose to interleave channels; o0 holds pixels 0-3 and 8-11, o1
+         // pixels 4-7 and 12-15
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         // store in pixel order
+         _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+         _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+         out += 64;
+      }
+   }
+
+   stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   j->scale_shift = 0;
    j->idct_block_kernel = stbi__idct_block;
+   j->idct_pair_kernel = NULL;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
@@ -3268,6 +3826,15 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__avx2_available()) {
+      j->idct_pair_kernel = stbi__idct_simd_pair_avx2;
+      #ifndef STBI_JPEG_OLD
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      #endif
+   }
+#endif
+
 #ifdef STBI_NEON
    j->idct_block_kernel = stbi__idct_simd;
    #ifndef STBI_JPEG_OLD
@@ -3312,6 +3879,8 @@ typedef struct
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n;
+   stbi__uint32 img_x, img_y; // output size, reduced by scale_shift
+   int scale_round = (1 << z->scale_shift) - 1;
    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
    // validate req_comp
@@ -3319,6 +3888,8 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+   img_x = (z->s->img_x + scale_round) >> z->scale_shift;
+   img_y = (z->s->img_y + scale_round) >> z->scale_shift;
 
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n;
@@ -3342,13 +3913,13 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
          // allocate line buffer big enough for upsampling off the edges
          // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
+         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(img_x + 3);
          if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
          r->hs      = z->img_h_max / z->img_comp[k].h;
          r->vs      = z->img_v_max / z->img_comp[k].v;
          r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+         r->w_lores = (img_x + r->hs-1) / r->hs;
          r->ypos    = 0;
          r->line0   = r->line1 = z->img_comp[k].data;
 
@@ -3360,12 +3931,12 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
       }
 
       // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc(n * z->s->img_x * z->s->img_y + 1);
+      output = (stbi_uc *) stbi__malloc(n * img_x * img_y + 1);
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
+      for (j=0; j < img_y; ++j) {
+         stbi_uc *out = output + n * img_x * j;
          for (k=0; k < decode_n; ++k) {
             stbi__resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -3376,16 +3947,16 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
             if (++r->ystep >= r->vs) {
                r->ystep = 0;
                r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
+               if (++r->ypos < (z->img_comp[k].y + scale_round) >> z->scale_shift)
                   r->line1 += z->img_comp[k].w2;
             }
          }
          if (n >= 3) {
             stbi_uc *y = coutput[0];
             if (z->s->img_n == 3) {
-               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], img_x, n);
             } else
-               for (i=0; i < z->s->img_x; ++i) {
+               for (i=0; i < img_x; ++i) {
                   out[0] = out[1] = out[2] = y[i];
                   out[3] = 255; // not used if n==3
                   out += n;
@@ -3393,14 +3964,14 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          } else {
             stbi_uc *y = coutput[0];
             if (n == 1)
-               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+               for (i=0; i < img_x; ++i) out[i] = y[i];
             else
-               for (i=0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+               for (i=0; i < img_x; ++i) *out++ = y[i], *out++ = 255;
          }
       }
       stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
+      *out_x = img_x;
+      *out_y = img_y;
       if (comp) *comp  = z->s->img_n; // report original components, not output
       return output;
    }
@@ -3409,9 +3980,17 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 static unsigned char *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
    stbi__jpeg j;
+   stbi_uc *result;
    j.s = s;
    stbi__setup_jpeg(&j);
-   return load_jpeg_image(&j, x,y,comp,req_comp);
+   j.scale_shift = s->reduce_shift;
+   if      (j.scale_shift == 1) j.idct_block_kernel = stbi__idct_block_4;
+   else if (j.scale_shift == 2) j.idct_block_kernel = stbi__idct_block_2;
+   else if (j.scale_shift == 3) j.idct_block_kernel = stbi__idct_block_1;
+   if (j.scale_shift) j.idct_pair_kernel = NULL;
+   result = load_jpeg_image(&j, x,y,comp,req_comp);
+   if (result) s->reduced_shift = j.scale_shift;
+   return result;
 }
 
 static int stbi__jpeg_test(stbi__context *s)